@@ -41,19 +41,26 @@ function clear_compile_environment {
 function build_api {
 	cd phantom_api
 	make DEFINES="-DSD_CARD_PHANTOM_LOC=\\\"/boot/\\\" -DTARGET_BOARD=\\\"$BOARD_PART\\\" -DTARGET_FPGA=0"
-	cd ..
+	cd phantomd
+	make DEFINES="-DSD_CARD_PHANTOM_LOC=\\\"/boot/\\\" -DTARGET_BOARD=\\\"$BOARD_PART\\\" -DTARGET_FPGA=0"
+	cd ../..
 }
 
 function copy_api {
 	check_rootfs_valid
+	# phantom_api_private.h holds the library's internals and is not installed
+	api_headers=`ls phantom_api/*.h | grep -v _private.h`
 	if [ "$ROOTFS" == "multistrap" ]; then
 		sudo cp -v phantom_api/libphantom.so multistrap/rootfs/usr/lib/
-		sudo cp -v phantom_api/*.h multistrap/rootfs/usr/include/
+		sudo cp -v $api_headers multistrap/rootfs/usr/include/
+		sudo cp -v phantom_api/phantomd/phantomd multistrap/rootfs/usr/sbin/
 	elif [ "$ROOTFS" == "buildroot" ]; then
 		mkdir -p buildroot-phantom/board/phantom_zynq/overlay/usr/lib
 		mkdir -p buildroot-phantom/board/phantom_zynq/overlay/usr/include
+		mkdir -p buildroot-phantom/board/phantom_zynq/overlay/usr/sbin
 		cp -v phantom_api/libphantom.so buildroot-phantom/board/phantom_zynq/overlay/usr/lib/
-		cp -v phantom_api/*.h buildroot-phantom/board/phantom_zynq/overlay/usr/include/
+		cp -v $api_headers buildroot-phantom/board/phantom_zynq/overlay/usr/include/
+		cp -v phantom_api/phantomd/phantomd buildroot-phantom/board/phantom_zynq/overlay/usr/sbin/
 	fi
 }
 
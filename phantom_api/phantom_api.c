@@ -34,9 +34,8 @@
  *
  **********************************************************************************************
  *
- *  1. Add interrupt handling support (call backs etc.)
+ *  1. Add interrupt call backs (blocking waits done, see phantom_fpga_ip_wait_done()).
  *  2. Code to read bitfile header to we can check top-level design name and FPGA device p/n.
- *  3. Add DMA support (where useful).
  *
  */
 
@@ -51,14 +50,211 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <stddef.h>
 #include "phantom_api.h"
 #include "phantom_api_lowlevel.h"
+#include "phantom_api_private.h"
 #include "phantom_xml_parser.h"
 
 
 /* set API version number MAJOR.MINOR */
 static char version_num[5] = "0.11";
 
+/*
+ * Context behind the calls that take none, such as phantom_initialise() and phantom_fpga_get_ips(),
+ * so programs driving a single design need not manage one.
+ */
+static phantom_context_t default_ctx;
+static pthread_once_t default_ctx_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Start-up phase timings, recorded while startup_timing is set, see phantom_set_startup_timing().
+ * Process wide, as downloads and configurations are not tied to a context.
+ */
+static int startup_timing;
+static int first_start_seen; // PHANTOM_PHASE_FIRST_START recorded, read without phase_lock by phantom_fpga_ip_start()
+static phantom_phase_timing_t phase_timing[PHANTOM_NUM_PHASES];
+static pthread_mutex_t phase_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static void context_init(phantom_context_t *ctx)
+{
+	memset(ctx, 0, sizeof(phantom_context_t));
+	ctx->event_fd = -1;
+	ctx->dev_timeout_ms = UIO_READY_TIMEOUT_MS;
+	ctx->use_daemon = 1;
+	pthread_mutex_init(&ctx->lock, NULL);
+}
+
+
+
+static void context_free_ips(phantom_context_t *ctx)
+{
+	for(uint32_t i = 0; i < ctx->num_ip_state; i++)
+		pthread_mutex_destroy(&ctx->ip_lock[i]);
+	free(ctx->ip_wait);
+	free(ctx->ip_lock);
+	free(ctx->lease_slot);
+	free(ctx->lease_held);
+	ctx->ip_wait = NULL;
+	ctx->ip_lock = NULL;
+	ctx->lease_slot = NULL;
+	ctx->lease_held = NULL;
+	ctx->num_ip_state = 0;
+}
+
+
+
+/*
+ * Size the per IP state of a context for the IPs of its configuration.
+ */
+static int context_alloc_ips(phantom_context_t *ctx)
+{
+	uint32_t num = ctx->conf.num_comps;
+
+	if((ctx->num_ip_state == num) && (ctx->ip_wait != NULL))
+		return PHANTOM_OK; // re-initialised with as many IPs
+	context_free_ips(ctx);
+	ctx->ip_wait = calloc(num ? num : 1, sizeof(ip_wait_t));
+	ctx->ip_lock = calloc(num ? num : 1, sizeof(pthread_mutex_t));
+	ctx->lease_slot = calloc(num ? num : 1, sizeof(int));
+	ctx->lease_held = calloc(num ? num : 1, sizeof(phantom_lease_t));
+	if((ctx->ip_wait == NULL) || (ctx->ip_lock == NULL) || (ctx->lease_slot == NULL) || (ctx->lease_held == NULL))
+	{
+		context_free_ips(ctx);
+		return PHANTOM_ERROR;
+	}
+	for(uint32_t i = 0; i < num; i++)
+	{
+		pthread_mutex_init(&ctx->ip_lock[i], NULL);
+		ctx->lease_slot[i] = -1;
+	}
+	ctx->num_ip_state = num;
+	return PHANTOM_OK;
+}
+
+
+
+static void default_ctx_init(void)
+{
+	context_init(&default_ctx);
+}
+
+
+
+static phantom_context_t *get_default_ctx(void)
+{
+	pthread_once(&default_ctx_once, default_ctx_init);
+	return &default_ctx;
+}
+
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+
+/*
+ * Returns the start time of a phase, or 0 if start-up timing is off.
+ */
+static inline uint64_t phase_begin(void)
+{
+	return __atomic_load_n(&startup_timing, __ATOMIC_RELAXED) ? now_ns() : 0;
+}
+
+
+
+/*
+ * Record a run of a phase begun at start_ns, unless timing was off when it began. PHANTOM_PHASE_FIRST_START
+ * is only recorded once.
+ */
+static void phase_end(phantom_phase_t phase, uint64_t start_ns)
+{
+	phantom_phase_timing_t *t = &phase_timing[phase];
+	uint64_t end_ns;
+
+	if(start_ns == 0)
+		return;
+	end_ns = now_ns();
+	pthread_mutex_lock(&phase_lock);
+	if(phase == PHANTOM_PHASE_FIRST_START)
+	{
+		if(first_start_seen)
+		{
+			pthread_mutex_unlock(&phase_lock);
+			return;
+		}
+		__atomic_store_n(&first_start_seen, 1, __ATOMIC_RELAXED);
+	}
+	if(t->count++ == 0)
+		t->start_ns = start_ns;
+	t->end_ns = end_ns;
+	t->total_ns += end_ns - start_ns;
+	pthread_mutex_unlock(&phase_lock);
+}
+
+
+
+/*
+ * Index of an IP in its context, or -1 if the IP does not belong to a context.
+ */
+static int get_ip_idx(phantom_ip_t* ip)
+{
+	ptrdiff_t idx;
+
+	if(ip->ctx == NULL)
+		return -1;
+	idx = ip - ip->ctx->conf.comp;
+	if((idx < 0) || (idx >= ip->ctx->num_ip_state))
+		return -1;
+	return (int) idx;
+}
+
+
+
+/*
+ * Per IP wait state. Only the thread waiting on an IP updates its entry.
+ */
+static ip_wait_t *get_ip_wait(phantom_ip_t* ip)
+{
+	int idx = get_ip_idx(ip);
+
+	return (idx < 0) ? NULL : &ip->ctx->ip_wait[idx];
+}
+
+
+
+/*
+ * Per IP lock, held only across read-modify-write sequences on the IP's control registers.
+ * Plain register reads and writes need no lock.
+ */
+static inline void ip_lock(phantom_ip_t* ip)
+{
+	int idx = get_ip_idx(ip);
+
+	if(idx >= 0)
+		pthread_mutex_lock(&ip->ctx->ip_lock[idx]);
+}
+
+
+
+static inline void ip_unlock(phantom_ip_t* ip)
+{
+	int idx = get_ip_idx(ip);
+
+	if(idx >= 0)
+		pthread_mutex_unlock(&ip->ctx->ip_lock[idx]);
+}
+
 
 
 /*
@@ -95,6 +291,9 @@ int phantom_download(int phanom_platform_fd)
     struct stat filestat;
     int ret;
     off_t fsize;
+    FILE *xml_fp;
+    phantom_conf_t *conf;
+    uint64_t t0 = phase_begin();
 
     //
     // copy opened file to SD card
@@ -137,6 +336,19 @@ int phantom_download(int phanom_platform_fd)
 	sprintf(cmd, "tar -xz -C %s -f %s", SD_CARD_PHANTOM_LOC, SD_CARD_PHANTOM_DOWNLOAD_FILE);
 	system(cmd);
 
+    // compile the design's XML in to a snapshot now, so no later initialise has to parse it
+    if((xml_fp = fopen(SD_CARD_PHANTOM_FPGA_CONF_FILE, "r")) != NULL)
+    {
+        if((conf = malloc(sizeof(phantom_conf_t))) != NULL)
+        {
+            if(!phantom_conf(xml_fp, conf))
+                snapshot_save(conf, SD_CARD_PHANTOM_FPGA_CONF_FILE, SD_CARD_PHANTOM_FPGA_SNAPSHOT_FILE);
+            free(conf);
+        }
+        fclose(xml_fp);
+    }
+
+    phase_end(PHANTOM_PHASE_DOWNLOAD, t0);
     return PHANTOM_OK;
 }
 
@@ -155,36 +367,344 @@ int phantom_download(int phanom_platform_fd)
  *    PHANTOM_ERROR  - if initialisation unsuccessful.
  */
 int phantom_initialise()
+{
+	return phantom_context_initialise(get_default_ctx());
+}
+
+
+
+/*
+ * Sets how long phantom_initialise() waits for the uio nodes of the design's IP cores to appear,
+ * e.g. while udev creates them after the phantom module is loaded. Initialisation returns as soon
+ * as they are all ready. The default is UIO_READY_TIMEOUT_MS.
+ *
+ * Parameters:
+ *    timeout_ms - the maximum wait in milliseconds, 0 not to wait, or a negative value to wait forever.
+ *
+ * Return Value:
+ *    PHANTOM_OK
+ */
+int phantom_set_dev_timeout(const int timeout_ms)
+{
+	return phantom_context_set_dev_timeout(get_default_ctx(), timeout_ms);
+}
+
+
+
+/*
+ * Sets whether phantom_initialise() maps all the design's IP cores up front (PHANTOM_MAP_EAGER, the
+ * default), or each IP core only when it is first looked up by id, idstring or name, or first
+ * accessed (PHANTOM_MAP_LAZY). In lazy mode only the uio nodes of the IP cores used are opened, so a
+ * process driving one core of a large design starts faster; the first access to each core pays
+ * for its mapping instead. Must be called before phantom_initialise().
+ *
+ * Parameters:
+ *    mode - PHANTOM_MAP_EAGER or PHANTOM_MAP_LAZY.
+ *
+ * Return Value:
+ *    PHANTOM_OK, or PHANTOM_ERROR if the mode is invalid.
+ */
+int phantom_set_map_mode(const phantom_map_mode_t mode)
+{
+	return phantom_context_set_map_mode(get_default_ctx(), mode);
+}
+
+
+
+/*
+ * Sets whether phantom_initialise() attaches to phantomd, the resident daemon, when it is running.
+ * An attached process takes the design's configuration and its opened uio nodes from the daemon
+ * in one round trip, and phantom_fpga_configure() asks the daemon to configure the FPGA. The
+ * default is to use the daemon; if it is not running the API works as without it.
+ *
+ * Parameters:
+ *    use - non-zero to attach to the daemon if it is running, zero never to.
+ *
+ * Return Value:
+ *    PHANTOM_OK
+ */
+int phantom_set_use_daemon(const int use)
+{
+	return phantom_context_set_use_daemon(get_default_ctx(), use);
+}
+
+
+
+/*
+ * Turns timing of the start-up phases on or off, process wide. While on, each phase (see
+ * phantom_phase_t) records when it first began, when it last ended, its total time and how many
+ * times it ran, from CLOCK_MONOTONIC. Runs that fail are not recorded. Turning timing on clears
+ * the previous timings. It is off by default, costing one load per phase when off.
+ *
+ * Parameters:
+ *    enable - non-zero to start timing, zero to stop.
+ *
+ * Return Value:
+ *    PHANTOM_OK
+ */
+int phantom_set_startup_timing(const int enable)
+{
+	pthread_mutex_lock(&phase_lock);
+	if(enable)
+	{
+		memset(phase_timing, 0, sizeof(phase_timing));
+		__atomic_store_n(&first_start_seen, 0, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&startup_timing, enable ? 1 : 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&phase_lock);
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Gets the start-up phase timings recorded since timing was turned on with
+ * phantom_set_startup_timing(). Times are in nanoseconds; start_ns and end_ns are CLOCK_MONOTONIC
+ * times, so phases can be placed against each other. A phase that has not run has a count of 0.
+ *
+ * Parameters:
+ *    phases - array to be filled in, indexed by phantom_phase_t.
+ *    max_phases - number of entries in phases.
+ *
+ * Return Value:
+ *    The number of entries filled in, at most PHANTOM_NUM_PHASES, or PHANTOM_ERROR if phases is NULL.
+ */
+int phantom_get_startup_timing(phantom_phase_timing_t *phases, const int max_phases)
+{
+	int num = (max_phases < PHANTOM_NUM_PHASES) ? max_phases : PHANTOM_NUM_PHASES;
+
+	if((phases == NULL) || (num < 0))
+		return PHANTOM_ERROR;
+	pthread_mutex_lock(&phase_lock);
+	memcpy(phases, phase_timing, num * sizeof(phantom_phase_timing_t));
+	pthread_mutex_unlock(&phase_lock);
+	return num;
+}
+
+
+
+/*
+ * Creates an empty context. A context owns everything the API knows about one FPGA design: its
+ * configuration, the IP cores' mappings and their uio fds. Each context is initialised on its own
+ * with phantom_context_initialise(), so a process may hold several.
+ *
+ * Thread safety: different threads may access different IPs of a context, or of different
+ * contexts, concurrently. Register accesses to the same IP from several threads are also safe, as
+ * the read-modify-write calls (phantom_fpga_ip_start(), the autorestart and interrupt calls) take a
+ * per IP lock; ordering between such threads is the caller's concern. Only one thread should wait
+ * on an IP at a time, and initialise/destroy must not run concurrently with other calls on the
+ * same context.
+ *
+ * Parameters:
+ *    none.
+ *
+ * Return Value:
+ *    The context, or NULL if out of memory.
+ */
+phantom_context_t *phantom_context_create(void)
+{
+	phantom_context_t *ctx;
+
+	if((ctx = malloc(sizeof(phantom_context_t))) == NULL)
+		return NULL;
+	context_init(ctx);
+	return ctx;
+}
+
+
+
+/*
+ * As phantom_set_dev_timeout(), for phantom_context_initialise() of the given context.
+ */
+int phantom_context_set_dev_timeout(phantom_context_t *ctx, const int timeout_ms)
+{
+	ctx->dev_timeout_ms = timeout_ms;
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * As phantom_set_use_daemon(), for phantom_context_initialise() of the given context.
+ */
+int phantom_context_set_use_daemon(phantom_context_t *ctx, const int use)
+{
+	ctx->use_daemon = use ? 1 : 0;
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * As phantom_set_map_mode(), for phantom_context_initialise() of the given context.
+ */
+int phantom_context_set_map_mode(phantom_context_t *ctx, const phantom_map_mode_t mode)
+{
+	if((mode != PHANTOM_MAP_EAGER) && (mode != PHANTOM_MAP_LAZY))
+		return PHANTOM_ERROR;
+	ctx->map_mode = mode;
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Maps the IP core's slaves and shared memory in to user space if they are not mapped yet, first
+ * waiting for its uio nodes if needed. In lazy mode this is done on the first access to the core;
+ * calling it ahead of time takes that cost off the first access. In eager mode the core is already
+ * mapped. A failed mapping is undone, so can be retried.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ * Returns PHANTOM_OK if the core is mapped, or PHANTOM_ERROR if it could not be or its context
+ * is not initialised, e.g. after phantom_terminate().
+ *
+ */
+int phantom_fpga_ip_map(phantom_ip_t* ip)
+{
+	phantom_context_t *ctx;
+	uint64_t t0;
+	int ret = PHANTOM_OK;
+
+	if((ip == NULL) || ((ctx = ip->ctx) == NULL))
+		return PHANTOM_ERROR;
+	if(__atomic_load_n(&ip->mapped, __ATOMIC_ACQUIRE))
+		return PHANTOM_OK;
+
+	pthread_mutex_lock(&ctx->lock);
+	if(!ctx->initialised)
+		ret = PHANTOM_ERROR; // terminated, or not initialised yet
+	else if(!ip->mapped)
+	{
+		t0 = phase_begin();
+		if(open_ip_devs(ctx, ip) || map_component(ctx, ip))
+		{
+			#ifdef DEBUG
+				printf("error: unable to map %s\n", ip->idstring);
+			#endif
+			ret = PHANTOM_ERROR;
+		}
+		else
+			phase_end(PHANTOM_PHASE_MAP, t0);
+	}
+	pthread_mutex_unlock(&ctx->lock);
+	return ret;
+}
+
+
+
+/*
+ * Returns the IP, mapping it first in lazy mode, or NULL if it could not be mapped.
+ */
+static phantom_ip_t *lookup_ip(phantom_ip_t *ip)
+{
+	if((ip == NULL) || (ip->ctx == NULL) || (ip->ctx->map_mode != PHANTOM_MAP_LAZY))
+		return ip;
+	return (phantom_fpga_ip_map(ip) == PHANTOM_OK) ? ip : NULL;
+}
+
+
+
+/*
+ * Returns 1 if an IP of the context has an async queue open or shared memory allocated, which
+ * includes the buffers of its streams and rings, else 0.
+ */
+static int context_in_use(phantom_context_t *ctx)
+{
+	phantom_ip_t *ips = get_phantom_component_array(&ctx->conf);
+	uint32_t num_comps = get_phantom_component_count(&ctx->conf);
+	phantom_mem_stats_t stats;
+
+	for(uint32_t i = 0; i < num_comps; i++)
+	{
+		if(ips[i].async_queue != NULL)
+			return 1;
+		if(ips[i].mem_pool != NULL)
+		{
+			mem_pool_get_stats(ips[i].mem_pool, &stats);
+			if(stats.in_use != 0)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+
+
+/*
+ * Initialises a context from the downloaded FPGA design, as phantom_initialise() does for the
+ * default context: the design's XML is parsed in to the context and its IP cores mapped in to user space.
+ * A context that is already initialised is released first, and is refused while any of its IPs has
+ * an async queue open or shared memory allocated, as the callers' IPs and buffers would be lost.
+ *
+ * Parameters:
+ *    ctx - the context.
+ *
+ * Return Value:
+ *    PHANTOM_OK     - if initialisation successful.
+ *    PHANTOM_ERROR  - if initialisation unsuccessful.
+ */
+int phantom_context_initialise(phantom_context_t *ctx)
 {
 	FILE *xml_fp;
 	int num_ph_comps;
 	phantom_ip_t *phantom_ipcores_ptr;
 	phantom_platform_info_t* ph_platform;
+	uint64_t t0 = phase_begin(), t;
+	int attached;
 
-	/* attempt to open phantom_fpga_conf.xml file. */
-	if((xml_fp = fopen(SD_CARD_PHANTOM_FPGA_CONF_FILE, "r"))==NULL)
+	if(context_in_use(ctx))
 	{
 		#ifdef DEBUG
-			printf("error: unable to open fpga_conf.xml file\n");
-			perror("api error");
+			printf("error: unable to initialise a context with async queues, streams, rings or buffers open\n");
 		#endif
 		return PHANTOM_ERROR;
 	}
-
-    /* init API from downloaded xml */
-	if(phantom_conf(xml_fp))
+	ctx->initialised = 0;
+	/* release the mappings and uio nodes of a previous initialise, before its configuration goes */
+	unmap_devs(ctx);
+	close_devs(ctx);
+
+	/* attach to phantomd if it is running, taking the configuration and uio nodes it holds */
+	t = phase_begin();
+	if((attached = ctx->use_daemon && !daemon_attach(ctx)))
+		phase_end(PHANTOM_PHASE_ATTACH, t);
+
+	/* else use the design's configuration snapshot if it is up to date, otherwise parse the XML */
+	t = phase_begin();
+	if(!attached && snapshot_load(&ctx->conf, SD_CARD_PHANTOM_FPGA_CONF_FILE, SD_CARD_PHANTOM_FPGA_SNAPSHOT_FILE))
 	{
-		fclose(xml_fp);
-		#ifdef DEBUG
-			printf("phantom_conf() error\n");
-		#endif
-		return PHANTOM_ERROR;
+		/* attempt to open phantom_fpga_conf.xml file. */
+		if((xml_fp = fopen(SD_CARD_PHANTOM_FPGA_CONF_FILE, "r"))==NULL)
+		{
+			#ifdef DEBUG
+				printf("error: unable to open fpga_conf.xml file\n");
+				perror("api error");
+			#endif
+			return PHANTOM_ERROR;
+		}
+
+	    /* init API from downloaded xml */
+		if(phantom_conf(xml_fp, &ctx->conf))
+		{
+			fclose(xml_fp);
+			#ifdef DEBUG
+				printf("phantom_conf() error\n");
+			#endif
+			return PHANTOM_ERROR;
 
+		}
+		fclose(xml_fp);
+		snapshot_save(&ctx->conf, SD_CARD_PHANTOM_FPGA_CONF_FILE, SD_CARD_PHANTOM_FPGA_SNAPSHOT_FILE);
 	}
-	fclose(xml_fp);
+	if(!attached)
+		phase_end(PHANTOM_PHASE_CONF, t);
+	if(context_alloc_ips(ctx))
+		return PHANTOM_ERROR;
+	for(uint32_t i = 0; i < ctx->conf.num_comps; i++)
+		ctx->conf.comp[i].ctx = ctx;
 
     /* Ensure the target board required by the FPGA design matches the running platform */
-	ph_platform = phantom_platform_get_info();
+	ph_platform = phantom_context_get_platform_info(ctx);
 	if(strcmp(ph_platform->platform, "generic") && strcmp(ph_platform->platform, TARGET_BOARD))
 	{
 		#ifdef DEBUG
@@ -203,25 +723,44 @@ int phantom_initialise()
 	}
 
 	/* map core components to user space (virtual memory) */
-	if(open_devs())
+	t = phase_begin();
+	if(!attached && open_devs(ctx))
 	{
 		#ifdef DEBUG
 			printf("error: open_devs() failed\n");
 		#endif
-		close_devs();
+		close_devs(ctx);
 		return PHANTOM_ERROR;
 	}
-	if((num_ph_comps = phantom_fpga_get_num_ips()) < 0)
+	if(!attached)
+		phase_end(PHANTOM_PHASE_OPEN_DEVS, t);
+	if((num_ph_comps = phantom_context_get_num_ips(ctx)) < 0)
 		return PHANTOM_ERROR;
-    phantom_ipcores_ptr = phantom_fpga_get_ips();
-    unmap_devs();
+    phantom_ipcores_ptr = phantom_context_get_ips(ctx);
+    if(ctx->map_mode == PHANTOM_MAP_LAZY)
+    {
+    	ctx->initialised = 1;
+    	phase_end(PHANTOM_PHASE_INITIALISE, t0);
+    	return PHANTOM_OK; // each IP is mapped on first use
+    }
     for(int i = 0; i < num_ph_comps; i++)
     {
-       if(map_component(phantom_ipcores_ptr))
-    		   return PHANTOM_ERROR;
+       t = phase_begin();
+       if(map_component(ctx, phantom_ipcores_ptr))
+       {
+    	   #ifdef DEBUG
+    		   printf("error: unable to map %s\n", phantom_ipcores_ptr->idstring);
+    	   #endif
+    	   unmap_devs(ctx); // the cores mapped before this one
+    	   close_devs(ctx);
+    	   return PHANTOM_ERROR;
+       }
+       phase_end(PHANTOM_PHASE_MAP, t);
        phantom_ipcores_ptr++;
     }
 
+    ctx->initialised = 1;
+    phase_end(PHANTOM_PHASE_INITIALISE, t0);
     return PHANTOM_OK;
 }
 
@@ -281,6 +820,8 @@ int phantom_fpga_is_done()
  * (on the platform’s SD card) and uses it to configure the FPGA. The function examines
  * the bitfile to ensure it is compatible with the FPGA device specified in the XML conf
  * file in the PHANTOM fs. TBD. The function finally checks the FPGA’s DONE pin is asserted on return.
+ * If phantomd is running, the daemon configures the FPGA, so configurations requested by several
+ * processes are never interleaved.
  *
  * Parameters:
  *    None.
@@ -291,44 +832,24 @@ int phantom_fpga_is_done()
  */
 int phantom_fpga_configure(void)
 {
-    int xdevcfg_fd;
-    struct stat filestat;
-    int ret;
-    off_t size;
-    int bitfile_fd;
     char bitfile_name[200];
     phantom_platform_info_t *ph_hwinfo;
+    uint64_t t0 = phase_begin();
+    int ret;
 
-    ph_hwinfo = get_phantom_platform_info();
-    sprintf(bitfile_name, "%s%s", SD_CARD_PHANTOM_FPGA_BITFILE_LOC, ph_hwinfo->bitfile);
-    bitfile_fd = open(bitfile_name, O_RDONLY);
-    if(bitfile_fd < 0)
+    /* phantomd, if it is running, configures the FPGA one request at a time */
+    if(!get_default_ctx()->use_daemon || ((ret = daemon_configure()) == PHANTOM_NOT_FOUND))
     {
-		#ifdef DEBUG
-    		printf("error: can't open bitfile %s\n", bitfile_name);
-		#endif
-        return PHANTOM_ERROR;
+        ph_hwinfo = phantom_platform_get_info();
+        sprintf(bitfile_name, "%s%s", SD_CARD_PHANTOM_FPGA_BITFILE_LOC, ph_hwinfo->bitfile);
+        if((ret = fpga_configure(bitfile_name)) == PHANTOM_OK)
+            ret = phantom_fpga_is_done();
     }
 
-    fstat(bitfile_fd, &filestat);
-    size = filestat.st_size;
-
-    xdevcfg_fd = open(FPGA_CFG_FILE, O_WRONLY);
-    if(xdevcfg_fd < 0)
-    {
-    	close(bitfile_fd);
-        return PHANTOM_ERROR;
-    }
-
-    ret = sendfile(xdevcfg_fd, bitfile_fd, NULL, size);
-    close(xdevcfg_fd);
-	close(bitfile_fd);
-
-    if (ret < 0)
-        return PHANTOM_FALSE;
-
-    return phantom_fpga_is_done();
-}
+    if(ret == PHANTOM_OK)
+        phase_end(PHANTOM_PHASE_CONFIGURE, t0);
+    return ret;
+}
 
 
 
@@ -390,12 +911,21 @@ int phantom_fpga_reset_global(void)
  *    None.
  *
  * Return Value:
- *    int value containing number of IP cores;
- *    returns -1 if number of IP cores exceeds MAX_PHANTOM_COMPONENTS.
+ *    int value containing number of IP cores.
 */
 int phantom_fpga_get_num_ips()
 {
-    return get_phantom_component_count();
+    return phantom_context_get_num_ips(get_default_ctx());
+}
+
+
+
+/*
+ * As phantom_fpga_get_num_ips(), for the IP cores of the given context.
+ */
+int phantom_context_get_num_ips(phantom_context_t *ctx)
+{
+    return get_phantom_component_count(&ctx->conf);
 }
 
 
@@ -413,7 +943,17 @@ int phantom_fpga_get_num_ips()
  */
 phantom_ip_t *phantom_fpga_get_ips()
 {
-	return get_phantom_component_array();
+	return phantom_context_get_ips(get_default_ctx());
+}
+
+
+
+/*
+ * As phantom_fpga_get_ips(), for the IP cores of the given context.
+ */
+phantom_ip_t *phantom_context_get_ips(phantom_context_t *ctx)
+{
+	return get_phantom_component_array(&ctx->conf);
 }
 
 
@@ -423,12 +963,12 @@ phantom_ip_t *phantom_fpga_get_ips()
  * Parameter:
  *    idx - index of struct array
  * Return:
- *    struct from indexed array of structs.
+ *    struct from indexed array of structs, or NULL if idx is out of range.
  *
  */
-phantom_ip_t *phantom_fpga_get_ip_from_idx(const uint8_t idx)
+phantom_ip_t *phantom_fpga_get_ip_from_idx(const uint32_t idx)
 {
-	return get_phantom_component(idx);
+	return get_phantom_component(&get_default_ctx()->conf, idx);
 }
 
 
@@ -441,16 +981,9 @@ phantom_ip_t *phantom_fpga_get_ip_from_idx(const uint8_t idx)
  *     struct of specified core on success, else NULL.
  *
  */
-phantom_ip_t *phantom_fpga_get_ip(const uint8_t id)
+phantom_ip_t *phantom_fpga_get_ip(const uint32_t id)
 {
-	phantom_ip_t* ip_ptr;
-	for(uint8_t i = 0; i < MAX_PHANTOM_COMPONENTS; i++)
-	{
-		ip_ptr = get_phantom_component(i);
-		if(ip_ptr->id == id)
-			return ip_ptr;
-	}
-	return NULL;
+	return lookup_ip(phantom_conf_find_id(&get_default_ctx()->conf, id));
 }
 
 
@@ -465,14 +998,17 @@ phantom_ip_t *phantom_fpga_get_ip(const uint8_t id)
  */
 phantom_ip_t *phantom_fpga_get_ip_from_idstr(const char *idstr)
 {
-	phantom_ip_t* ip_ptr;
-	for(uint8_t i = 0; i < MAX_PHANTOM_COMPONENTS; i++)
-	{
-		ip_ptr = get_phantom_component(i);
-		if(!strcmp(ip_ptr->idstring, idstr))
-			return ip_ptr;
-	}
-	return NULL;
+	return phantom_context_get_ip_from_idstr(get_default_ctx(), idstr);
+}
+
+
+
+/*
+ * As phantom_fpga_get_ip_from_idstr(), for the IP cores of the given context.
+ */
+phantom_ip_t *phantom_context_get_ip_from_idstr(phantom_context_t *ctx, const char *idstr)
+{
+	return lookup_ip(phantom_conf_find_idstr(&ctx->conf, idstr));
 }
 
 
@@ -480,27 +1016,61 @@ phantom_ip_t *phantom_fpga_get_ip_from_idstr(const char *idstr)
 /*
  * After a call to phantom_initialise() this function will return a populated struct with the given Phantom component ip name.
  * Parameters:
- *     idstr - id string of requested core
+ *     ipname - ip name of requested core
  * Return:
  *     first struct found of specified core on success, else NULL.
  *
  */
 phantom_ip_t *phantom_fpga_get_ip_from_name(const char *ipname)
 {
-	phantom_ip_t* ip_ptr;
-	for(uint8_t i = 0; i < MAX_PHANTOM_COMPONENTS; i++)
+	return lookup_ip(phantom_conf_find_name(&get_default_ctx()->conf, ipname));
+}
+
+
+
+/*
+ * After a call to phantom_initialise() this function finds every instance of the given Phantom component ip name.
+ * Parameters:
+ *     ipname - ip name of requested cores
+ *     ips - array filled with the first max_ips instances, in design order
+ *     max_ips - entries in ips
+ * Return:
+ *     number of instances in the design, which may be more than max_ips,
+ *     or PHANTOM_ERROR if an instance could not be mapped in lazy mode.
+ *
+ */
+int phantom_fpga_get_ips_from_name(const char *ipname, phantom_ip_t **ips, const int max_ips)
+{
+	return phantom_context_get_ips_from_name(get_default_ctx(), ipname, ips, max_ips);
+}
+
+
+
+/*
+ * As phantom_fpga_get_ips_from_name(), for the IP cores of the given context.
+ */
+int phantom_context_get_ips_from_name(phantom_context_t *ctx, const char *ipname, phantom_ip_t **ips, const int max_ips)
+{
+	phantom_ip_t *ip;
+	int n = 0;
+
+	for(ip = phantom_conf_find_name(&ctx->conf, ipname); ip != NULL; ip = phantom_conf_next_name(&ctx->conf, ip), n++)
 	{
-		ip_ptr = get_phantom_component(i);
-		if(!strcmp(ip_ptr->ipname , ipname))
-			return ip_ptr;
+		if(n < max_ips)
+		{
+			if(lookup_ip(ip) == NULL)
+				return PHANTOM_ERROR;
+			ips[n] = ip;
+		}
 	}
-	return NULL;
+	return n;
 }
 
 
 
 /*
  * Starts the specified IP core. Has no effect if the core is already started.
+ * If a spin or hybrid wait policy is set the start time is recorded, see phantom_fpga_ip_set_wait_policy().
  * Parameters
  *    ip – The IP core to control.
  * Returns PHANTOM_OK if the core started successfully, or PHANTOM_ERROR if not.
@@ -509,8 +1079,19 @@ phantom_ip_t *phantom_fpga_get_ip_from_name(const char *ipname)
  */
 int phantom_fpga_ip_start(phantom_ip_t* ip)
 {
-	phantom_data_t reg = reg_read(ip->s0_vmem_base, IPCORE_CTRL_ADDR);
-	reg_write(ip->s0_vmem_base, IPCORE_CTRL_ADDR, reg | IPCORE_CTRL_AP_START_BM);
+	ip_wait_t *w = get_ip_wait(ip);
+	if(ip_ensure_mapped(ip))
+		return PHANTOM_ERROR;
+	if(__builtin_expect(__atomic_load_n(&startup_timing, __ATOMIC_RELAXED), 0) &&
+	   !__atomic_load_n(&first_start_seen, __ATOMIC_RELAXED))
+		phase_end(PHANTOM_PHASE_FIRST_START, now_ns());
+	if((w != NULL) && (w->policy != PHANTOM_WAIT_SLEEP))
+		w->start_ns = now_ns(); // job duration feeds the adaptive spin budget
+
+	ip_lock(ip);
+	uint32_t reg = reg_read32(ip->s0_vmem_base, IPCORE_CTRL_ADDR);
+	reg_write32(ip->s0_vmem_base, IPCORE_CTRL_ADDR, reg | IPCORE_CTRL_AP_START_BM);
+	ip_unlock(ip);
 
     return PHANTOM_OK;
 }
@@ -527,8 +1108,13 @@ int phantom_fpga_ip_start(phantom_ip_t* ip)
  */
 int phantom_fpga_ip_set_autorestart(phantom_ip_t* ip)
 {
-	phantom_data_t reg = reg_read(ip->s0_vmem_base, IPCORE_CTRL_ADDR);
-	reg_write(ip->s0_vmem_base, IPCORE_CTRL_ADDR, reg | IPCORE_CTRL_AUTORESTART_BM);
+	if(ip_ensure_mapped(ip))
+		return PHANTOM_ERROR;
+
+	ip_lock(ip);
+	uint32_t reg = reg_read32(ip->s0_vmem_base, IPCORE_CTRL_ADDR);
+	reg_write32(ip->s0_vmem_base, IPCORE_CTRL_ADDR, reg | IPCORE_CTRL_AUTORESTART_BM);
+	ip_unlock(ip);
 
     return PHANTOM_OK;
 }
@@ -544,8 +1130,13 @@ int phantom_fpga_ip_set_autorestart(phantom_ip_t* ip)
  */
 int phantom_fpga_ip_clear_autorestart(phantom_ip_t* ip)
 {
-	phantom_data_t reg = reg_read(ip->s0_vmem_base, IPCORE_CTRL_ADDR);
-	reg_write(ip->s0_vmem_base, IPCORE_CTRL_ADDR, reg & ~IPCORE_CTRL_AUTORESTART_BM);
+	if(ip_ensure_mapped(ip))
+		return PHANTOM_ERROR;
+
+	ip_lock(ip);
+	uint32_t reg = reg_read32(ip->s0_vmem_base, IPCORE_CTRL_ADDR);
+	reg_write32(ip->s0_vmem_base, IPCORE_CTRL_ADDR, reg & ~IPCORE_CTRL_AUTORESTART_BM);
+	ip_unlock(ip);
 
     return PHANTOM_OK;
 }
@@ -564,7 +1155,9 @@ int phantom_fpga_ip_clear_autorestart(phantom_ip_t* ip)
  */
 int phantom_fpga_ip_is_done(phantom_ip_t* ip)
 {
-	if(reg_read(ip->s0_vmem_base, IPCORE_CTRL_ADDR) & IPCORE_CTRL_AP_DONE_BM)
+	if(ip_ensure_mapped(ip))
+		return PHANTOM_ERROR;
+	if(reg_read32(ip->s0_vmem_base, IPCORE_CTRL_ADDR) & IPCORE_CTRL_AP_DONE_BM)
 		return PHANTOM_OK;
 	return PHANTOM_FALSE;
 }
@@ -581,7 +1174,9 @@ int phantom_fpga_ip_is_done(phantom_ip_t* ip)
  */
 int phantom_fpga_ip_is_idle(phantom_ip_t* ip)
 {
-	if(reg_read(ip->s0_vmem_base, IPCORE_CTRL_ADDR) & IPCORE_CTRL_AP_IDLE_BM)
+	if(ip_ensure_mapped(ip))
+		return PHANTOM_ERROR;
+	if(reg_read32(ip->s0_vmem_base, IPCORE_CTRL_ADDR) & IPCORE_CTRL_AP_IDLE_BM)
 		return PHANTOM_OK;
 	return PHANTOM_FALSE;
 
@@ -589,6 +1184,442 @@ int phantom_fpga_ip_is_idle(phantom_ip_t* ip)
 
 
 
+/*
+ * Enables the core's ap_done and ap_ready interrupts and arms the uio interrupt. Stale events are
+ * cleared first so the interrupt line is not asserted on enable.
+ * Returns 0 on success, -1 if the core has no usable interrupt.
+ */
+static int ip_irq_arm(phantom_ip_t* ip)
+{
+	uint32_t isr;
+
+	if((ip->s0_vmem_base == NULL) || (ip->s0_uio_fd < 0))
+		return -1;
+
+	ip_lock(ip);
+	isr = reg_read32(ip->s0_vmem_base, IPCORE_ISR_ADDR);
+	if(isr)
+		reg_write32(ip->s0_vmem_base, IPCORE_ISR_ADDR, isr); // toggle-on-write
+	reg_write32(ip->s0_vmem_base, IPCORE_IER_ADDR, IPCORE_IER_CH0_BM | IPCORE_IER_CH1_BM);
+	reg_write32(ip->s0_vmem_base, IPCORE_GIER_ADDR, IPCORE_GIER_EN_BM);
+	ip_unlock(ip);
+
+	return uio_irq_enable(ip->s0_uio_fd);
+}
+
+
+
+/*
+ * Acknowledges a taken interrupt in the core, then re-arms the uio interrupt for the next one.
+ * Returns 0 on success, -1 on error.
+ */
+static int ip_irq_ack(phantom_ip_t* ip)
+{
+	uint32_t isr;
+
+	/* ISR is toggle-on-write, so two racing acks would set the bits again */
+	ip_lock(ip);
+	isr = reg_read32(ip->s0_vmem_base, IPCORE_ISR_ADDR);
+	reg_write32(ip->s0_vmem_base, IPCORE_ISR_ADDR, isr);
+	ip_unlock(ip);
+	return uio_irq_enable(ip->s0_uio_fd);
+}
+
+
+
+/*
+ * Folds an observed job duration in to the IP's running average and derives the spin budget from
+ * it: jobs expected to finish within WAIT_SPIN_MAX_NS are spun on for a little longer than average,
+ * longer jobs are not spun on at all. For waits that slept, the excess over the average estimates
+ * the interrupt wakeup latency.
+ */
+static void wait_account(ip_wait_t *w, uint64_t done_ns, int slept)
+{
+	phantom_wait_stats_t *st = &w->stats;
+	uint64_t job_ns, budget_ns;
+	uint32_t wakeup_ns;
+
+	if(slept)
+		st->num_sleeps++;
+	else
+		st->num_spin_done++;
+	if(w->start_ns == 0)
+		return; // not started through phantom_fpga_ip_start(), duration unknown
+
+	job_ns = done_ns - w->start_ns;
+	w->start_ns = 0;
+	if(job_ns > UINT32_MAX)
+		job_ns = UINT32_MAX;
+
+	if(slept && (st->avg_job_ns != 0) && (job_ns > st->avg_job_ns))
+	{
+		wakeup_ns = job_ns - st->avg_job_ns;
+		st->wakeup_ns_total += wakeup_ns;
+		if(wakeup_ns > st->wakeup_ns_max)
+			st->wakeup_ns_max = wakeup_ns;
+	}
+
+	if(st->avg_job_ns == 0)
+		st->avg_job_ns = job_ns;
+	else
+		st->avg_job_ns += ((int64_t) job_ns - (int64_t) st->avg_job_ns) >> WAIT_EWMA_SHIFT;
+
+	budget_ns = st->avg_job_ns + (st->avg_job_ns >> 1);
+	st->spin_budget_ns = (budget_ns <= WAIT_SPIN_MAX_NS) ? budget_ns : 0;
+}
+
+
+
+/*
+ * Selects how phantom_fpga_ip_wait_done() waits for the specified IP:
+ *    PHANTOM_WAIT_SLEEP - block on the IP's interrupt (the default).
+ *    PHANTOM_WAIT_SPIN - poll the control register, no interrupt needed.
+ *    PHANTOM_WAIT_HYBRID - poll for an adaptive spin budget, then block on the interrupt.
+ * Under the spin and hybrid policies phantom_fpga_ip_start() timestamps each job so the spin
+ * budget can follow the IP's observed job durations. Selecting a policy resets the IP's wait statistics.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    policy (phantom_wait_policy_t) – The wait policy.
+ * Returns PHANTOM_OK if the policy was set, or PHANTOM_ERROR if not.
+ *
+ */
+int phantom_fpga_ip_set_wait_policy(phantom_ip_t* ip, const phantom_wait_policy_t policy)
+{
+	ip_wait_t *w = get_ip_wait(ip);
+
+	if((w == NULL) || (policy > PHANTOM_WAIT_HYBRID))
+		return PHANTOM_ERROR;
+
+	memset(w, 0, sizeof(ip_wait_t));
+	w->policy = policy;
+	if(policy == PHANTOM_WAIT_HYBRID)
+		w->stats.spin_budget_ns = WAIT_SPIN_MAX_NS; // spin fully until the first durations are seen
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Copies the wait statistics of the specified IP, see phantom_fpga_ip_set_wait_policy().
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    stats (phantom_wait_stats_t*) – The struct to fill.
+ * Returns PHANTOM_OK on success, or PHANTOM_ERROR if not.
+ *
+ */
+int phantom_fpga_ip_get_wait_stats(phantom_ip_t* ip, phantom_wait_stats_t *stats)
+{
+	ip_wait_t *w = get_ip_wait(ip);
+
+	if((w == NULL) || (stats == NULL))
+		return PHANTOM_ERROR;
+
+	*stats = w->stats;
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Blocks until the specified IP has completed its execution. How it waits is set by
+ * phantom_fpga_ip_set_wait_policy(); by default it sleeps on the IP's interrupt instead of polling
+ * the control register. When sleeping, the core's ap_done and ap_ready interrupts are enabled, and
+ * each interrupt taken is acknowledged in the core and re-armed in the kernel.
+ * Like phantom_fpga_ip_is_done(), a successful return clears the core's ap_done flag.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core to wait on.
+ *    timeout_ms (int) – The maximum time to wait in milliseconds, or a negative value to wait forever.
+ * Returns PHANTOM_OK if the core completed, PHANTOM_FALSE on timeout, or PHANTOM_ERROR if the
+ * core has no usable interrupt.
+ * Note: slave s0 must be assigned to IP core control registers, and for the sleep policy its uio
+ * node must have an interrupt. The hybrid policy keeps spinning if there is no interrupt.
+ *
+ */
+int phantom_fpga_ip_wait_done(phantom_ip_t* ip, const int timeout_ms)
+{
+	ip_wait_t *w = get_ip_wait(ip);
+	phantom_wait_policy_t policy = (w != NULL) ? w->policy : PHANTOM_WAIT_SLEEP;
+	uint64_t now, deadline = 0, spin_end;
+	int remaining_ms = timeout_ms;
+
+	if(ip_ensure_mapped(ip) || (ip->s0_vmem_base == NULL))
+		return PHANTOM_ERROR;
+
+	now = now_ns();
+	if(timeout_ms > 0)
+		deadline = now + timeout_ms * 1000000ULL;
+	if(w != NULL)
+		w->stats.num_waits++;
+
+	if(policy != PHANTOM_WAIT_SLEEP)
+	{
+		if((policy == PHANTOM_WAIT_SPIN) || (ip->s0_uio_fd < 0))
+			spin_end = (timeout_ms < 0) ? UINT64_MAX : deadline; // spin for the whole wait
+		else
+			spin_end = now + w->stats.spin_budget_ns;
+		if((timeout_ms > 0) && (spin_end > deadline))
+			spin_end = deadline;
+
+		do
+		{
+			w->stats.spin_polls++;
+			if(reg_read32(ip->s0_vmem_base, IPCORE_CTRL_ADDR) & IPCORE_CTRL_AP_DONE_BM)
+			{
+				wait_account(w, now_ns(), 0);
+				return PHANTOM_OK;
+			}
+		}
+		while((now = now_ns()) < spin_end);
+
+		if((policy == PHANTOM_WAIT_SPIN) || (ip->s0_uio_fd < 0) || (timeout_ms == 0))
+			return PHANTOM_FALSE;
+	}
+
+	if(ip_irq_arm(ip))
+		return PHANTOM_ERROR;
+
+	for(;;)
+	{
+		/* the interrupt is armed, so a completion after this read still wakes the wait below */
+		if(reg_read32(ip->s0_vmem_base, IPCORE_CTRL_ADDR) & IPCORE_CTRL_AP_DONE_BM)
+		{
+			if(w != NULL)
+				wait_account(w, now_ns(), 1);
+			return PHANTOM_OK;
+		}
+
+		if(timeout_ms > 0)
+		{
+			now = now_ns();
+			if(now >= deadline)
+				return PHANTOM_FALSE;
+			remaining_ms = (deadline - now + 999999) / 1000000;
+		}
+		else if(timeout_ms == 0)
+			return PHANTOM_FALSE;
+
+		switch(uio_irq_wait(ip->s0_uio_fd, remaining_ms))
+		{
+			case 0:
+				break;
+			case 1:
+				return PHANTOM_FALSE;
+			default:
+				return PHANTOM_ERROR;
+		}
+
+		if(ip_irq_ack(ip))
+			return PHANTOM_ERROR;
+	}
+}
+
+
+
+/*
+ * Returns a file descriptor that becomes readable when the specified IP raises its interrupt, for use
+ * with poll(), select() or epoll in the caller's own event loop. The core's interrupts are enabled and
+ * armed by this call. When the fd is readable call phantom_fpga_ip_ack() to find out whether the core
+ * completed and to re-arm it. The fd belongs to the API; do not read or close it.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ * Returns the file descriptor, or PHANTOM_ERROR if the core has no usable interrupt.
+ * Note: arm before starting the core, or its completion may be missed.
+ *
+ */
+int phantom_fpga_ip_get_fd(phantom_ip_t* ip)
+{
+	if(ip_ensure_mapped(ip) || ip_irq_arm(ip))
+		return PHANTOM_ERROR;
+	return ip->s0_uio_fd;
+}
+
+
+
+/*
+ * Consumes a pending interrupt of the specified IP, acknowledges it and re-arms the interrupt.
+ * Does not block. Like phantom_fpga_ip_is_done(), a PHANTOM_OK return clears the core's ap_done flag.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ * Returns PHANTOM_OK if the core has completed, PHANTOM_FALSE if not, or PHANTOM_ERROR on error.
+ *
+ */
+int phantom_fpga_ip_ack(phantom_ip_t* ip)
+{
+	uint32_t ctrl;
+
+	if(ip_ensure_mapped(ip) || (ip->s0_vmem_base == NULL) || (ip->s0_uio_fd < 0))
+		return PHANTOM_ERROR;
+	if(uio_irq_wait(ip->s0_uio_fd, 0) < 0)
+		return PHANTOM_ERROR;
+
+	/* ack before sampling ap_done so a completion racing this call raises a fresh interrupt */
+	if(ip_irq_ack(ip))
+		return PHANTOM_ERROR;
+	ctrl = reg_read32(ip->s0_vmem_base, IPCORE_CTRL_ADDR);
+
+	return (ctrl & IPCORE_CTRL_AP_DONE_BM) ? PHANTOM_OK : PHANTOM_FALSE;
+}
+
+
+
+/*
+ * Returns a single file descriptor that becomes readable when any IP core with an interrupt raises it.
+ * The fd is an epoll instance over the cores' uio fds, so it can itself be added to the caller's
+ * epoll set or event loop. The first call enables and arms the interrupts of every core; later calls
+ * return the same fd. Use phantom_fpga_collect_done() when it is readable.
+ * Parameters
+ *    None.
+ * Returns the file descriptor, or PHANTOM_ERROR if it could not be created or no core has an interrupt.
+ * Note: do not mix with phantom_fpga_ip_wait_done() on the same cores.
+ *
+ */
+int phantom_fpga_get_event_fd(void)
+{
+	return phantom_context_get_event_fd(get_default_ctx());
+}
+
+
+
+/*
+ * As phantom_fpga_get_event_fd(), over the IP cores of the given context.
+ */
+int phantom_context_get_event_fd(phantom_context_t *ctx)
+{
+	phantom_ip_t *ips = phantom_context_get_ips(ctx);
+	int num_ips = phantom_context_get_num_ips(ctx);
+	struct epoll_event ev;
+	int num_added = 0;
+	int event_fd;
+
+	pthread_mutex_lock(&ctx->lock);
+	if(ctx->event_fd >= 0)
+	{
+		pthread_mutex_unlock(&ctx->lock);
+		return ctx->event_fd;
+	}
+	if((event_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	{
+		pthread_mutex_unlock(&ctx->lock);
+		#ifdef DEBUG
+			perror("error: unable to create event fd");
+		#endif
+		return PHANTOM_ERROR;
+	}
+	for(int i = 0; i < num_ips; i++)
+	{
+		if(ip_irq_arm(&ips[i]))
+			continue; // core without an interrupt
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if(epoll_ctl(event_fd, EPOLL_CTL_ADD, ips[i].s0_uio_fd, &ev))
+		{
+			#ifdef DEBUG
+				perror("error: unable to add ip to event fd");
+			#endif
+			continue;
+		}
+		num_added++;
+	}
+	if(num_added == 0)
+	{
+		close(event_fd);
+		event_fd = PHANTOM_ERROR;
+	}
+	else
+		ctx->event_fd = event_fd;
+	pthread_mutex_unlock(&ctx->lock);
+	return event_fd;
+}
+
+
+
+/*
+ * Collects the IP cores that have completed since the last call, acknowledging and re-arming the
+ * interrupt of every core that raised one. Does not block, so call it when the fd returned by
+ * phantom_fpga_get_event_fd() is readable.
+ * Parameters
+ *    done (phantom_ip_t**) – Array receiving the completed cores.
+ *    max_done (int) – Size of the done array.
+ * Returns the number of completed cores written to done, or PHANTOM_ERROR on error.
+ * Note: cores that raised an interrupt but did not fit in done stay pending for the next call.
+ *
+ */
+int phantom_fpga_collect_done(phantom_ip_t **done, const int max_done)
+{
+	return phantom_context_collect_done(get_default_ctx(), done, max_done);
+}
+
+
+
+/*
+ * As phantom_fpga_collect_done(), when the fd returned by phantom_context_get_event_fd() is readable.
+ */
+int phantom_context_collect_done(phantom_context_t *ctx, phantom_ip_t **done, const int max_done)
+{
+	struct epoll_event evs[MAX_PHANTOM_COMPONENTS];
+	phantom_ip_t *ips = phantom_context_get_ips(ctx);
+	int num_evs, num_done = 0;
+
+	if((ctx->event_fd < 0) || (max_done <= 0))
+		return PHANTOM_ERROR;
+	do
+		num_evs = epoll_wait(ctx->event_fd, evs, (max_done < MAX_PHANTOM_COMPONENTS) ? max_done : MAX_PHANTOM_COMPONENTS, 0);
+	while((num_evs < 0) && (errno == EINTR));
+	if(num_evs < 0)
+		return PHANTOM_ERROR;
+
+	for(int i = 0; i < num_evs; i++)
+	{
+		phantom_ip_t *ip = &ips[evs[i].data.u32];
+		switch(phantom_fpga_ip_ack(ip))
+		{
+			case PHANTOM_OK:
+				done[num_done++] = ip;
+				break;
+			case PHANTOM_FALSE:
+				break; // ap_ready only
+			default:
+				return PHANTOM_ERROR;
+		}
+	}
+	return num_done;
+}
+
+
+
+/*
+ * Returns the mapped base of the given AXI slave of the IP if the byte range [addr, addr + len)
+ * lies inside it, else NULL. Used to bounds check register accesses, and block transfers once per range.
+ */
+static void *get_slave_range(phantom_ip_t* ip, const phantom_address_t addr, const uint32_t len, const uint8_t axi_slave)
+{
+	void *vmem_base;
+	uint32_t size;
+
+	if(ip_ensure_mapped(ip))
+		return NULL;
+	switch (axi_slave)
+	{
+		case 0:
+			vmem_base = ip->s0_vmem_base;
+			size = ip->s0_axi_address_size;
+			break;
+		case 1:
+			vmem_base = ip->s1_vmem_base;
+			size = ip->s1_axi_address_size;
+			break;
+		default:
+			return NULL;
+	}
+	if((vmem_base == NULL) || (addr > size) || (len > size - addr))
+		return NULL; // also an unused slave, which has no mapping and a size of 0
+
+	return vmem_base;
+}
+
+
+
 /*
  * Set a value inside one of two AXI slave address spaces of the IP. addr is based from 0 and will be automatically
  * offset to the appropriate base address (phantom_ip_t.base_address).
@@ -604,21 +1635,11 @@ int phantom_fpga_ip_is_idle(phantom_ip_t* ip)
  */
 int phantom_fpga_ip_set(phantom_ip_t* ip, phantom_address_t addr, phantom_data_t val, uint8_t axi_slave)
 {
-	switch (axi_slave)
-	{
-		case 0:
-			if(addr >= ip->s0_axi_address_size)
-				return PHANTOM_ERROR;
-			reg_write(ip->s0_vmem_base, addr, val);
-			break;
-		case 1:
-			if(addr >= ip->s1_axi_address_size)
-				return PHANTOM_ERROR;
-			reg_write(ip->s1_vmem_base, addr, val);
-			break;
-		default:
-			return PHANTOM_ERROR;
-	}
+	void *vmem_base;
+
+	if((vmem_base = get_slave_range(ip, addr, sizeof(phantom_data_t), axi_slave)) == NULL)
+		return PHANTOM_ERROR;
+	reg_write_data(vmem_base, addr, val);
 
 	return PHANTOM_OK;
 }
@@ -637,21 +1658,376 @@ int phantom_fpga_ip_set(phantom_ip_t* ip, phantom_address_t addr, phantom_data_t
  */
 phantom_data_t phantom_fpga_ip_get(phantom_ip_t* ip, const phantom_address_t addr, const uint8_t axi_slave)
 {
-	switch (axi_slave)
+	void *vmem_base;
+
+	if((vmem_base = get_slave_range(ip, addr, sizeof(phantom_data_t), axi_slave)) == NULL)
+		return 0;
+	return reg_read_data(vmem_base, addr);
+}
+
+
+
+/*
+ * Copy a block of bytes in to one of two AXI slave address spaces of the IP. addr is based from 0
+ * and will be automatically offset to the appropriate base address (phantom_ip_t.base_address).
+ * The whole range is bounds checked once and then moved with the widest accesses the CPU
+ * supports; unaligned leading and trailing bytes are written singly.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core to write to.
+ *    addr (phantom_address_t) – The start address, based at 0, inside the address space of the IP core.
+ *    buf (const void*) – The data to copy.
+ *    len (uint32_t) – The number of bytes to copy.
+ *    axi_slave - slave number: 0 = s0 axi slave, 1 = s1 axi slave.
+ * Returns PHANTOM_OK if the block was written, or PHANTOM_ERROR if not.
+ *
+ */
+int phantom_fpga_ip_set_block(phantom_ip_t* ip, const phantom_address_t addr, const void *buf, const uint32_t len, const uint8_t axi_slave)
+{
+	void *vmem_base;
+
+	if((vmem_base = get_slave_range(ip, addr, len, axi_slave)) == NULL)
+		return PHANTOM_ERROR;
+	reg_write_block(vmem_base, addr, buf, len);
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Copy a block of bytes from one of two AXI slave address spaces of the IP. See phantom_fpga_ip_set_block().
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core to read from.
+ *    addr (phantom_address_t) – The start address, based at 0, inside the address space of the IP core.
+ *    buf (void*) – The buffer to receive the data.
+ *    len (uint32_t) – The number of bytes to copy.
+ *    axi_slave - slave number: 0 = s0 axi slave, 1 = s1 axi slave.
+ * Returns PHANTOM_OK if the block was read, or PHANTOM_ERROR if not.
+ * Note: if the AXI bus stalls this function will hang.
+ *
+ */
+int phantom_fpga_ip_get_block(phantom_ip_t* ip, const phantom_address_t addr, void *buf, const uint32_t len, const uint8_t axi_slave)
+{
+	void *vmem_base;
+
+	if((vmem_base = get_slave_range(ip, addr, len, axi_slave)) == NULL)
+		return PHANTOM_ERROR;
+	reg_read_block(vmem_base, addr, buf, len);
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Fill a validated handle for one of the two AXI slave address spaces of the IP. The handle can
+ * then be used with the inline phantom_handle_set()/phantom_handle_get() accessors in phantom_api.h,
+ * which skip the slave switch and range compare of phantom_fpga_ip_set()/phantom_fpga_ip_get().
+ * The handle is valid until phantom_terminate() is called.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    axi_slave - slave number: 0 = s0 axi slave, 1 = s1 axi slave.
+ *    handle (phantom_ip_handle_t*) – The handle to fill.
+ * Returns PHANTOM_OK if the handle was filled, or PHANTOM_ERROR if the slave is not mapped.
+ *
+ */
+int phantom_fpga_ip_get_handle(phantom_ip_t* ip, const uint8_t axi_slave, phantom_ip_handle_t *handle)
+{
+	void *vmem_base;
+
+	if((vmem_base = get_slave_range(ip, 0, sizeof(phantom_data_t), axi_slave)) == NULL)
+		return PHANTOM_ERROR;
+
+	handle->vmem_base = vmem_base;
+	handle->size = axi_slave ? ip->s1_axi_address_size : ip->s0_axi_address_size;
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Returns the reserved memory shared between the CPU and the AXI masters of the IP. Buffers placed
+ * here can be handed to the IP by physical address instead of being copied through the slave registers.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    phys (phantom_address_t*) – If not NULL, receives the physical (bus) address of the memory.
+ *    size (uint32_t*) – If not NULL, receives the size of the memory in bytes.
+ * Returns the virtual address of the memory, or NULL if the IP has no mapped master memory.
+ *
+ */
+void *phantom_fpga_ip_get_mem(phantom_ip_t* ip, phantom_address_t *phys, uint32_t *size)
+{
+	if(ip_ensure_mapped(ip) || (ip->m0_vmem_base == NULL))
+		return NULL;
+
+	if(phys != NULL)
+		*phys = ip->m0_axi_base_address;
+	if(size != NULL)
+		*size = ip->m0_axi_address_size;
+
+	return ip->m0_vmem_base;
+}
+
+
+
+/*
+ * Allocate a physically contiguous buffer from the shared memory of the IP's AXI masters. Buffers are
+ * rounded up to a power of two of at least 128 bytes and aligned to their size, so they start on an AXI
+ * burst boundary. Use phantom_fpga_mem_get_phys() to obtain the address to program in to the IP.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core whose shared memory to allocate from.
+ *    size (uint32_t) – The size of the buffer in bytes.
+ * Returns the virtual address of the buffer, or NULL if the IP has no shared memory or it is exhausted.
+ *
+ */
+void *phantom_fpga_mem_alloc(phantom_ip_t* ip, const uint32_t size)
+{
+	if(ip_ensure_mapped(ip) || (ip->mem_pool == NULL))
+		return NULL;
+	return mem_pool_alloc(ip->mem_pool, size);
+}
+
+
+
+/*
+ * Return a buffer obtained from phantom_fpga_mem_alloc() to the IP's pool.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core the buffer was allocated from.
+ *    ptr (void*) – The buffer, may be NULL.
+ *
+ */
+void phantom_fpga_mem_free(phantom_ip_t* ip, void *ptr)
+{
+	if((ip->mem_pool == NULL) || (ptr == NULL))
+		return;
+	mem_pool_free(ip->mem_pool, ptr);
+}
+
+
+
+/*
+ * Translate a virtual address inside the IP's shared memory to the physical address seen by the IP.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    ptr (const void*) – An address inside the shared memory, e.g. from phantom_fpga_mem_alloc().
+ * Returns the physical address, or 0 if ptr is outside the shared memory.
+ *
+ */
+phantom_address_t phantom_fpga_mem_get_phys(phantom_ip_t* ip, const void *ptr)
+{
+	uintptr_t offset = (uintptr_t) ptr - (uintptr_t) ip->m0_vmem_base;
+
+	if((ip->m0_vmem_base == NULL) || (offset >= ip->m0_axi_address_size))
+		return 0;
+	return ip->m0_axi_base_address + offset;
+}
+
+
+
+/*
+ * Translate a physical address inside the IP's shared memory, e.g. one written back by the IP, to
+ * a virtual address.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    phys (phantom_address_t) – A physical address inside the shared memory.
+ * Returns the virtual address, or NULL if phys is outside the shared memory.
+ *
+ */
+void *phantom_fpga_mem_get_virt(phantom_ip_t* ip, const phantom_address_t phys)
+{
+	if((ip->m0_vmem_base == NULL) || (phys < ip->m0_axi_base_address) || (phys - ip->m0_axi_base_address >= ip->m0_axi_address_size))
+		return NULL;
+	return (uint8_t *) ip->m0_vmem_base + (phys - ip->m0_axi_base_address);
+}
+
+
+
+/*
+ * Report usage and fragmentation of the IP's buffer pool.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    stats (phantom_mem_stats_t*) – The struct to fill.
+ * Returns PHANTOM_OK, or PHANTOM_NOT_FOUND if the IP has no shared memory.
+ *
+ */
+int phantom_fpga_mem_get_stats(phantom_ip_t* ip, phantom_mem_stats_t *stats)
+{
+	if(ip_ensure_mapped(ip))
+		return PHANTOM_ERROR;
+	if(ip->mem_pool == NULL)
+		return PHANTOM_NOT_FOUND;
+	mem_pool_get_stats(ip->mem_pool, stats);
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Remaps the shared memory of the IP's AXI masters cacheable, so the CPU reads and writes buffers
+ * at normal memory speed. Unless the masters are cache coherent, every hand-off of a buffer between
+ * the CPU and the IP must then be bracketed with phantom_fpga_mem_end_cpu_access() before the IP is
+ * started and phantom_fpga_mem_begin_cpu_access() once it is done. Must be called before any buffer
+ * is allocated from the IP's pool.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    coherent (int) – Non-zero if the IP's masters snoop the CPU caches, e.g. through the ACP on
+ *    Zynq-7000 or an HPC port on Zynq UltraScale+; maintenance is then reduced to barriers.
+ * Returns PHANTOM_OK, PHANTOM_NOT_FOUND if the IP has no shared memory, or PHANTOM_ERROR if buffers
+ * are allocated, the memory is not in the kernel's linear map (a no-map reserved-memory node) or
+ * cannot be remapped or, for non coherent masters, the CPU does not allow cache maintenance from
+ * user space (32-bit ARM). Rings and DMA channels cannot be opened on non coherent cached memory.
+ *
+ */
+int phantom_fpga_mem_set_cached(phantom_ip_t* ip, const int coherent)
+{
+	phantom_mem_stats_t stats;
+	mem_pool_t *pool;
+	void *mmem;
+
+	if(ip_ensure_mapped(ip))
+		return PHANTOM_ERROR;
+	if(ip->mem_pool == NULL)
+		return PHANTOM_NOT_FOUND;
+	if(ip->m0_cache & MEM_CACHED)
+		return PHANTOM_OK;
+	if(!coherent && !cache_maintenance_supported())
 	{
-		case 0:
-			if(addr >= ip->s0_axi_address_size)
-				return 0;
-			return reg_read(ip->s0_vmem_base, addr);
-			break;
-		case 1:
-			if(addr >= ip->s1_axi_address_size)
-				return 0;
-			return reg_read(ip->s1_vmem_base, addr);
-			break;
-		default:
-			return 0;
+		#ifdef DEBUG
+			printf("error: no user space cache maintenance, %s shared memory left uncached\n", ip->idstring);
+		#endif
+		return PHANTOM_ERROR;
 	}
+	mem_pool_get_stats(ip->mem_pool, &stats);
+	if(stats.in_use != 0)
+		return PHANTOM_ERROR;
+
+	if((mmem = map_mem_cached(ip->m0_axi_base_address, ip->m0_axi_address_size)) == NULL)
+		return PHANTOM_ERROR;
+	if((pool = mem_pool_create(mmem, ip->m0_axi_base_address, ip->m0_axi_address_size)) == NULL)
+	{
+		munmap(mmem, ip->m0_axi_address_size);
+		return PHANTOM_ERROR;
+	}
+	mem_pool_destroy(ip->mem_pool);
+	munmap(ip->m0_vmem_base, ip->m0_axi_address_size);
+	ip->mem_pool = pool;
+	ip->m0_vmem_base = mmem;
+	ip->m0_cache = MEM_CACHED | (coherent ? MEM_COHERENT : 0);
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Checks a range lies inside the IP's shared memory. Returns 0 if so, -1 if not.
+ */
+static int mem_check_range(phantom_ip_t* ip, const void *ptr, const uint32_t len)
+{
+	uintptr_t offset = (uintptr_t) ptr - (uintptr_t) ip->m0_vmem_base;
+
+	if((ip->m0_vmem_base == NULL) || (offset >= ip->m0_axi_address_size) || (len > ip->m0_axi_address_size - offset))
+		return -1;
+	return 0;
+}
+
+
+
+/*
+ * Writes CPU writes to a range of the IP's cacheable shared memory back to memory, so the IP reads them.
+ * Has no effect on uncached or coherent shared memory beyond a barrier.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    ptr (const void*) – Start of the range, inside the shared memory.
+ *    len (uint32_t) – Length of the range in bytes.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR if the range is outside the shared memory.
+ *
+ */
+int phantom_fpga_mem_clean(phantom_ip_t* ip, const void *ptr, const uint32_t len)
+{
+	if(mem_check_range(ip, ptr, len))
+		return PHANTOM_ERROR;
+	if((ip->m0_cache & (MEM_CACHED | MEM_COHERENT)) == MEM_CACHED)
+		cache_clean_range(ptr, len);
+	else
+		cache_barrier();
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Discards cached copies of a range of the IP's cacheable shared memory, so the CPU reads what the IP
+ * wrote. User space cannot discard lines without writing them back, so this is a flush: the CPU
+ * must not have written the range since it was handed to the IP.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR if the range is outside the shared memory.
+ *
+ */
+int phantom_fpga_mem_invalidate(phantom_ip_t* ip, const void *ptr, const uint32_t len)
+{
+	return phantom_fpga_mem_flush(ip, ptr, len);
+}
+
+
+
+/*
+ * Writes back and discards cached copies of a range of the IP's cacheable shared memory.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR if the range is outside the shared memory.
+ *
+ */
+int phantom_fpga_mem_flush(phantom_ip_t* ip, const void *ptr, const uint32_t len)
+{
+	if(mem_check_range(ip, ptr, len))
+		return PHANTOM_ERROR;
+	if((ip->m0_cache & (MEM_CACHED | MEM_COHERENT)) == MEM_CACHED)
+		cache_flush_range(ptr, len);
+	else
+		cache_barrier();
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Hands a buffer in the IP's shared memory to the CPU, after the IP has completed
+ * (phantom_fpga_ip_is_done() or phantom_fpga_ip_wait_done()). Data the IP wrote is made visible.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    ptr (const void*) – The buffer.
+ *    len (uint32_t) – Length of the buffer in bytes.
+ *    dir (phantom_mem_dir_t) – PHANTOM_MEM_FROM_DEVICE or PHANTOM_MEM_BIDIRECTIONAL if the IP wrote
+ *    the buffer, PHANTOM_MEM_TO_DEVICE if it only read it.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR if the range is outside the shared memory.
+ *
+ */
+int phantom_fpga_mem_begin_cpu_access(phantom_ip_t* ip, const void *ptr, const uint32_t len, const phantom_mem_dir_t dir)
+{
+	if(dir & PHANTOM_MEM_FROM_DEVICE)
+		return phantom_fpga_mem_invalidate(ip, ptr, len);
+	return mem_check_range(ip, ptr, len) ? PHANTOM_ERROR : PHANTOM_OK;
+}
+
+
+
+/*
+ * Hands a buffer in the IP's shared memory to the IP, before it is started with phantom_fpga_ip_start().
+ * CPU writes are made visible to the IP and, if the IP will write the buffer, no dirty line is left
+ * that could later be evicted over its data.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    ptr (const void*) – The buffer.
+ *    len (uint32_t) – Length of the buffer in bytes.
+ *    dir (phantom_mem_dir_t) – PHANTOM_MEM_TO_DEVICE if the IP only reads the buffer,
+ *    PHANTOM_MEM_FROM_DEVICE or PHANTOM_MEM_BIDIRECTIONAL if it writes it.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR if the range is outside the shared memory.
+ *
+ */
+int phantom_fpga_mem_end_cpu_access(phantom_ip_t* ip, const void *ptr, const uint32_t len, const phantom_mem_dir_t dir)
+{
+	if(dir & PHANTOM_MEM_FROM_DEVICE)
+		return phantom_fpga_mem_flush(ip, ptr, len);
+	return phantom_fpga_mem_clean(ip, ptr, len);
 }
 
 
@@ -666,7 +2042,17 @@ phantom_data_t phantom_fpga_ip_get(phantom_ip_t* ip, const phantom_address_t add
  */
 phantom_platform_info_t *phantom_platform_get_info()
 {
-	return get_phantom_platform_info();
+	return phantom_context_get_platform_info(get_default_ctx());
+}
+
+
+
+/*
+ * As phantom_platform_get_info(), for the design of the given context.
+ */
+phantom_platform_info_t *phantom_context_get_platform_info(phantom_context_t *ctx)
+{
+	return get_phantom_platform_info(&ctx->conf);
 }
 
 
@@ -680,6 +2066,51 @@ phantom_platform_info_t *phantom_platform_get_info()
  */
 void phantom_terminate(void)
 {
-	unmap_devs();
-	close_devs();
+	phantom_context_t *ctx = get_default_ctx();
+	phantom_ip_t *ips = phantom_context_get_ips(ctx);
+
+	for(int i = 0; i < phantom_context_get_num_ips(ctx); i++)
+		phantom_fpga_async_close(&ips[i]);
+	if(ctx->event_fd >= 0)
+	{
+		close(ctx->event_fd);
+		ctx->event_fd = -1;
+	}
+	lease_close(ctx);
+	ctx->initialised = 0; // so a later access fails rather than mapping the IP again
+	unmap_devs(ctx);
+	close_devs(ctx);
+}
+
+
+
+/*
+ * Releases everything held by a context, as phantom_terminate() does for the default context, and
+ * frees it. The context's IPs must no longer be in use.
+ * Parameters:
+ *    ctx - the context, may be NULL.
+ * Return Value:
+ *    None
+ *
+ */
+void phantom_context_destroy(phantom_context_t *ctx)
+{
+	phantom_ip_t *ips;
+
+	if(ctx == NULL)
+		return;
+	ips = phantom_context_get_ips(ctx);
+	for(int i = 0; i < phantom_context_get_num_ips(ctx); i++)
+		phantom_fpga_async_close(&ips[i]);
+	if(ctx->event_fd >= 0)
+		close(ctx->event_fd);
+	lease_close(ctx);
+	ctx->initialised = 0; // so a later access fails rather than mapping the IP again
+	unmap_devs(ctx);
+	close_devs(ctx);
+	free_devs(ctx);
+	context_free_ips(ctx);
+	phantom_conf_free(&ctx->conf);
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
 }
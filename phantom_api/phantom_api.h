@@ -59,7 +59,13 @@
 #define PHANTOM_NOT_FOUND -3
 
 
-/* maximum permitted cores definition */
+/* DMA transfer directions */
+#define PHANTOM_DMA_TO_IP 0
+#define PHANTOM_DMA_FROM_IP 1
+
+
+/* Cores are no longer limited in number; this remains as a batch size for callers, e.g. of
+   phantom_fpga_collect_done(). See phantom_fpga_get_num_ips() for the size of a design. */
 #define MAX_PHANTOM_COMPONENTS 30
 
 
@@ -79,6 +85,10 @@
 typedef enum {FCLKRESETN0=1, FCLKRESETN1=2, FCLKRESETN2=4, FCLKRESETN3=8} fclkresetn_type_t;
 
 
+/* An FPGA design opened by the API, owning its configuration, mappings and uio fds. See phantom_context_create(). */
+typedef struct phantom_context phantom_context_t;
+
+
 /* Struct for representing a single PHANTOM IP core. Can have multiple cores in FPGA PL. */
 typedef struct {
     char *ipname; // name of Phantom fpga core
@@ -89,11 +99,82 @@ typedef struct {
 	uint32_t s0_axi_address_size;
 	phantom_address_t s1_axi_base_address;
 	uint32_t s1_axi_address_size;
-	uint32_t *s0_vmem_base; /* private */
-	uint32_t *s1_vmem_base; /* private */
+	phantom_data_t *s0_vmem_base; /* private */
+	phantom_data_t *s1_vmem_base; /* private */
+	/* fields below were added after the original layout, so the ones above keep their offsets */
+	phantom_address_t m0_axi_base_address; // reserved memory shared by the IP's AXI masters
+	uint32_t m0_axi_address_size;
+	void *m0_vmem_base; /* private */
+	void *mem_pool; /* private */
+	int s0_uio_fd; /* private */
+	void *async_queue; /* private */
+	phantom_context_t *ctx; /* private, the context owning the IP */
+	uint8_t m0_cache; /* private */
+	uint8_t mapped; /* private */
 } phantom_ip_t;
 
 
+/* Struct to report usage of the buffer pool over an IP's shared memory. Sizes are in bytes. */
+typedef struct {
+	uint32_t total_size; // size of the shared memory managed by the pool
+	uint32_t in_use; // currently allocated, rounded up to block sizes
+	uint32_t peak_in_use; // high water mark of in_use
+	uint32_t free; // free in the pool, excluding blocks held in thread caches
+	uint32_t largest_free; // largest block that can currently be allocated
+	uint32_t fragmentation; // percentage of free memory not in the largest free block
+	uint32_t num_allocs;
+	uint32_t num_frees;
+	uint32_t num_failed; // allocations that could not be satisfied
+} phantom_mem_stats_t;
+
+
+/* Direction of a CPU access hand-off on cacheable shared memory, see phantom_fpga_mem_begin_cpu_access(). */
+typedef enum {PHANTOM_MEM_TO_DEVICE=1, PHANTOM_MEM_FROM_DEVICE=2, PHANTOM_MEM_BIDIRECTIONAL=3} phantom_mem_dir_t;
+
+
+/* Lease on an IP core shared between processes, see phantom_fpga_ip_lease(). */
+typedef enum {PHANTOM_LEASE_SHARED=1, PHANTOM_LEASE_EXCLUSIVE=2} phantom_lease_t;
+
+
+/* When phantom_initialise() maps the IP cores, see phantom_set_map_mode(). */
+typedef enum {PHANTOM_MAP_EAGER=0, PHANTOM_MAP_LAZY=1} phantom_map_mode_t;
+
+
+/* How phantom_fpga_ip_wait_done() waits for an IP core, see phantom_fpga_ip_set_wait_policy(). */
+typedef enum {PHANTOM_WAIT_SLEEP=0, PHANTOM_WAIT_SPIN=1, PHANTOM_WAIT_HYBRID=2} phantom_wait_policy_t;
+
+
+/* Struct to report how waits on an IP core were satisfied. Times are in ns. */
+typedef struct {
+	uint32_t spin_budget_ns; // current adaptive spin budget of the hybrid policy
+	uint32_t avg_job_ns; // running average of observed job durations, start to done
+	uint32_t num_waits;
+	uint32_t num_spin_done; // waits that saw the core done while spinning
+	uint32_t num_sleeps; // waits that blocked on the core's interrupt
+	uint64_t spin_polls; // control register reads made while spinning
+	uint64_t wakeup_ns_total; // estimated interrupt wakeup latency summed over waits that slept
+	uint32_t wakeup_ns_max;
+} phantom_wait_stats_t;
+
+
+/* An asynchronous job for an IP core, see phantom_fpga_async_submit(). Owned by the caller. */
+typedef struct phantom_job {
+	const void *args; // written in to the IP before it is started, may be NULL
+	uint32_t args_len; // bytes at args
+	phantom_address_t args_addr; // where the arguments go, based from 0 inside the AXI slave
+	uint8_t axi_slave;
+	void (*callback)(struct phantom_job *); // called from the dispatcher thread on completion, may be NULL
+	void *user_data;
+	int status; // PHANTOM_OK once run, or PHANTOM_ERROR if the arguments could not be written or the core timed out
+	phantom_ip_t *ip; // set to the IP core the job runs on, before it is started
+	uint32_t state; /* private */
+} phantom_job_t;
+
+
+/* Instances of one IP core sharing a job queue, see phantom_fpga_group_open(). */
+typedef struct phantom_group phantom_group_t;
+
+
 /* Struct to hold PHANTOM platform information. */
 typedef struct {
 	char *platform;
@@ -104,6 +185,65 @@ typedef struct {
 } phantom_platform_info_t;
 
 
+/* Scatter-gather DMA channel, see phantom_fpga_dma_open(). */
+typedef struct phantom_dma_chan phantom_dma_t;
+
+
+/* Multi-buffered stream over an IP core's shared memory, see phantom_fpga_stream_open(). */
+typedef struct phantom_stream phantom_stream_t;
+
+
+/* Struct to report the stage timings of a stream. Times are in ns, summed over all frames. */
+typedef struct {
+	uint32_t num_frames; // sets completed by the core
+	uint64_t fill_ns; // CPU filling inputs, get_input to submit
+	uint64_t drain_ns; // CPU draining outputs, get_output to release
+	uint64_t fpga_ns; // core busy, start to seen done
+	uint64_t wait_ns; // CPU blocked waiting for the core
+	uint64_t elapsed_ns; // first start to last completion
+	uint32_t overlap_pct; // percentage of fpga_ns hidden behind CPU work
+} phantom_stream_stats_t;
+
+
+/* Start-up phases timed when start-up timing is enabled, see phantom_set_startup_timing(). */
+typedef enum {
+	PHANTOM_PHASE_DOWNLOAD=0, // phantom_download()
+	PHANTOM_PHASE_CONFIGURE, // phantom_fpga_configure()
+	PHANTOM_PHASE_INITIALISE, // phantom_initialise(), including the four phases below
+	PHANTOM_PHASE_ATTACH, // taking the configuration and uio nodes from phantomd
+	PHANTOM_PHASE_CONF, // loading the configuration from its snapshot or XML
+	PHANTOM_PHASE_OPEN_DEVS, // finding the uio nodes, and waiting for them
+	PHANTOM_PHASE_MAP, // mapping an IP core, once per core; in lazy mode including its uio nodes
+	PHANTOM_PHASE_FIRST_START, // the first phantom_fpga_ip_start(), a point in time
+	PHANTOM_NUM_PHASES
+} phantom_phase_t;
+
+
+/* Struct to report the timing of one start-up phase. Times are CLOCK_MONOTONIC, in ns. */
+typedef struct {
+	uint64_t start_ns; // when the phase first began, 0 if it has not run
+	uint64_t end_ns; // when it last ended
+	uint64_t total_ns; // time spent in it, summed over its runs
+	uint32_t count; // times it ran
+} phantom_phase_timing_t;
+
+
+/* Descriptor ring fed to an auto-restarting IP core, see phantom_fpga_ring_open(). */
+typedef struct phantom_ring phantom_ring_t;
+
+
+/* Recorded register command list, see phantom_cmdlist_create(). */
+typedef struct phantom_cmdlist phantom_cmdlist_t;
+
+
+/* Validated handle on one AXI slave of an IP core. Obtained once with phantom_fpga_ip_get_handle()
+   and then used with the inline accessors below, which compile down to a single load or store. */
+typedef struct {
+	volatile uint8_t *vmem_base;
+	uint32_t size;
+} phantom_ip_handle_t;
+
+
 /* function prototypes */
 int phantom_download(int);
 int phantom_initialise(void);
@@ -114,20 +254,137 @@ int phantom_fpga_reset(const uint8_t);
 int phantom_fpga_reset_global(void);
 int phantom_fpga_get_num_ips();
 phantom_ip_t *phantom_fpga_get_ips();
-phantom_ip_t *phantom_fpga_get_ip(const uint8_t);
-phantom_ip_t *phantom_fpga_get_ip_from_idx(const uint8_t);
+phantom_ip_t *phantom_fpga_get_ip(const uint32_t);
+phantom_ip_t *phantom_fpga_get_ip_from_idx(const uint32_t);
 phantom_ip_t *phantom_fpga_get_ip_from_idstr(const char *);
 phantom_ip_t *phantom_fpga_get_ip_from_name(const char *);
+int phantom_fpga_get_ips_from_name(const char *, phantom_ip_t **, const int);
 int phantom_fpga_ip_start(phantom_ip_t*);
 int phantom_fpga_ip_set_autorestart(phantom_ip_t*);
 int phantom_fpga_ip_clear_autorestart(phantom_ip_t*);
 int phantom_fpga_ip_is_done(phantom_ip_t*);
 int phantom_fpga_ip_is_idle(phantom_ip_t*);
+int phantom_fpga_ip_wait_done(phantom_ip_t*, const int);
+int phantom_fpga_ip_set_wait_policy(phantom_ip_t*, const phantom_wait_policy_t);
+int phantom_fpga_ip_get_wait_stats(phantom_ip_t*, phantom_wait_stats_t*);
+int phantom_fpga_ip_get_fd(phantom_ip_t*);
+int phantom_fpga_ip_ack(phantom_ip_t*);
+int phantom_fpga_get_event_fd(void);
+int phantom_fpga_collect_done(phantom_ip_t**, const int);
 int phantom_fpga_ip_set(phantom_ip_t*, const phantom_address_t, const phantom_data_t, const uint8_t);
 phantom_data_t phantom_fpga_ip_get(phantom_ip_t*, const phantom_address_t, const uint8_t);
+int phantom_fpga_ip_set_block(phantom_ip_t*, const phantom_address_t, const void*, const uint32_t, const uint8_t);
+int phantom_fpga_ip_get_block(phantom_ip_t*, const phantom_address_t, void*, const uint32_t, const uint8_t);
+void *phantom_fpga_ip_get_mem(phantom_ip_t*, phantom_address_t*, uint32_t*);
+void *phantom_fpga_mem_alloc(phantom_ip_t*, const uint32_t);
+void phantom_fpga_mem_free(phantom_ip_t*, void*);
+phantom_address_t phantom_fpga_mem_get_phys(phantom_ip_t*, const void*);
+void *phantom_fpga_mem_get_virt(phantom_ip_t*, const phantom_address_t);
+int phantom_fpga_mem_get_stats(phantom_ip_t*, phantom_mem_stats_t*);
+int phantom_fpga_mem_set_cached(phantom_ip_t*, const int);
+int phantom_fpga_mem_clean(phantom_ip_t*, const void*, const uint32_t);
+int phantom_fpga_mem_invalidate(phantom_ip_t*, const void*, const uint32_t);
+int phantom_fpga_mem_flush(phantom_ip_t*, const void*, const uint32_t);
+int phantom_fpga_mem_begin_cpu_access(phantom_ip_t*, const void*, const uint32_t, const phantom_mem_dir_t);
+int phantom_fpga_mem_end_cpu_access(phantom_ip_t*, const void*, const uint32_t, const phantom_mem_dir_t);
+int phantom_fpga_dma_transfer(phantom_ip_t*, const phantom_address_t, const phantom_address_t, const phantom_address_t, const int);
+int phantom_fpga_dma_is_idle(phantom_ip_t*, const phantom_address_t, const int);
+phantom_dma_t *phantom_fpga_dma_open(phantom_ip_t*, const phantom_address_t, const int, const uint32_t, const uint32_t);
+int phantom_fpga_dma_queue(phantom_dma_t*, const phantom_address_t, const uint32_t);
+int phantom_fpga_dma_reap(phantom_dma_t*);
+int phantom_fpga_dma_wait(phantom_dma_t*);
+void phantom_fpga_dma_close(phantom_dma_t*);
+int phantom_fpga_async_open(phantom_ip_t*, uint32_t);
+int phantom_fpga_async_submit(phantom_ip_t*, phantom_job_t*, const int);
+int phantom_fpga_job_is_done(phantom_job_t*);
+int phantom_fpga_job_wait(phantom_job_t*, const int);
+void phantom_fpga_async_close(phantom_ip_t*);
+phantom_group_t *phantom_fpga_group_open(const char *, uint32_t);
+phantom_group_t *phantom_context_group_open(phantom_context_t*, const char *, uint32_t);
+int phantom_fpga_group_get_num_ips(phantom_group_t*);
+phantom_ip_t *phantom_fpga_group_get_ip(phantom_group_t*, const int);
+int phantom_fpga_group_submit(phantom_group_t*, phantom_job_t*, const int);
+void phantom_fpga_group_close(phantom_group_t*);
+phantom_stream_t *phantom_fpga_stream_open(phantom_ip_t*, const uint32_t, const uint32_t, const uint32_t, const phantom_address_t, const phantom_address_t);
+void *phantom_fpga_stream_get_input(phantom_stream_t*);
+int phantom_fpga_stream_submit(phantom_stream_t*);
+void *phantom_fpga_stream_get_output(phantom_stream_t*, const int);
+int phantom_fpga_stream_release(phantom_stream_t*);
+int phantom_fpga_stream_get_stats(phantom_stream_t*, phantom_stream_stats_t*);
+int phantom_fpga_stream_close(phantom_stream_t*, const int);
+phantom_ring_t *phantom_fpga_ring_open(phantom_ip_t*, const uint32_t, const uint32_t, const phantom_address_t);
+void *phantom_fpga_ring_reserve(phantom_ring_t*);
+int phantom_fpga_ring_push(phantom_ring_t*);
+void *phantom_fpga_ring_get_done(phantom_ring_t*);
+int phantom_fpga_ring_release(phantom_ring_t*);
+uint32_t phantom_fpga_ring_pending(phantom_ring_t*);
+int phantom_fpga_ring_wait(phantom_ring_t*, const int);
+int phantom_fpga_ring_close(phantom_ring_t*, const int);
+phantom_cmdlist_t *phantom_cmdlist_create(const uint32_t, const uint32_t);
+int phantom_cmdlist_write(phantom_cmdlist_t*, phantom_ip_t*, const phantom_address_t, const phantom_data_t, const uint8_t);
+int phantom_cmdlist_write_param(phantom_cmdlist_t*, phantom_ip_t*, const phantom_address_t, const uint32_t, const uint8_t);
+int phantom_cmdlist_read(phantom_cmdlist_t*, phantom_ip_t*, const phantom_address_t, const uint32_t, const uint8_t);
+int phantom_cmdlist_poll(phantom_cmdlist_t*, phantom_ip_t*, const phantom_address_t, const phantom_data_t, const phantom_data_t, const uint8_t, const int);
+int phantom_cmdlist_start(phantom_cmdlist_t*, phantom_ip_t*);
+int phantom_cmdlist_wait_done(phantom_cmdlist_t*, phantom_ip_t*, const int);
+int phantom_cmdlist_replay(phantom_cmdlist_t*, const phantom_data_t*, phantom_data_t*);
+void phantom_cmdlist_destroy(phantom_cmdlist_t*);
+int phantom_fpga_ip_lease(phantom_ip_t*, const phantom_lease_t, const int);
+int phantom_fpga_ip_release(phantom_ip_t*);
 void phantom_terminate(void);
 phantom_platform_info_t *phantom_platform_get_info(void);
+int phantom_set_dev_timeout(const int);
+int phantom_set_map_mode(const phantom_map_mode_t);
+int phantom_set_use_daemon(const int);
+int phantom_set_startup_timing(const int);
+int phantom_get_startup_timing(phantom_phase_timing_t *, const int);
+int phantom_fpga_ip_map(phantom_ip_t*);
+phantom_context_t *phantom_context_create(void);
+int phantom_context_set_dev_timeout(phantom_context_t*, const int);
+int phantom_context_set_map_mode(phantom_context_t*, const phantom_map_mode_t);
+int phantom_context_set_use_daemon(phantom_context_t*, const int);
+int phantom_context_initialise(phantom_context_t*);
+int phantom_context_get_num_ips(phantom_context_t*);
+phantom_ip_t *phantom_context_get_ips(phantom_context_t*);
+phantom_ip_t *phantom_context_get_ip_from_idstr(phantom_context_t*, const char *);
+int phantom_context_get_ips_from_name(phantom_context_t*, const char *, phantom_ip_t **, const int);
+phantom_platform_info_t *phantom_context_get_platform_info(phantom_context_t*);
+int phantom_context_get_event_fd(phantom_context_t*);
+int phantom_context_collect_done(phantom_context_t*, phantom_ip_t**, const int);
+void phantom_context_destroy(phantom_context_t*);
 char *phantom_get_version(void);
+int phantom_fpga_ip_get_handle(phantom_ip_t*, const uint8_t, phantom_ip_handle_t*);
+
+
+
+/*
+ * Write a register through a validated handle. addr is based from 0 inside the handle's slave.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR on a bad address when PHANTOM_HANDLE_CHECKS is defined.
+ */
+static inline int phantom_handle_set(const phantom_ip_handle_t *h, const phantom_address_t addr, const phantom_data_t val)
+{
+#ifdef PHANTOM_HANDLE_CHECKS
+	if((addr > h->size - sizeof(phantom_data_t)) || (addr & (sizeof(phantom_data_t) - 1)))
+		return PHANTOM_ERROR;
+#endif
+	*((volatile phantom_data_t *)(h->vmem_base + addr)) = val;
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Read a register through a validated handle. addr is based from 0 inside the handle's slave.
+ * Returns the register value, or 0 on a bad address when PHANTOM_HANDLE_CHECKS is defined.
+ */
+static inline phantom_data_t phantom_handle_get(const phantom_ip_handle_t *h, const phantom_address_t addr)
+{
+#ifdef PHANTOM_HANDLE_CHECKS
+	if((addr > h->size - sizeof(phantom_data_t)) || (addr & (sizeof(phantom_data_t) - 1)))
+		return 0;
+#endif
+	return *((volatile phantom_data_t *)(h->vmem_base + addr));
+}
 
 
 
@@ -0,0 +1,740 @@
+/*
+ * File:         phantom_api_async.c
+ *
+ * Project:      PHANTOM
+ *
+ * Organisation: University of York
+ *
+ * Author(s):    PHANTOM team
+ *
+ * Version:      0.11 (dev only)
+ *
+ * Description:  Asynchronous job submission. Each IP opened for async use gets a bounded
+ *               lock-free submission ring and a dispatcher thread which writes each job's
+ *               arguments, starts the core, waits for it and completes the job. Instances of the
+ *               same IP core can be opened as a group, whose dispatchers steal jobs from each
+ *               other's rings when their own is empty.
+ *
+ * Copyright:    University of York. 2026.
+ *
+ * Legal:        All rights reserved. No warranty, explicit or implicit, provided.
+ *
+ * Revisions:
+ *
+ * Notes:        The ring is Vyukov's bounded queue: every cell carries a sequence number which
+ *               tells producers and the consumer whose turn it is, so submitters only contend on
+ *               one compare-and-swap of the enqueue position, and consumers on one of the dequeue
+ *               position. Threads sleep on futexes, and only enter the kernel to wake a sleeper
+ *               when one is recorded. The dispatchers of a group all sleep on the group's work
+ *               counter, so any idle instance can be woken for a job queued to a busy one.
+ *
+ *
+*/
+
+
+
+#include "phantom_api.h"
+#include "phantom_api_lowlevel.h"
+#include "phantom_api_private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+
+
+typedef struct {
+	uint32_t seq;
+	phantom_job_t *job;
+} async_cell_t;
+
+
+/* Per-IP submission ring and dispatcher. Positions written by different sides sit on their own cache lines. */
+typedef struct {
+	uint32_t enqueue_pos __attribute__((aligned(ASYNC_CACHE_LINE))); // shared by all submitters
+	uint32_t space_seq __attribute__((aligned(ASYNC_CACHE_LINE))); // bumped by the dispatchers as cells free up
+	uint32_t space_waiters;
+	uint32_t dispatcher_sleeping; // futex the dispatcher sleeps on while the ring is empty, if not grouped
+	uint32_t dequeue_pos __attribute__((aligned(ASYNC_CACHE_LINE))); // own dispatcher, and others of its group stealing
+	uint32_t mask;
+	int stop;
+	phantom_ip_t *ip;
+	struct phantom_group *group; // NULL if not grouped
+	uint32_t group_idx;
+	pthread_t dispatcher;
+	async_cell_t *cells;
+} async_queue_t;
+
+
+struct phantom_group {
+	uint32_t work_seq __attribute__((aligned(ASYNC_CACHE_LINE))); // futex idle dispatchers sleep on, bumped per job
+	uint32_t sleepers;
+	uint32_t next; // round robin submission cursor
+	uint32_t num_ips;
+	uint32_t space_seq __attribute__((aligned(ASYNC_CACHE_LINE))); // bumped as cells free up in any ring of the group
+	uint32_t space_waiters;
+	async_queue_t *queues[];
+};
+
+
+
+static int futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+
+
+static void futex_wake(uint32_t *addr, int num)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+
+
+
+/*
+ * Publish a job in the ring. Safe from any number of threads.
+ * Returns 0 on success, -1 if the ring is full.
+ */
+static int async_enqueue(async_queue_t *q, phantom_job_t *job)
+{
+	uint32_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	async_cell_t *cell;
+	int32_t dif;
+
+	for(;;)
+	{
+		cell = &q->cells[pos & q->mask];
+		dif = (int32_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+		if(dif == 0)
+		{
+			if(__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if(dif < 0)
+			return -1; // cell still holds a job from the previous lap
+		else
+			pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	}
+	cell->job = job;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+
+
+/*
+ * Take the oldest job from the ring. Safe from any number of dispatchers, so the idle dispatchers
+ * of a group can steal.
+ * Returns the job, or NULL if the ring is empty.
+ */
+static phantom_job_t *async_dequeue(async_queue_t *q)
+{
+	uint32_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	async_cell_t *cell;
+	phantom_job_t *job;
+	int32_t dif;
+
+	for(;;)
+	{
+		cell = &q->cells[pos & q->mask];
+		dif = (int32_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if(dif == 0)
+		{
+			if(__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if(dif < 0)
+			return NULL; // empty
+		else
+			pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	}
+	job = cell->job;
+	__atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE); // free for the next lap
+
+	/* let blocked submitters retry, those of the group waiting for space in any of its rings */
+	__atomic_add_fetch(&q->space_seq, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&q->space_waiters, __ATOMIC_SEQ_CST))
+		futex_wake(&q->space_seq, INT_MAX);
+	if(q->group != NULL)
+	{
+		__atomic_add_fetch(&q->group->space_seq, 1, __ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&q->group->space_waiters, __ATOMIC_SEQ_CST))
+			futex_wake(&q->group->space_seq, INT_MAX);
+	}
+
+	return job;
+}
+
+
+
+/*
+ * Run one job on the IP: write its arguments, start the core and wait for it to complete.
+ */
+static void async_run_job(phantom_ip_t *ip, phantom_job_t *job)
+{
+	const struct timespec poll = {0, ASYNC_JOB_POLL_US * 1000L};
+	struct timespec t0, now;
+	uint32_t state;
+	int rc;
+
+	job->status = PHANTOM_OK;
+	job->ip = ip;
+	if((job->args != NULL) && (job->args_len != 0))
+		job->status = phantom_fpga_ip_set_block(ip, job->args_addr, job->args, job->args_len, job->axi_slave);
+	if(job->status == PHANTOM_OK)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		phantom_fpga_ip_start(ip);
+		rc = phantom_fpga_ip_wait_done(ip, ASYNC_JOB_TIMEOUT_MS);
+		if(rc == PHANTOM_ERROR)
+		{
+			/* core has no interrupt, fall back to polling it with a sleep between reads */
+			while((rc = phantom_fpga_ip_is_done(ip)) != PHANTOM_OK)
+			{
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				if((now.tv_sec - t0.tv_sec) * 1000 + (now.tv_nsec - t0.tv_nsec) / 1000000 >= ASYNC_JOB_TIMEOUT_MS)
+					break;
+				nanosleep(&poll, NULL);
+			}
+		}
+		if(rc != PHANTOM_OK)
+		{
+			#ifdef DEBUG
+				printf("error: %s did not complete its job within %d ms\n", ip->idstring, ASYNC_JOB_TIMEOUT_MS);
+			#endif
+			job->status = PHANTOM_ERROR;
+		}
+	}
+
+	if(job->callback != NULL)
+		job->callback(job);
+
+	/* the job may be freed by its owner as soon as it is marked done, so touch nothing after */
+	state = __atomic_exchange_n(&job->state, ASYNC_JOB_DONE, __ATOMIC_ACQ_REL);
+	if(state & ASYNC_JOB_WAITING)
+		futex_wake(&job->state, INT_MAX);
+}
+
+
+
+/*
+ * Take a job from the dispatcher's own ring or, if grouped and that is empty, from the rings of
+ * the other instances, starting with the next one along.
+ * Returns the job, or NULL if there is none.
+ */
+static phantom_job_t *async_next_job(async_queue_t *q)
+{
+	struct phantom_group *g = q->group;
+	phantom_job_t *job;
+
+	if(((job = async_dequeue(q)) != NULL) || (g == NULL))
+		return job;
+	for(uint32_t i = 1; i < g->num_ips; i++)
+		if((job = async_dequeue(g->queues[(q->group_idx + i) % g->num_ips])) != NULL)
+			return job;
+	return NULL;
+}
+
+
+
+/*
+ * Sleep until a job is queued anywhere in the dispatcher's group.
+ */
+static void async_group_sleep(async_queue_t *q)
+{
+	struct phantom_group *g = q->group;
+	uint32_t seq = __atomic_load_n(&g->work_seq, __ATOMIC_SEQ_CST);
+	phantom_job_t *job;
+
+	/* announce the sleep, then re-check every ring so a job published meanwhile is not missed */
+	__atomic_add_fetch(&g->sleepers, 1, __ATOMIC_SEQ_CST);
+	if((job = async_next_job(q)) != NULL)
+	{
+		__atomic_sub_fetch(&g->sleepers, 1, __ATOMIC_SEQ_CST);
+		async_run_job(q->ip, job);
+		return;
+	}
+	if(!__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE))
+		futex_wait(&g->work_seq, seq, NULL);
+	__atomic_sub_fetch(&g->sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+
+
+static void *async_dispatcher(void *arg)
+{
+	async_queue_t *q = arg;
+	phantom_job_t *job;
+
+	for(;;)
+	{
+		if((job = async_next_job(q)) != NULL)
+		{
+			async_run_job(q->ip, job);
+			continue;
+		}
+		if(__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE))
+			break; // stopped and drained
+		if(q->group != NULL)
+		{
+			async_group_sleep(q);
+			continue;
+		}
+
+		/* announce the sleep, then re-check so a job published meanwhile is not missed */
+		__atomic_store_n(&q->dispatcher_sleeping, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if((job = async_dequeue(q)) != NULL)
+		{
+			__atomic_store_n(&q->dispatcher_sleeping, 0, __ATOMIC_RELAXED);
+			async_run_job(q->ip, job);
+			continue;
+		}
+		if(!__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE))
+			futex_wait(&q->dispatcher_sleeping, 1, NULL);
+		__atomic_store_n(&q->dispatcher_sleeping, 0, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+
+
+/*
+ * Wake a dispatcher for a newly queued job: the ring's own one or, if grouped, any idle one of the group.
+ */
+static void async_wake_dispatcher(async_queue_t *q)
+{
+	struct phantom_group *g = q->group;
+
+	if(g != NULL)
+	{
+		__atomic_add_fetch(&g->work_seq, 1, __ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&g->sleepers, __ATOMIC_SEQ_CST))
+			futex_wake(&g->work_seq, 1);
+		return;
+	}
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&q->dispatcher_sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&q->dispatcher_sleeping, 0, __ATOMIC_SEQ_CST))
+		futex_wake(&q->dispatcher_sleeping, 1);
+}
+
+
+
+/*
+ * Create the submission ring of an IP, without its dispatcher.
+ * Returns the ring, or NULL on failure.
+ */
+static async_queue_t *async_queue_create(phantom_ip_t *ip, uint32_t ring_size)
+{
+	async_queue_t *q;
+	uint32_t size = 2;
+
+	if((ip == NULL) || ip_ensure_mapped(ip) || (ip->s0_vmem_base == NULL) || (ip->async_queue != NULL))
+		return NULL;
+	if(ring_size == 0)
+		ring_size = ASYNC_DEFAULT_RING_SIZE;
+	if(ring_size > ASYNC_MAX_RING_SIZE)
+		return NULL;
+	while(size < ring_size)
+		size <<= 1;
+
+	if(posix_memalign((void **) &q, ASYNC_CACHE_LINE, sizeof(async_queue_t)))
+		return NULL;
+	memset(q, 0, sizeof(async_queue_t));
+	if((q->cells = malloc(size * sizeof(async_cell_t))) == NULL)
+	{
+		free(q);
+		return NULL;
+	}
+	for(uint32_t i = 0; i < size; i++)
+		q->cells[i].seq = i;
+	q->mask = size - 1;
+	q->ip = ip;
+
+	return q;
+}
+
+
+
+static int async_queue_start(async_queue_t *q)
+{
+	if(pthread_create(&q->dispatcher, NULL, async_dispatcher, q))
+	{
+		#ifdef DEBUG
+			printf("error: unable to create dispatcher thread for %s\n", q->ip->idstring);
+		#endif
+		return -1;
+	}
+	return 0;
+}
+
+
+
+static void async_queue_free(async_queue_t *q)
+{
+	free(q->cells);
+	free(q);
+}
+
+
+
+/*
+ * Opens the specified IP for asynchronous jobs, creating its submission ring and dispatcher thread.
+ * From then on only the dispatcher may start the core. The dispatcher waits for each job with
+ * phantom_fpga_ip_wait_done(), so the IP's wait policy applies.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    ring_size (uint32_t) – Jobs that may be queued at once, rounded up to a power of 2. 0 selects a default.
+ * Returns PHANTOM_OK on success, or PHANTOM_ERROR if not.
+ *
+ */
+int phantom_fpga_async_open(phantom_ip_t *ip, uint32_t ring_size)
+{
+	async_queue_t *q;
+
+	if((q = async_queue_create(ip, ring_size)) == NULL)
+		return PHANTOM_ERROR;
+	if(async_queue_start(q))
+	{
+		async_queue_free(q);
+		return PHANTOM_ERROR;
+	}
+	ip->async_queue = q;
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Submits a job to an IP opened with phantom_fpga_async_open(). Safe to call from any number of
+ * threads. The job must stay valid until it completes; the callback, if any, is called from the
+ * dispatcher thread when the core is done, and the job is then marked done for phantom_fpga_job_wait().
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    job (phantom_job_t*) – The job. args, args_len, args_addr, axi_slave, callback and user_data must be set.
+ *    blocking (int) – If non-zero, wait for space when the ring is full.
+ * Returns PHANTOM_OK if the job was queued, PHANTOM_FALSE if the ring is full and blocking is 0,
+ * or PHANTOM_ERROR if the IP is not open for async jobs.
+ *
+ */
+int phantom_fpga_async_submit(phantom_ip_t *ip, phantom_job_t *job, const int blocking)
+{
+	async_queue_t *q = ip->async_queue;
+	uint32_t seq, prev_state;
+
+	if((q == NULL) || (job == NULL))
+		return PHANTOM_ERROR;
+
+	prev_state = job->state;
+	job->state = ASYNC_JOB_QUEUED;
+	for(;;)
+	{
+		seq = __atomic_load_n(&q->space_seq, __ATOMIC_SEQ_CST);
+		if(async_enqueue(q, job) == 0)
+			break;
+		if(!blocking)
+		{
+			job->state = prev_state; // not queued, so nothing will ever complete it
+			return PHANTOM_FALSE;
+		}
+
+		/* backpressure: sleep until the dispatcher frees a cell; a stale seq returns at once */
+		__atomic_add_fetch(&q->space_waiters, 1, __ATOMIC_SEQ_CST);
+		futex_wait(&q->space_seq, seq, NULL);
+		__atomic_sub_fetch(&q->space_waiters, 1, __ATOMIC_SEQ_CST);
+	}
+	async_wake_dispatcher(q);
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Checks if a submitted job has completed.
+ * Parameters
+ *    job (phantom_job_t*) – The job.
+ * Returns PHANTOM_OK if the job is done, or PHANTOM_FALSE if not.
+ *
+ */
+int phantom_fpga_job_is_done(phantom_job_t *job)
+{
+	if(__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) == ASYNC_JOB_DONE)
+		return PHANTOM_OK;
+	return PHANTOM_FALSE;
+}
+
+
+
+/*
+ * Blocks until a submitted job has completed, after its callback has returned.
+ * Parameters
+ *    job (phantom_job_t*) – The job.
+ *    timeout_ms (int) – The maximum time to wait in milliseconds, or a negative value to wait forever.
+ * Returns the job's status if it completed, PHANTOM_FALSE on timeout, or PHANTOM_ERROR if the job
+ * has never been queued.
+ *
+ */
+int phantom_fpga_job_wait(phantom_job_t *job, const int timeout_ms)
+{
+	struct timespec now, deadline, rel;
+	uint32_t state = ASYNC_JOB_QUEUED;
+
+	if(timeout_ms >= 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	for(;;)
+	{
+		/* record a waiter so the dispatcher knows to wake us */
+		if(!__atomic_compare_exchange_n(&job->state, &state, ASYNC_JOB_QUEUED | ASYNC_JOB_WAITING, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+		{
+			if(state == ASYNC_JOB_DONE)
+				return job->status;
+			if(state != (ASYNC_JOB_QUEUED | ASYNC_JOB_WAITING))
+				return PHANTOM_ERROR; // never submitted, nothing will wake us
+		}
+
+		if(timeout_ms < 0)
+			futex_wait(&job->state, ASYNC_JOB_QUEUED | ASYNC_JOB_WAITING, NULL);
+		else
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			rel.tv_sec = deadline.tv_sec - now.tv_sec;
+			rel.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+			if(rel.tv_nsec < 0)
+			{
+				rel.tv_sec--;
+				rel.tv_nsec += 1000000000L;
+			}
+			if(rel.tv_sec < 0)
+				return PHANTOM_FALSE;
+			futex_wait(&job->state, ASYNC_JOB_QUEUED | ASYNC_JOB_WAITING, &rel);
+		}
+		state = ASYNC_JOB_QUEUED;
+	}
+}
+
+
+
+/*
+ * Stops asynchronous use of the specified IP. Jobs already queued are run to completion first.
+ * No job may be submitted to the IP once this is called. If the IP is in a group the whole group
+ * is closed, as phantom_fpga_group_close().
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ * Returns nothing.
+ *
+ */
+void phantom_fpga_async_close(phantom_ip_t *ip)
+{
+	async_queue_t *q = ip->async_queue;
+
+	if(q == NULL)
+		return;
+	if(q->group != NULL)
+	{
+		phantom_fpga_group_close(q->group);
+		return;
+	}
+
+	__atomic_store_n(&q->stop, 1, __ATOMIC_RELEASE);
+	async_wake_dispatcher(q);
+	pthread_join(q->dispatcher, NULL);
+
+	async_queue_free(q);
+	ip->async_queue = NULL;
+}
+
+
+
+/*
+ * As phantom_context_group_open(), for the default context.
+ */
+phantom_group_t *phantom_fpga_group_open(const char *ipname, uint32_t ring_size)
+{
+	phantom_ip_t *ip = phantom_fpga_get_ip_from_name(ipname);
+
+	return (ip == NULL) ? NULL : phantom_context_group_open(ip->ctx, ipname, ring_size);
+}
+
+
+
+/*
+ * Opens every instance of an IP core in a context as one group for asynchronous jobs. Each
+ * instance gets its own submission ring and dispatcher, as phantom_fpga_async_open(). Jobs are
+ * queued round robin over the instances, and a dispatcher whose ring is empty takes jobs from the
+ * others, so jobs queued behind a long one go to whichever instance is idle.
+ * Parameters
+ *    ctx (phantom_context_t*) – The context.
+ *    ipname (char*) – The IP name shared by the instances, as phantom_ip_t.ipname.
+ *    ring_size (uint32_t) – Jobs that may be queued at once per instance, rounded up to a power of 2. 0 selects a default.
+ * Returns the group, or NULL if no instance was found, one is already open for async jobs, or on error.
+ *
+ */
+phantom_group_t *phantom_context_group_open(phantom_context_t *ctx, const char *ipname, uint32_t ring_size)
+{
+	phantom_ip_t *ip;
+	struct phantom_group *g;
+	uint32_t n = 0, started = 0, num_ips = 0;
+
+	if((ctx == NULL) || (ipname == NULL))
+		return NULL;
+	for(ip = phantom_conf_find_name(&ctx->conf, ipname); ip != NULL; ip = phantom_conf_next_name(&ctx->conf, ip))
+		num_ips++;
+	if(num_ips == 0)
+		return NULL;
+	if(posix_memalign((void **) &g, ASYNC_CACHE_LINE, sizeof(struct phantom_group) + num_ips * sizeof(async_queue_t *)))
+		return NULL;
+	memset(g, 0, sizeof(struct phantom_group));
+
+	for(ip = phantom_conf_find_name(&ctx->conf, ipname); ip != NULL; ip = phantom_conf_next_name(&ctx->conf, ip))
+	{
+		if((g->queues[n] = async_queue_create(ip, ring_size)) == NULL)
+			goto fail;
+		g->queues[n]->group = g;
+		g->queues[n]->group_idx = n;
+		n++;
+	}
+	g->num_ips = n;
+
+	/* every ring exists before any dispatcher may steal from it */
+	for(; started < n; started++)
+		if(async_queue_start(g->queues[started]))
+			goto fail;
+	for(uint32_t i = 0; i < n; i++)
+		g->queues[i]->ip->async_queue = g->queues[i];
+
+	return g;
+
+fail:
+	for(uint32_t i = 0; i < started; i++)
+		__atomic_store_n(&g->queues[i]->stop, 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&g->work_seq, 1, __ATOMIC_SEQ_CST);
+	futex_wake(&g->work_seq, INT_MAX);
+	for(uint32_t i = 0; i < n; i++)
+	{
+		if(i < started)
+			pthread_join(g->queues[i]->dispatcher, NULL);
+		async_queue_free(g->queues[i]);
+	}
+	free(g);
+	return NULL;
+}
+
+
+
+/*
+ * Returns the number of IP instances in a group.
+ */
+int phantom_fpga_group_get_num_ips(phantom_group_t *g)
+{
+	return g->num_ips;
+}
+
+
+
+/*
+ * Returns the idx'th IP instance of a group, or NULL if idx is out of range.
+ */
+phantom_ip_t *phantom_fpga_group_get_ip(phantom_group_t *g, const int idx)
+{
+	if((idx < 0) || ((uint32_t) idx >= g->num_ips))
+		return NULL;
+	return g->queues[idx]->ip;
+}
+
+
+
+/*
+ * Submits a job to a group, as phantom_fpga_async_submit(). It runs on whichever instance takes it
+ * first, which is set in job->ip before the core is started. Safe to call from any number of threads.
+ * Parameters
+ *    g (phantom_group_t*) – The group.
+ *    job (phantom_job_t*) – The job.
+ *    blocking (int) – If non-zero, wait for space when every ring is full.
+ * Returns PHANTOM_OK if the job was queued, PHANTOM_FALSE if every ring is full and blocking is 0,
+ * or PHANTOM_ERROR on error.
+ *
+ */
+int phantom_fpga_group_submit(phantom_group_t *g, phantom_job_t *job, const int blocking)
+{
+	async_queue_t *q;
+	uint32_t first, seq, prev_state;
+
+	if((g == NULL) || (job == NULL))
+		return PHANTOM_ERROR;
+
+	prev_state = job->state;
+	job->state = ASYNC_JOB_QUEUED;
+	first = __atomic_fetch_add(&g->next, 1, __ATOMIC_RELAXED) % g->num_ips;
+	q = g->queues[first];
+	for(;;)
+	{
+		seq = __atomic_load_n(&g->space_seq, __ATOMIC_SEQ_CST);
+		for(uint32_t i = 0; i < g->num_ips; i++)
+		{
+			if(async_enqueue(g->queues[(first + i) % g->num_ips], job) == 0)
+			{
+				async_wake_dispatcher(q);
+				return PHANTOM_OK;
+			}
+		}
+		if(!blocking)
+		{
+			job->state = prev_state; // not queued, so nothing will ever complete it
+			return PHANTOM_FALSE;
+		}
+
+		/* every ring full: sleep until a cell frees up in any of them */
+		__atomic_add_fetch(&g->space_waiters, 1, __ATOMIC_SEQ_CST);
+		futex_wait(&g->space_seq, seq, NULL);
+		__atomic_sub_fetch(&g->space_waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+
+
+/*
+ * Closes a group. Jobs already queued are run to completion first. No job may be submitted to
+ * the group once this is called.
+ * Parameters
+ *    g (phantom_group_t*) – The group, may be NULL.
+ * Returns nothing.
+ *
+ */
+void phantom_fpga_group_close(phantom_group_t *g)
+{
+	if(g == NULL)
+		return;
+
+	for(uint32_t i = 0; i < g->num_ips; i++)
+		__atomic_store_n(&g->queues[i]->stop, 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&g->work_seq, 1, __ATOMIC_SEQ_CST);
+	futex_wake(&g->work_seq, INT_MAX);
+
+	for(uint32_t i = 0; i < g->num_ips; i++)
+		pthread_join(g->queues[i]->dispatcher, NULL);
+	for(uint32_t i = 0; i < g->num_ips; i++)
+	{
+		g->queues[i]->ip->async_queue = NULL;
+		async_queue_free(g->queues[i]);
+	}
+	free(g);
+}
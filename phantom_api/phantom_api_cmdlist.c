@@ -0,0 +1,343 @@
+/*
+ * File:         phantom_api_cmdlist.c
+ *
+ * Project:      PHANTOM
+ *
+ * Organisation: University of York
+ *
+ * Author(s):    PHANTOM team
+ *
+ * Version:      0.11 (dev only)
+ *
+ * Description:  Recordable register command lists. A sequence of register writes, reads, polls,
+ *               starts and waits against one or more IPs is validated once when recorded and
+ *               then replayed many times, with selected write values patched from a parameter array.
+ *
+ * Copyright:    University of York. 2026.
+ *
+ * Legal:        All rights reserved. No warranty, explicit or implicit, provided.
+ *
+ * Revisions:
+ *
+ * Notes:        Each command is resolved at record time to a register pointer and a slot in a
+ *               single values array holding the parameters, then the read results, then the
+ *               recorded constants. Replay copies the parameters in and runs the commands with no
+ *               address or range checks.
+ *
+ *
+*/
+
+
+
+#include "phantom_api.h"
+#include "phantom_api_lowlevel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+
+
+typedef enum {CMD_WRITE, CMD_READ, CMD_POLL, CMD_START, CMD_WAIT} cmd_op_t;
+
+
+typedef struct {
+	cmd_op_t op;
+	uint32_t slot; // values slot written from or read in to
+	volatile phantom_data_t *reg;
+	phantom_data_t mask; // CMD_POLL: (reg & mask) == value ends the poll
+	phantom_data_t value;
+	int timeout_ms; // CMD_POLL, CMD_WAIT
+	phantom_ip_t *ip; // CMD_START, CMD_WAIT
+} cmd_t;
+
+
+struct phantom_cmdlist {
+	cmd_t *cmds;
+	uint32_t num_cmds;
+	uint32_t max_cmds;
+	phantom_data_t *values; // params, then results, then constants
+	uint32_t num_values;
+	uint32_t num_params;
+	uint32_t num_results;
+	int replaying; // set while a replay runs, values is not shared between replays
+};
+
+
+
+/*
+ * Resolve and validate a register of an IP's slave once, at record time.
+ * Returns the register pointer, or NULL if the address is outside the slave or misaligned.
+ */
+static volatile phantom_data_t *cmdlist_get_reg(phantom_ip_t *ip, const phantom_address_t addr, const uint8_t axi_slave)
+{
+	phantom_ip_handle_t handle;
+
+	if((ip == NULL) || (phantom_fpga_ip_get_handle(ip, axi_slave, &handle) != PHANTOM_OK))
+		return NULL;
+	if((addr > handle.size - sizeof(phantom_data_t)) || (addr & (sizeof(phantom_data_t) - 1)))
+	{
+		#ifdef DEBUG
+			printf("error: command list address 0x%08" PRIx64 " invalid for %s s%d\n", (uint64_t) addr, ip->idstring, axi_slave);
+		#endif
+		return NULL;
+	}
+	return (volatile phantom_data_t *)(handle.vmem_base + addr);
+}
+
+
+
+/*
+ * Append a command, growing the command and values arrays as needed.
+ * If constant is set a new values slot is allocated for value.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR if out of memory.
+ */
+static int cmdlist_append(phantom_cmdlist_t *cl, cmd_t *cmd, int constant)
+{
+	void *p;
+
+	if(cl->num_cmds == cl->max_cmds)
+	{
+		if((p = realloc(cl->cmds, 2 * cl->max_cmds * sizeof(cmd_t))) == NULL)
+			return PHANTOM_ERROR;
+		cl->cmds = p;
+		cl->max_cmds *= 2;
+	}
+	if(constant)
+	{
+		if((p = realloc(cl->values, (cl->num_values + 1) * sizeof(phantom_data_t))) == NULL)
+			return PHANTOM_ERROR;
+		cl->values = p;
+		cl->values[cl->num_values] = cmd->value;
+		cmd->slot = cl->num_values++;
+	}
+	cl->cmds[cl->num_cmds++] = *cmd;
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Creates an empty command list.
+ * Parameters
+ *    num_params (uint32_t) – Number of values patched in on each replay, see phantom_cmdlist_write_param().
+ *    num_results (uint32_t) – Number of values read back on each replay, see phantom_cmdlist_read().
+ * Returns the command list, or NULL if out of memory.
+ *
+ */
+phantom_cmdlist_t *phantom_cmdlist_create(const uint32_t num_params, const uint32_t num_results)
+{
+	phantom_cmdlist_t *cl;
+
+	if((cl = calloc(1, sizeof(phantom_cmdlist_t))) == NULL)
+		return NULL;
+	cl->max_cmds = CMDLIST_INITIAL_CMDS;
+	cl->num_params = num_params;
+	cl->num_results = num_results;
+	cl->num_values = num_params + num_results;
+	cl->cmds = malloc(cl->max_cmds * sizeof(cmd_t));
+	cl->values = calloc(cl->num_values ? cl->num_values : 1, sizeof(phantom_data_t));
+	if((cl->cmds == NULL) || (cl->values == NULL))
+	{
+		phantom_cmdlist_destroy(cl);
+		return NULL;
+	}
+	return cl;
+}
+
+
+
+/*
+ * Records a write of a constant value. addr is based from 0 inside the AXI slave of the IP.
+ * Returns PHANTOM_OK if recorded, or PHANTOM_ERROR if the address is invalid.
+ */
+int phantom_cmdlist_write(phantom_cmdlist_t *cl, phantom_ip_t *ip, const phantom_address_t addr, const phantom_data_t val, const uint8_t axi_slave)
+{
+	cmd_t cmd = {.op = CMD_WRITE, .value = val};
+
+	if((cmd.reg = cmdlist_get_reg(ip, addr, axi_slave)) == NULL)
+		return PHANTOM_ERROR;
+	return cmdlist_append(cl, &cmd, 1);
+}
+
+
+
+/*
+ * Records a write of the value passed as params[param] to phantom_cmdlist_replay().
+ * Returns PHANTOM_OK if recorded, or PHANTOM_ERROR if the address or param index is invalid.
+ */
+int phantom_cmdlist_write_param(phantom_cmdlist_t *cl, phantom_ip_t *ip, const phantom_address_t addr, const uint32_t param, const uint8_t axi_slave)
+{
+	cmd_t cmd = {.op = CMD_WRITE, .slot = param};
+
+	if((param >= cl->num_params) || ((cmd.reg = cmdlist_get_reg(ip, addr, axi_slave)) == NULL))
+		return PHANTOM_ERROR;
+	return cmdlist_append(cl, &cmd, 0);
+}
+
+
+
+/*
+ * Records a read returned as results[result] from phantom_cmdlist_replay().
+ * Returns PHANTOM_OK if recorded, or PHANTOM_ERROR if the address or result index is invalid.
+ */
+int phantom_cmdlist_read(phantom_cmdlist_t *cl, phantom_ip_t *ip, const phantom_address_t addr, const uint32_t result, const uint8_t axi_slave)
+{
+	cmd_t cmd = {.op = CMD_READ, .slot = cl->num_params + result};
+
+	if((result >= cl->num_results) || ((cmd.reg = cmdlist_get_reg(ip, addr, axi_slave)) == NULL))
+		return PHANTOM_ERROR;
+	return cmdlist_append(cl, &cmd, 0);
+}
+
+
+
+/*
+ * Records a poll that reads the register until (reg & mask) == val, or timeout_ms passes
+ * (negative waits forever). A timed out poll ends the replay.
+ * Returns PHANTOM_OK if recorded, or PHANTOM_ERROR if the address is invalid.
+ */
+int phantom_cmdlist_poll(phantom_cmdlist_t *cl, phantom_ip_t *ip, const phantom_address_t addr, const phantom_data_t mask, const phantom_data_t val, const uint8_t axi_slave, const int timeout_ms)
+{
+	cmd_t cmd = {.op = CMD_POLL, .mask = mask, .value = val & mask, .timeout_ms = timeout_ms};
+
+	if((cmd.reg = cmdlist_get_reg(ip, addr, axi_slave)) == NULL)
+		return PHANTOM_ERROR;
+	return cmdlist_append(cl, &cmd, 0);
+}
+
+
+
+/*
+ * Records a start of the IP, as phantom_fpga_ip_start().
+ * Returns PHANTOM_OK if recorded, or PHANTOM_ERROR if the IP's control registers are not mapped.
+ */
+int phantom_cmdlist_start(phantom_cmdlist_t *cl, phantom_ip_t *ip)
+{
+	cmd_t cmd = {.op = CMD_START, .ip = ip};
+
+	if((cmd.reg = cmdlist_get_reg(ip, IPCORE_CTRL_ADDR, 0)) == NULL)
+		return PHANTOM_ERROR;
+	return cmdlist_append(cl, &cmd, 0);
+}
+
+
+
+/*
+ * Records a wait for the IP to complete, as phantom_fpga_ip_wait_done() under the IP's wait policy.
+ * A timed out wait ends the replay.
+ * Returns PHANTOM_OK if recorded, or PHANTOM_ERROR if the IP's control registers are not mapped.
+ */
+int phantom_cmdlist_wait_done(phantom_cmdlist_t *cl, phantom_ip_t *ip, const int timeout_ms)
+{
+	cmd_t cmd = {.op = CMD_WAIT, .ip = ip, .timeout_ms = timeout_ms};
+
+	if((cmd.reg = cmdlist_get_reg(ip, IPCORE_CTRL_ADDR, 0)) == NULL)
+		return PHANTOM_ERROR;
+	return cmdlist_append(cl, &cmd, 0);
+}
+
+
+
+static int cmdlist_poll(const cmd_t *cmd)
+{
+	struct timespec now, deadline;
+	uint32_t spins = 0;
+
+	if(cmd->timeout_ms >= 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += cmd->timeout_ms / 1000;
+		deadline.tv_nsec += (cmd->timeout_ms % 1000) * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+	while((*cmd->reg & cmd->mask) != cmd->value)
+	{
+		if((cmd->timeout_ms >= 0) && ((++spins % CMDLIST_POLL_CLOCK_SPINS) == 0))
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if((now.tv_sec > deadline.tv_sec) || ((now.tv_sec == deadline.tv_sec) && (now.tv_nsec >= deadline.tv_nsec)))
+				return PHANTOM_FALSE;
+		}
+	}
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Replays a recorded command list. All addresses were checked when recorded so none are checked here.
+ * Parameters
+ *    cl (phantom_cmdlist_t*) – The command list.
+ *    params (const phantom_data_t*) – num_params values for the recorded param writes, may be NULL if none.
+ *    results (phantom_data_t*) – Receives num_results values from the recorded reads, may be NULL if none.
+ * Returns PHANTOM_OK if all commands ran, PHANTOM_FALSE if a poll or wait timed out, or
+ * PHANTOM_ERROR if a start or wait failed, or the list is already being replayed by another thread.
+ * Note: a list is replayed by one thread at a time; use one list per thread to replay concurrently.
+ *
+ */
+int phantom_cmdlist_replay(phantom_cmdlist_t *cl, const phantom_data_t *params, phantom_data_t *results)
+{
+	phantom_data_t *values = cl->values;
+	const cmd_t *cmd = cl->cmds;
+	const cmd_t *end = cmd + cl->num_cmds;
+	int ret = PHANTOM_OK;
+
+	if(__atomic_exchange_n(&cl->replaying, 1, __ATOMIC_ACQUIRE))
+		return PHANTOM_ERROR;
+	if(cl->num_params)
+		memcpy(values, params, cl->num_params * sizeof(phantom_data_t));
+
+	for(; cmd < end; cmd++)
+	{
+		switch(cmd->op)
+		{
+			case CMD_WRITE:
+				*cmd->reg = values[cmd->slot];
+				break;
+			case CMD_READ:
+				values[cmd->slot] = *cmd->reg;
+				break;
+			case CMD_START:
+				/* through the IP's lock, and timed for its adaptive wait, as any other start */
+				if((ret = phantom_fpga_ip_start(cmd->ip)) != PHANTOM_OK)
+					goto done;
+				break;
+			case CMD_POLL:
+				if((ret = cmdlist_poll(cmd)) != PHANTOM_OK)
+					goto done;
+				break;
+			case CMD_WAIT:
+				if((ret = phantom_fpga_ip_wait_done(cmd->ip, cmd->timeout_ms)) != PHANTOM_OK)
+					goto done;
+				break;
+		}
+	}
+
+done:
+	if(cl->num_results)
+		memcpy(results, values + cl->num_params, cl->num_results * sizeof(phantom_data_t));
+	__atomic_store_n(&cl->replaying, 0, __ATOMIC_RELEASE);
+
+	return ret;
+}
+
+
+
+/*
+ * Frees a command list.
+ */
+void phantom_cmdlist_destroy(phantom_cmdlist_t *cl)
+{
+	if(cl == NULL)
+		return;
+	free(cl->cmds);
+	free(cl->values);
+	free(cl);
+}
@@ -0,0 +1,342 @@
+/*
+ * File:         phantom_api_daemon.c
+ *
+ * Project:      PHANTOM
+ *
+ * Organisation: University of York
+ *
+ * Author(s):    PHANTOM team
+ *
+ * Version:      0.11 (dev only)
+ *
+ * Description:  Messages between the API and phantomd, the resident daemon that holds the
+ *               downloaded design's configuration and its opened uio nodes. A client attaches in
+ *               one round trip, taking the configuration and the nodes' fds instead of parsing the
+ *               XML and scanning sysfs itself, and asks the daemon to configure the FPGA so that
+ *               reconfigurations from many processes never race on the configuration device.
+ *
+ * Copyright:    University of York. 2026.
+ *
+ * Legal:        All rights reserved. No warranty, explicit or implicit, provided.
+ *
+ * Revisions:
+ *
+ * Notes:        The daemon listens on PHANTOMD_SOCKET_FILE, a SOCK_SEQPACKET Unix socket, and
+ *               serves one request per connection. Fds are passed with SCM_RIGHTS. The daemon
+ *               opens each uio node afresh for every client, so no two processes share an open
+ *               file, and with it the node's interrupt event count; each process maps the nodes
+ *               itself. Anyone able to connect to the socket can drive the IP cores, so access is
+ *               controlled by the socket file's permissions. The daemon itself is in phantomd/.
+ *
+ *
+*/
+
+
+
+#include "phantom_api.h"
+#include "phantom_api_lowlevel.h"
+#include "phantom_api_private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+
+
+/*
+ * Connect to phantomd.
+ * Returns the connected socket, or -1 if the daemon is not running.
+ */
+static int daemon_connect(void)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	struct timeval tv = {PHANTOMD_TIMEOUT_MS / 1000, (PHANTOMD_TIMEOUT_MS % 1000) * 1000};
+	int sock;
+
+	strncpy(addr.sun_path, PHANTOMD_SOCKET_FILE, sizeof(addr.sun_path) - 1);
+	if((sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+	if(connect(sock, (struct sockaddr *) &addr, sizeof(addr)) ||
+	   setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) || setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)))
+	{
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+
+
+static int daemon_request(int sock, uint32_t op)
+{
+	phantomd_req_t req = {PHANTOMD_MAGIC, PHANTOMD_VERSION, op};
+
+	return (send(sock, &req, sizeof(req), MSG_NOSIGNAL) == (ssize_t) sizeof(req)) ? 0 : -1;
+}
+
+
+
+/*
+ * Receive a reply from phantomd, and the fds passed with it in to fds, which has room for
+ * PHANTOMD_FDS_PER_MSG.
+ * Returns the number of fds received, or -1 if the reply is invalid, in which case no fd is left open.
+ */
+static int daemon_recv_reply(int sock, phantomd_reply_t *reply, int *fds)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(PHANTOMD_FDS_PER_MSG * sizeof(int))];
+	} ctrl;
+	struct iovec iov = {reply, sizeof(phantomd_reply_t)};
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+	struct cmsghdr *cmsg;
+	ssize_t len;
+	int num_fds = 0, n;
+
+	do
+		len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	while((len < 0) && (errno == EINTR));
+	if(len < 0)
+		return -1;
+	for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS))
+			continue;
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if(num_fds + n > PHANTOMD_FDS_PER_MSG)
+			n = PHANTOMD_FDS_PER_MSG - num_fds; // cannot happen, the buffer only has room for as many
+		memcpy(&fds[num_fds], CMSG_DATA(cmsg), n * sizeof(int));
+		num_fds += n;
+	}
+	if((len != sizeof(phantomd_reply_t)) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+	   (reply->magic != PHANTOMD_MAGIC) || (reply->num_fds != (uint32_t) num_fds))
+	{
+		#ifdef DEBUG
+			printf("error: invalid reply from phantomd\n");
+		#endif
+		while(num_fds > 0)
+			close(fds[--num_fds]);
+		return -1;
+	}
+	return num_fds;
+}
+
+
+
+/*
+ * Attach a context to phantomd: load the configuration snapshot it passes and index the uio
+ * nodes it has opened, ready to be mapped.
+ * Returns 0 on success, or -1 if the daemon is not running or fails, leaving no uio node indexed.
+ */
+int daemon_attach(phantom_context_t *ctx)
+{
+	phantomd_reply_t reply;
+	int fds[PHANTOMD_FDS_PER_MSG];
+	uint32_t num_uio;
+	int sock, n, ret = -1;
+
+	if((sock = daemon_connect()) < 0)
+		return -1;
+	if(daemon_request(sock, PHANTOMD_OP_ATTACH) || ((n = daemon_recv_reply(sock, &reply, fds)) < 0))
+	{
+		close(sock);
+		return -1;
+	}
+	if((reply.status != PHANTOM_OK) || (n != 1))
+	{
+		while(n > 0)
+			close(fds[--n]);
+		close(sock);
+		return -1;
+	}
+	ret = snapshot_load_fd(&ctx->conf, fds[0]);
+	close(fds[0]);
+	if(ret)
+	{
+		close(sock);
+		return -1;
+	}
+
+	close_devs(ctx);
+	for(num_uio = reply.num_uio; num_uio > 0; num_uio -= (uint32_t) n)
+	{
+		if(((n = daemon_recv_reply(sock, &reply, fds)) <= 0) || (reply.status != PHANTOM_OK) || ((uint32_t) n > num_uio))
+			break;
+		for(int i = 0; i < n; i++)
+		{
+			if(uio_add_opened(ctx, reply.uio[i].num, (phantom_address_t) reply.uio[i].addr, fds[i]) == 0)
+				continue;
+			while(i < n)
+				close(fds[i++]);
+			n = -1;
+		}
+		if(n < 0)
+			break;
+	}
+	close(sock);
+	if(num_uio > 0)
+	{
+		while(n > 0)
+			close(fds[--n]); // from a reply with an error or too many fds
+		close_devs(ctx);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+/*
+ * Ask phantomd to configure the FPGA with the design's bitfile.
+ * Returns the result of the configuration, as phantom_fpga_configure(), or PHANTOM_NOT_FOUND
+ * if the daemon is not running.
+ */
+int daemon_configure(void)
+{
+	phantomd_reply_t reply;
+	int fds[PHANTOMD_FDS_PER_MSG];
+	int sock, n;
+
+	if((sock = daemon_connect()) < 0)
+		return PHANTOM_NOT_FOUND;
+	n = daemon_request(sock, PHANTOMD_OP_CONFIGURE) ? -1 : daemon_recv_reply(sock, &reply, fds);
+	close(sock);
+	if(n < 0)
+		return PHANTOM_ERROR;
+	while(n > 0)
+		close(fds[--n]);
+	return reply.status;
+}
+
+
+
+/*
+ * Receive a client's request, in phantomd.
+ * Returns the requested PHANTOMD_OP_, or -1 if the request is invalid.
+ */
+int daemon_recv_request(int sock)
+{
+	phantomd_req_t req;
+	ssize_t len;
+
+	do
+		len = recv(sock, &req, sizeof(req), 0);
+	while((len < 0) && (errno == EINTR));
+	if((len != sizeof(req)) || (req.magic != PHANTOMD_MAGIC) || (req.version != PHANTOMD_VERSION))
+		return -1;
+	return (int) req.op;
+}
+
+
+
+static int daemon_send_reply(int sock, phantomd_reply_t *reply, const int *fds)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(PHANTOMD_FDS_PER_MSG * sizeof(int))];
+	} ctrl;
+	struct iovec iov = {reply, sizeof(phantomd_reply_t)};
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+	struct cmsghdr *cmsg;
+	ssize_t len;
+
+	if(reply->num_fds > 0)
+	{
+		memset(&ctrl, 0, sizeof(ctrl));
+		msg.msg_control = ctrl.buf;
+		msg.msg_controllen = CMSG_SPACE(reply->num_fds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(reply->num_fds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, reply->num_fds * sizeof(int));
+	}
+	do
+		len = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	while((len < 0) && (errno == EINTR));
+	return (len == sizeof(phantomd_reply_t)) ? 0 : -1;
+}
+
+
+
+/*
+ * Answer a client's request with a status only, in phantomd.
+ * Returns 0 on success, -1 if the client has gone.
+ */
+int daemon_send_status(int sock, int status)
+{
+	phantomd_reply_t reply;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.magic = PHANTOMD_MAGIC;
+	reply.status = status;
+	return daemon_send_reply(sock, &reply, NULL);
+}
+
+
+
+/*
+ * Close the fds opened for one reply to an attach.
+ */
+static void daemon_close_fds(int *fds, uint32_t num_fds)
+{
+	while(num_fds > 0)
+		close(fds[--num_fds]);
+}
+
+
+
+/*
+ * Answer an attach, in phantomd: pass the configuration snapshot in snap_fd, then the context's
+ * opened uio nodes, PHANTOMD_FDS_PER_MSG at a time. Each node is opened afresh for the client,
+ * so the client has its own interrupt event count rather than sharing the daemon's open file.
+ * Returns 0 on success, -1 if the client has gone or a node cannot be opened.
+ */
+int daemon_send_context(int sock, phantom_context_t *ctx, int snap_fd)
+{
+	char bufstr[LINE_LEN];
+	phantomd_reply_t reply;
+	int fds[PHANTOMD_FDS_PER_MSG];
+	int ret;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.magic = PHANTOMD_MAGIC;
+	reply.status = PHANTOM_OK;
+	for(int i = 0; i < ctx->num_uio; i++)
+		if(ctx->uio[i].flags & UIO_DEV_OPENED)
+			reply.num_uio++;
+	reply.num_fds = 1;
+	if(daemon_send_reply(sock, &reply, &snap_fd))
+		return -1;
+
+	reply.num_fds = 0;
+	for(int i = 0; i < ctx->num_uio; i++)
+	{
+		if(!(ctx->uio[i].flags & UIO_DEV_OPENED))
+			continue;
+		sprintf(bufstr, "%s%d", UIO_DEVS_LOC, ctx->uio[i].num);
+		if((fds[reply.num_fds] = open(bufstr, O_RDWR | O_CLOEXEC)) < 0)
+		{
+			daemon_close_fds(fds, reply.num_fds);
+			return -1;
+		}
+		reply.uio[reply.num_fds].num = ctx->uio[i].num;
+		reply.uio[reply.num_fds].addr = (uint64_t) ctx->uio[i].addr;
+		if(++reply.num_fds == PHANTOMD_FDS_PER_MSG)
+		{
+			ret = daemon_send_reply(sock, &reply, fds);
+			daemon_close_fds(fds, reply.num_fds); // the client holds its own references
+			if(ret)
+				return -1;
+			reply.num_fds = 0;
+		}
+	}
+	ret = (reply.num_fds > 0) ? daemon_send_reply(sock, &reply, fds) : 0;
+	daemon_close_fds(fds, reply.num_fds);
+	return ret;
+}
@@ -0,0 +1,418 @@
+/*
+ * File:         phantom_api_dma.c
+ *
+ * Project:      PHANTOM
+ *
+ * Organisation: University of York
+ *
+ * Author(s):    PHANTOM team
+ *
+ * Version:      0.11 (dev only)
+ *
+ * Description:  Driver for Xilinx AXI DMA cores placed inside the address space of a PHANTOM IP.
+ *               Supports simple (register direct) mode and scatter-gather mode with descriptor
+ *               rings held in the IP's shared memory.
+ *
+ * Copyright:    University of York. 2026.
+ *
+ * Legal:        All rights reserved. No warranty, explicit or implicit, provided.
+ *
+ * Revisions:
+ *
+ * Notes:        The DMA core's registers are reached through the IP's s0 slave at offset dma_core.
+ *               Buffer addresses are physical (bus) addresses, e.g. from phantom_fpga_mem_get_phys().
+ *
+ *
+*/
+
+
+
+#include "phantom_api.h"
+#include "phantom_api_lowlevel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+/* Scatter-gather channel state */
+struct phantom_dma_chan {
+	phantom_ip_t *ip;
+	volatile uint8_t *regs; // channel register block
+	volatile uint8_t *descs; // descriptor ring in the IP's shared memory
+	phantom_address_t descs_phys;
+	uint32_t num_descs;
+	uint32_t max_len; // bytes per descriptor
+	uint32_t head; // next descriptor to fill
+	uint32_t tail; // oldest descriptor not yet reaped
+	uint32_t in_flight;
+	uint8_t *last; // per descriptor: set if it ends a queued transfer
+	int direction;
+	int error;
+};
+
+
+
+static inline void dma_write(volatile uint8_t *base, uint32_t offset, uint32_t value)
+{
+	*((volatile uint32_t *)(base + offset)) = value;
+}
+
+
+
+static inline uint32_t dma_read(volatile uint8_t *base, uint32_t offset)
+{
+	return *((volatile uint32_t *)(base + offset));
+}
+
+
+
+static inline uint32_t addr_lo(phantom_address_t addr)
+{
+	return (uint32_t) addr;
+}
+
+
+
+static inline uint32_t addr_hi(phantom_address_t addr)
+{
+	return (uint32_t)((uint64_t) addr >> 32);
+}
+
+
+
+/*
+ * Returns the register block of the given channel of a DMA core, or NULL if the core does not lie
+ * inside the IP's s0 slave or the direction is invalid.
+ */
+static volatile uint8_t *get_dma_channel(phantom_ip_t* ip, const phantom_address_t dma_core, const int direction)
+{
+	if(ip_ensure_mapped(ip) || (ip->s0_vmem_base == NULL) || (dma_core > ip->s0_axi_address_size) ||
+	   (ip->s0_axi_address_size - dma_core < AXI_DMA_REG_SPACE) || (dma_core & 3))
+		return NULL;
+
+	switch(direction)
+	{
+		case PHANTOM_DMA_TO_IP:
+			return (volatile uint8_t *) ip->s0_vmem_base + dma_core + AXI_DMA_MM2S_OFFSET;
+		case PHANTOM_DMA_FROM_IP:
+			return (volatile uint8_t *) ip->s0_vmem_base + dma_core + AXI_DMA_S2MM_OFFSET;
+		default:
+			return NULL;
+	}
+}
+
+
+
+/*
+ * Wait for a simple mode channel to go idle. Returns 0 when idle, -1 on a DMA error.
+ * Note: if the stream stalls this function will hang.
+ */
+static int dma_wait_idle(volatile uint8_t *regs)
+{
+	uint32_t status;
+
+	while(!((status = dma_read(regs, AXI_DMA_DMASR)) & AXI_DMA_DMASR_IDLE_BM))
+		if(status & (AXI_DMA_DMASR_ERR_BM | AXI_DMA_DMASR_HALTED_BM))
+			return -1;
+	return 0;
+}
+
+
+
+/*
+ * Cause a DMA core in the specified IP core to initiate a simple mode DMA transfer. The function
+ * returns once the transfer has been started. Transfers longer than the core's buffer length
+ * register allows (AXI_DMA_DEFAULT_MAX_LEN) are split, and the function then blocks until all but
+ * the last part have completed.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core containing the DMA core.
+ *    dma_core (phantom_address_t) – The offset, starting at 0, of the DMA core inside the s0 address space of the IP.
+ *    buffaddr (phantom_address_t) – The physical address in main memory to start the transfer from.
+ *    length (phantom_address_t) – The length in bytes of the transfer.
+ *    direction (int) – PHANTOM_DMA_TO_IP or PHANTOM_DMA_FROM_IP.
+ * Returns PHANTOM_OK if the transfer was started, PHANTOM_FALSE if the channel is busy, in error
+ * or built for scatter-gather, or PHANTOM_ERROR on invalid parameters.
+ *
+ */
+int phantom_fpga_dma_transfer(phantom_ip_t* ip, const phantom_address_t dma_core, const phantom_address_t buffaddr,
+		const phantom_address_t length, const int direction)
+{
+	volatile uint8_t *regs;
+	phantom_address_t addr = buffaddr, remaining = length;
+	uint32_t status, len;
+	const uint32_t chunk = AXI_DMA_DEFAULT_MAX_LEN & ~(AXI_DMA_BD_SIZE - 1); // keeps split parts aligned
+
+	if(((regs = get_dma_channel(ip, dma_core, direction)) == NULL) || (length == 0))
+		return PHANTOM_ERROR;
+
+	status = dma_read(regs, AXI_DMA_DMASR);
+	if(status & (AXI_DMA_DMASR_SGINCLD_BM | AXI_DMA_DMASR_ERR_BM))
+		return PHANTOM_FALSE;
+	if(status & AXI_DMA_DMASR_HALTED_BM)
+	{
+		dma_write(regs, AXI_DMA_DMACR, dma_read(regs, AXI_DMA_DMACR) | AXI_DMA_DMACR_RS_BM);
+		if(dma_read(regs, AXI_DMA_DMASR) & AXI_DMA_DMASR_HALTED_BM)
+			return PHANTOM_FALSE;
+	}
+	else if(!(status & AXI_DMA_DMASR_IDLE_BM))
+		return PHANTOM_FALSE; // channel running but not idle - start of a previous transfer
+
+	for(;;)
+	{
+		len = (remaining > AXI_DMA_DEFAULT_MAX_LEN) ? chunk : (uint32_t) remaining;
+		dma_write(regs, AXI_DMA_ADDR, addr_lo(addr));
+		dma_write(regs, AXI_DMA_ADDR_MSB, addr_hi(addr));
+		dma_write(regs, AXI_DMA_LENGTH, len); // writing the length starts the transfer
+		remaining -= len;
+		addr += len;
+		if(remaining == 0)
+			break;
+		if(dma_wait_idle(regs))
+			return PHANTOM_FALSE;
+	}
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Check if the DMA core in the specified IP core is idle in the given direction. Because the Xilinx
+ * AXI DMA core is bidirectional, it is possible for a transfer to be proceeding in one direction
+ * whilst the other is idle.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core containing the DMA core.
+ *    dma_core (phantom_address_t) – The offset, starting at 0, of the DMA core inside the s0 address space of the IP.
+ *    direction (int) – PHANTOM_DMA_TO_IP or PHANTOM_DMA_FROM_IP.
+ * Returns PHANTOM_OK if the channel is idle or halted, PHANTOM_FALSE if it is busy, or PHANTOM_ERROR.
+ *
+ */
+int phantom_fpga_dma_is_idle(phantom_ip_t* ip, const phantom_address_t dma_core, const int direction)
+{
+	volatile uint8_t *regs;
+
+	if((regs = get_dma_channel(ip, dma_core, direction)) == NULL)
+		return PHANTOM_ERROR;
+
+	if(dma_read(regs, AXI_DMA_DMASR) & (AXI_DMA_DMASR_IDLE_BM | AXI_DMA_DMASR_HALTED_BM))
+		return PHANTOM_OK;
+	return PHANTOM_FALSE;
+}
+
+
+
+/*
+ * Open one channel of a scatter-gather AXI DMA core for queued transfers. A ring of num_descs
+ * descriptors is allocated from the IP's shared memory, so the DMA core's SG port must be able to
+ * reach it. The channel must be halted; it is started and left waiting for descriptors.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core containing the DMA core.
+ *    dma_core (phantom_address_t) – The offset, starting at 0, of the DMA core inside the s0 address space of the IP.
+ *    direction (int) – PHANTOM_DMA_TO_IP or PHANTOM_DMA_FROM_IP.
+ *    num_descs (uint32_t) – The number of descriptors in the ring, at least 2.
+ *    max_len (uint32_t) – The largest length a descriptor may carry, i.e. 2^width - 1 for the core's
+ *                         buffer length register width. 0 selects the core's default of 14 bits.
+ * Returns the channel, or NULL on failure.
+ *
+ */
+phantom_dma_t *phantom_fpga_dma_open(phantom_ip_t* ip, const phantom_address_t dma_core, const int direction,
+		const uint32_t num_descs, const uint32_t max_len)
+{
+	phantom_dma_t *chan;
+	volatile uint8_t *regs, *desc;
+	phantom_address_t next;
+	uint32_t status;
+
+	if(((regs = get_dma_channel(ip, dma_core, direction)) == NULL) || (num_descs < 2))
+		return NULL;
+	if((ip->m0_cache & (MEM_CACHED | MEM_COHERENT)) == MEM_CACHED)
+	{
+		#ifdef DEBUG
+			printf("error: %s shared memory is cached and not coherent, dma descriptors need it uncached\n", ip->idstring);
+		#endif
+		return NULL; // the descriptors are written and read back without cache maintenance
+	}
+
+	status = dma_read(regs, AXI_DMA_DMASR);
+	if(!(status & AXI_DMA_DMASR_SGINCLD_BM) || !(status & AXI_DMA_DMASR_HALTED_BM))
+	{
+		#ifdef DEBUG
+			printf("error: dma channel not halted or not built with scatter-gather\n");
+		#endif
+		return NULL;
+	}
+
+	if((chan = calloc(1, sizeof(phantom_dma_t))) == NULL)
+		return NULL;
+	if((chan->last = calloc(num_descs, 1)) == NULL)
+	{
+		free(chan);
+		return NULL;
+	}
+	if((chan->descs = phantom_fpga_mem_alloc(ip, num_descs * AXI_DMA_BD_SIZE)) == NULL)
+	{
+		free(chan->last);
+		free(chan);
+		return NULL;
+	}
+	chan->ip = ip;
+	chan->regs = regs;
+	chan->descs_phys = phantom_fpga_mem_get_phys(ip, (void *) chan->descs);
+	chan->num_descs = num_descs;
+	chan->max_len = (max_len ? max_len : AXI_DMA_DEFAULT_MAX_LEN) & ~(AXI_DMA_BD_SIZE - 1);
+	chan->direction = direction;
+
+	/* link the descriptors in to a ring */
+	for(uint32_t i = 0; i < num_descs; i++)
+	{
+		desc = chan->descs + i * AXI_DMA_BD_SIZE;
+		next = chan->descs_phys + ((i + 1) % num_descs) * AXI_DMA_BD_SIZE;
+		for(uint32_t word = 0; word < AXI_DMA_BD_SIZE; word += sizeof(uint32_t))
+			dma_write(desc, word, 0);
+		dma_write(desc, AXI_DMA_BD_NXTDESC, addr_lo(next));
+		dma_write(desc, AXI_DMA_BD_NXTDESC_MSB, addr_hi(next));
+	}
+
+	/* current descriptor may only be written while halted */
+	dma_write(regs, AXI_DMA_CURDESC, addr_lo(chan->descs_phys));
+	dma_write(regs, AXI_DMA_CURDESC_MSB, addr_hi(chan->descs_phys));
+	dma_write(regs, AXI_DMA_DMACR, dma_read(regs, AXI_DMA_DMACR) | AXI_DMA_DMACR_RS_BM);
+
+	return chan;
+}
+
+
+
+/*
+ * Queue a transfer on a scatter-gather channel. Transfers longer than the channel's max_len are
+ * split over several descriptors. The function returns once the descriptors are handed to the core.
+ * Parameters
+ *    chan (phantom_dma_t*) – The channel.
+ *    buffaddr (phantom_address_t) – The physical address of the buffer.
+ *    length (uint32_t) – The length in bytes of the transfer.
+ * Returns PHANTOM_OK if queued, PHANTOM_FALSE if the ring has too few free descriptors (call
+ * phantom_fpga_dma_reap() and retry), or PHANTOM_ERROR if the channel is in error.
+ *
+ */
+int phantom_fpga_dma_queue(phantom_dma_t *chan, const phantom_address_t buffaddr, const uint32_t length)
+{
+	volatile uint8_t *desc = NULL;
+	uint32_t ndescs, len, ctrl, remaining = length;
+	phantom_address_t addr = buffaddr;
+
+	if(chan->error || (length == 0))
+		return PHANTOM_ERROR;
+
+	ndescs = (length + chan->max_len - 1) / chan->max_len;
+	if(ndescs > chan->num_descs - chan->in_flight)
+		return PHANTOM_FALSE;
+
+	for(uint32_t i = 0; i < ndescs; i++)
+	{
+		len = (remaining > chan->max_len) ? chan->max_len : remaining;
+		ctrl = len;
+		if(chan->direction == PHANTOM_DMA_TO_IP)
+			ctrl |= ((i == 0) ? AXI_DMA_BD_CTRL_SOF_BM : 0) | ((i == ndescs - 1) ? AXI_DMA_BD_CTRL_EOF_BM : 0);
+
+		desc = chan->descs + chan->head * AXI_DMA_BD_SIZE;
+		dma_write(desc, AXI_DMA_BD_BUFFER, addr_lo(addr));
+		dma_write(desc, AXI_DMA_BD_BUFFER_MSB, addr_hi(addr));
+		dma_write(desc, AXI_DMA_BD_CONTROL, ctrl);
+		dma_write(desc, AXI_DMA_BD_STATUS, 0);
+		chan->last[chan->head] = (i == ndescs - 1);
+		chan->head = (chan->head + 1) % chan->num_descs;
+
+		addr += len;
+		remaining -= len;
+	}
+	chan->in_flight += ndescs;
+
+	/* descriptors must be visible before the tail write hands them over */
+	__sync_synchronize();
+	dma_write(chan->regs, AXI_DMA_TAILDESC_MSB, addr_hi(chan->descs_phys + (desc - chan->descs)));
+	dma_write(chan->regs, AXI_DMA_TAILDESC, addr_lo(chan->descs_phys + (desc - chan->descs)));
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Collect completed descriptors of a scatter-gather channel, freeing them for new transfers.
+ * Parameters
+ *    chan (phantom_dma_t*) – The channel.
+ * Returns the number of queued transfers completed since the last call, or PHANTOM_ERROR if the
+ * core reported an error (the channel must then be closed).
+ *
+ */
+int phantom_fpga_dma_reap(phantom_dma_t *chan)
+{
+	volatile uint8_t *desc;
+	uint32_t status;
+	int completed = 0;
+
+	if(dma_read(chan->regs, AXI_DMA_DMASR) & AXI_DMA_DMASR_ERR_BM)
+		chan->error = 1;
+
+	while(chan->in_flight && !chan->error)
+	{
+		desc = chan->descs + chan->tail * AXI_DMA_BD_SIZE;
+		status = dma_read(desc, AXI_DMA_BD_STATUS);
+		if(!(status & AXI_DMA_BD_STS_CMPLT_BM))
+			break;
+		if(status & AXI_DMA_BD_STS_ERR_BM)
+			chan->error = 1;
+		dma_write(desc, AXI_DMA_BD_STATUS, 0);
+		completed += chan->last[chan->tail];
+		chan->tail = (chan->tail + 1) % chan->num_descs;
+		chan->in_flight--;
+	}
+
+	if(chan->error)
+		return PHANTOM_ERROR;
+	return completed;
+}
+
+
+
+/*
+ * Wait until every transfer queued on a scatter-gather channel has completed.
+ * Parameters
+ *    chan (phantom_dma_t*) – The channel.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR if the core reported an error.
+ * Note: if the stream stalls this function will hang.
+ *
+ */
+int phantom_fpga_dma_wait(phantom_dma_t *chan)
+{
+	while(chan->in_flight)
+		if(phantom_fpga_dma_reap(chan) == PHANTOM_ERROR)
+			return PHANTOM_ERROR;
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Stop a scatter-gather channel and release its descriptor ring. Transfers still in flight are abandoned.
+ * Parameters
+ *    chan (phantom_dma_t*) – The channel.
+ *
+ */
+void phantom_fpga_dma_close(phantom_dma_t *chan)
+{
+	dma_write(chan->regs, AXI_DMA_DMACR, dma_read(chan->regs, AXI_DMA_DMACR) & ~AXI_DMA_DMACR_RS_BM);
+	for(int i = 0; i < REG_READ_TIMEOUT; i++)
+	{
+		if(dma_read(chan->regs, AXI_DMA_DMASR) & AXI_DMA_DMASR_HALTED_BM)
+			break;
+		usleep(1);
+	}
+
+	phantom_fpga_mem_free(chan->ip, (void *) chan->descs);
+	free(chan->last);
+	free(chan);
+}
@@ -0,0 +1,474 @@
+/*
+ * File:         phantom_api_lease.c
+ *
+ * Project:      PHANTOM
+ *
+ * Organisation: University of York
+ *
+ * Author(s):    PHANTOM team
+ *
+ * Version:      0.11 (dev only)
+ *
+ * Description:  Node wide IP leases. Processes that share IP cores, such as the ranks of an MPI
+ *               job, take exclusive or shared leases on them through a control block in shared
+ *               memory, so only one of them drives a core at a time.
+ *
+ * Copyright:    University of York. 2026.
+ *
+ * Legal:        All rights reserved. No warranty, explicit or implicit, provided.
+ *
+ * Revisions:
+ *
+ * Notes:        The block, LEASE_BLOCK_FILE, holds one slot per leased IP keyed by the IP's s0 base
+ *               address, so any process mapping the same core finds the same slot. Each slot is
+ *               guarded by a robust, process shared mutex which is only held while the slot is
+ *               updated; an uncontended lease or release is one atomic operation on it and no
+ *               system call. A holder that dies mid-update leaves the mutex to be recovered by the
+ *               next locker, and leases of dead processes are pruned whenever an acquire is blocked.
+ *               Blocked acquirers sleep on the slot's release counter as a shared futex, waking at
+ *               least every LEASE_PRUNE_MS to prune. Leases are advisory: cores are not fenced from
+ *               processes that do not take them.
+ *
+ *
+*/
+
+
+
+#include "phantom_api.h"
+#include "phantom_api_lowlevel.h"
+#include "phantom_api_private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+
+
+typedef struct {
+	pthread_mutex_t lock; // robust and process shared, held only while the slot is updated
+	uint32_t seq; // futex, bumped on every release
+	uint32_t waiters; // processes sleeping on seq
+	uint64_t key; // s0 base address of the IP, 0 if the slot is free
+	pid_t excl_pid; // exclusive holder, 0 if none
+	uint32_t num_shared;
+	pid_t shared_pid[LEASE_MAX_SHARED];
+} lease_slot_t;
+
+
+typedef struct {
+	uint32_t magic; // set last, once the block is initialised
+	uint32_t version;
+	uint32_t size; // catches processes built with a different layout
+	pthread_mutex_t lock; // robust and process shared, guards slot allocation
+	lease_slot_t slot[LEASE_MAX_SLOTS];
+} lease_block_t;
+
+
+
+static int lease_futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+
+
+static void lease_futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+
+static int lease_mutex_init(pthread_mutex_t *m)
+{
+	pthread_mutexattr_t attr;
+	int err;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	err = pthread_mutex_init(m, &attr);
+	pthread_mutexattr_destroy(&attr);
+	return err;
+}
+
+
+
+/*
+ * Lock a block or slot mutex. If its last holder died while holding it the mutex is made
+ * consistent again; any lease that process held is pruned once it blocks an acquire.
+ * Returns 0 on success, -1 if the mutex is unusable.
+ */
+static int lease_lock(pthread_mutex_t *m)
+{
+	int err = pthread_mutex_lock(m);
+
+	if(err == EOWNERDEAD)
+		err = pthread_mutex_consistent(m);
+	return err ? -1 : 0;
+}
+
+
+
+/*
+ * Restrict a new lease block to its creator, or to PHANTOM_ACCESS_GROUP if that is set and the
+ * creator may give the block to it. Anyone able to write the block can take or steal any lease.
+ * Returns 0 on success, -1 on fail.
+ */
+static int lease_set_access(int fd)
+{
+	struct group *gr;
+
+	if(fchmod(fd, 0600))
+		return -1;
+	if(PHANTOM_ACCESS_GROUP[0] == '\0')
+		return 0;
+	if(((gr = getgrnam(PHANTOM_ACCESS_GROUP)) == NULL) || fchown(fd, -1, gr->gr_gid))
+	{
+		#ifdef DEBUG
+			printf("error: unable to give the lease block to group %s, left to its creator\n", PHANTOM_ACCESS_GROUP);
+		#endif
+		return 0;
+	}
+	return fchmod(fd, 0660);
+}
+
+
+
+/*
+ * Map the lease block, creating and initialising it if this is the first process on the node to
+ * use it. Creation is serialised with flock(), which is dropped if the creator dies.
+ * Returns the block, or NULL on failure.
+ */
+static lease_block_t *lease_open(phantom_context_t *ctx)
+{
+	lease_block_t *b = NULL;
+	struct stat st;
+	void *mem;
+	int fd;
+
+	pthread_mutex_lock(&ctx->lock);
+	if(ctx->lease_block != NULL)
+	{
+		pthread_mutex_unlock(&ctx->lock);
+		return ctx->lease_block;
+	}
+	if((fd = open(LEASE_BLOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+	{
+		pthread_mutex_unlock(&ctx->lock);
+		#ifdef DEBUG
+			perror("error: unable to open lease block");
+		#endif
+		return NULL;
+	}
+	if(flock(fd, LOCK_EX) || fstat(fd, &st) || (st.st_size < 0))
+		goto out;
+	if(((size_t) st.st_size < sizeof(lease_block_t)) && (ftruncate(fd, sizeof(lease_block_t)) || lease_set_access(fd)))
+		goto out;
+	if((mem = mmap(NULL, sizeof(lease_block_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		goto out;
+	b = mem;
+
+	if(b->magic != LEASE_MAGIC)
+	{
+		/* new block, or its creator died before finishing */
+		memset(b, 0, sizeof(lease_block_t));
+		lease_mutex_init(&b->lock);
+		for(int i = 0; i < LEASE_MAX_SLOTS; i++)
+			lease_mutex_init(&b->slot[i].lock);
+		b->version = LEASE_VERSION;
+		b->size = sizeof(lease_block_t);
+		__atomic_store_n(&b->magic, LEASE_MAGIC, __ATOMIC_RELEASE);
+	}
+	else if((b->version != LEASE_VERSION) || (b->size != sizeof(lease_block_t)))
+	{
+		#ifdef DEBUG
+			printf("error: lease block %s has an incompatible layout\n", LEASE_BLOCK_FILE);
+		#endif
+		munmap(mem, sizeof(lease_block_t));
+		b = NULL;
+	}
+	ctx->lease_block = b;
+
+out:
+	flock(fd, LOCK_UN);
+	close(fd);
+	pthread_mutex_unlock(&ctx->lock);
+	return b;
+}
+
+
+
+/*
+ * Find the IP's slot in the block, claiming a free one if the IP has never been leased.
+ * The slot index is cached in the context.
+ * Returns the slot, or NULL if the block is full.
+ */
+static lease_slot_t *lease_get_slot(phantom_context_t *ctx, lease_block_t *b, int idx, uint64_t key)
+{
+	int i, free_slot = -1;
+
+	if((i = __atomic_load_n(&ctx->lease_slot[idx], __ATOMIC_ACQUIRE)) >= 0)
+		return &b->slot[i];
+
+	if(lease_lock(&b->lock))
+		return NULL;
+	for(i = 0; i < LEASE_MAX_SLOTS; i++)
+	{
+		if(b->slot[i].key == key)
+			break;
+		if((b->slot[i].key == 0) && (free_slot < 0))
+			free_slot = i;
+	}
+	if((i == LEASE_MAX_SLOTS) && (free_slot >= 0))
+		b->slot[i = free_slot].key = key;
+	pthread_mutex_unlock(&b->lock);
+
+	if(i == LEASE_MAX_SLOTS)
+	{
+		#ifdef DEBUG
+			printf("error: lease block full\n");
+		#endif
+		return NULL;
+	}
+	__atomic_store_n(&ctx->lease_slot[idx], i, __ATOMIC_RELEASE);
+	return &b->slot[i];
+}
+
+
+
+/*
+ * Grant the lease if it is free. Called with the slot locked.
+ * Returns 1 if granted, 0 if not.
+ */
+static int lease_grant(lease_slot_t *s, const phantom_lease_t mode, pid_t pid)
+{
+	if(s->excl_pid != 0)
+		return 0;
+	if(mode == PHANTOM_LEASE_EXCLUSIVE)
+	{
+		if(s->num_shared != 0)
+			return 0;
+		s->excl_pid = pid;
+		return 1;
+	}
+	if(s->num_shared == LEASE_MAX_SHARED)
+		return 0;
+	s->shared_pid[s->num_shared] = pid;
+	s->num_shared++;
+	return 1;
+}
+
+
+
+static int pid_alive(pid_t pid)
+{
+	return (kill(pid, 0) == 0) || (errno != ESRCH);
+}
+
+
+
+/*
+ * Drop the leases of processes that have exited. Called with the slot locked.
+ * Returns 1 if any lease was dropped, 0 if not.
+ */
+static int lease_prune(lease_slot_t *s)
+{
+	int pruned = 0;
+
+	if((s->excl_pid != 0) && !pid_alive(s->excl_pid))
+	{
+		s->excl_pid = 0;
+		pruned = 1;
+	}
+	for(uint32_t i = 0; i < s->num_shared; )
+	{
+		if(pid_alive(s->shared_pid[i]))
+		{
+			i++;
+			continue;
+		}
+		/* copy before shrinking, so a crash in between leaves a duplicate rather than a lost lease */
+		s->shared_pid[i] = s->shared_pid[s->num_shared - 1];
+		s->num_shared--;
+		pruned = 1;
+	}
+	return pruned;
+}
+
+
+
+static int lease_get_idx(phantom_ip_t* ip)
+{
+	ptrdiff_t idx;
+
+	if((ip == NULL) || (ip->ctx == NULL))
+		return -1;
+	idx = ip - ip->ctx->conf.comp;
+	if((idx < 0) || (idx >= ip->ctx->num_ip_state))
+		return -1;
+	return (int) idx;
+}
+
+
+
+/*
+ * Takes a node wide lease on the specified IP, shared with every process on the board that maps
+ * the same core. An exclusive lease is granted while no other lease is held on the IP, a shared
+ * lease while no exclusive lease is held. Leases of processes that exit or crash are reclaimed.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    mode (phantom_lease_t) – PHANTOM_LEASE_EXCLUSIVE or PHANTOM_LEASE_SHARED.
+ *    timeout_ms (int) – The maximum time to wait in milliseconds, 0 to try once, or a negative value to wait forever.
+ * Returns PHANTOM_OK if the lease was granted, PHANTOM_FALSE on timeout, or PHANTOM_ERROR on error
+ * or if the IP is already leased through its context.
+ *
+ */
+int phantom_fpga_ip_lease(phantom_ip_t* ip, const phantom_lease_t mode, const int timeout_ms)
+{
+	int idx = lease_get_idx(ip);
+	pid_t pid = getpid();
+	struct timespec now, deadline, slice;
+	lease_block_t *b;
+	lease_slot_t *s;
+	int granted, waiting = 0;
+	int64_t left_ns = 0;
+	uint32_t seq = 0;
+
+	if((idx < 0) || ((mode != PHANTOM_LEASE_SHARED) && (mode != PHANTOM_LEASE_EXCLUSIVE)))
+		return PHANTOM_ERROR;
+	if(ip->ctx->lease_held[idx] != 0)
+		return PHANTOM_ERROR;
+	if((b = lease_open(ip->ctx)) == NULL)
+		return PHANTOM_ERROR;
+	if((s = lease_get_slot(ip->ctx, b, idx, ip->s0_axi_base_address)) == NULL)
+		return PHANTOM_ERROR;
+
+	if(timeout_ms > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	for(;;)
+	{
+		if(timeout_ms > 0)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			left_ns = (deadline.tv_sec - now.tv_sec) * 1000000000LL + (deadline.tv_nsec - now.tv_nsec);
+		}
+		if(lease_lock(&s->lock))
+			return PHANTOM_ERROR;
+		if(waiting)
+			s->waiters--;
+		/* only look for dead holders when blocked, so the uncontended path makes no system calls */
+		granted = lease_grant(s, mode, pid) || (lease_prune(s) && lease_grant(s, mode, pid));
+		waiting = !granted && ((timeout_ms < 0) || (left_ns > 0));
+		if(waiting)
+		{
+			seq = s->seq;
+			s->waiters++;
+		}
+		pthread_mutex_unlock(&s->lock);
+
+		if(granted)
+			break;
+		if(!waiting)
+			return PHANTOM_FALSE;
+
+		slice.tv_sec = 0;
+		slice.tv_nsec = LEASE_PRUNE_MS * 1000000L;
+		if((timeout_ms >= 0) && (left_ns < slice.tv_nsec))
+			slice.tv_nsec = left_ns;
+		lease_futex_wait(&s->seq, seq, &slice);
+	}
+
+	ip->ctx->lease_held[idx] = mode;
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Releases the lease held on the specified IP and wakes any process waiting for it.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR if no lease is held on the IP through its context.
+ *
+ */
+int phantom_fpga_ip_release(phantom_ip_t* ip)
+{
+	int idx = lease_get_idx(ip);
+	pid_t pid = getpid();
+	lease_slot_t *s;
+	uint32_t waiters;
+
+	if((idx < 0) || (ip->ctx->lease_held[idx] == 0))
+		return PHANTOM_ERROR;
+	s = &((lease_block_t *) ip->ctx->lease_block)->slot[ip->ctx->lease_slot[idx]];
+
+	if(lease_lock(&s->lock))
+		return PHANTOM_ERROR;
+	if(ip->ctx->lease_held[idx] == PHANTOM_LEASE_EXCLUSIVE)
+	{
+		if(s->excl_pid == pid)
+			s->excl_pid = 0;
+	}
+	else
+	{
+		for(uint32_t i = 0; i < s->num_shared; i++)
+		{
+			if(s->shared_pid[i] != pid)
+				continue;
+			s->shared_pid[i] = s->shared_pid[s->num_shared - 1];
+			s->num_shared--;
+			break;
+		}
+	}
+	s->seq++;
+	waiters = s->waiters;
+	pthread_mutex_unlock(&s->lock);
+
+	if(waiters)
+		lease_futex_wake(&s->seq);
+	ip->ctx->lease_held[idx] = 0;
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Release every lease held through a context and unmap the lease block.
+ */
+void lease_close(phantom_context_t *ctx)
+{
+	if(ctx->lease_block == NULL)
+		return;
+	for(uint32_t i = 0; i < ctx->num_ip_state; i++)
+		if(ctx->lease_held[i] != 0)
+			phantom_fpga_ip_release(&ctx->conf.comp[i]);
+	munmap(ctx->lease_block, sizeof(lease_block_t));
+	ctx->lease_block = NULL;
+	for(uint32_t i = 0; i < ctx->num_ip_state; i++)
+		ctx->lease_slot[i] = -1;
+}
@@ -27,6 +27,7 @@
 
 #include "phantom_api.h"
 #include "phantom_api_lowlevel.h"
+#include "phantom_api_private.h"
 #include "phantom_xml_parser.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,210 +37,594 @@
 #include <fcntl.h>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/sendfile.h>
 
 
 
 
-typedef struct {
-	int fd;
-	uint8_t flags;
-} uio_struct_t;
+/* Private Functions prototype */
+void *get_mapped_vmem_base(phantom_context_t *, phantom_address_t, uint32_t, int *);
+unsigned int get_memory_size(char *);
+char* get_nodestr(const char *, char *);
+int check_for_node_str(const char*, const char*);
+int check_valid_addr_and_size(phantom_address_t, uint32_t);
+int check_valid_mem_addr_and_size(phantom_address_t, uint32_t);
 
 
 
-/* struct to hold all uio device file descriptors */
-static uio_struct_t uio[NUM_OF_UIO_DEVS];
 
+static inline uint32_t uio_index_hash(phantom_context_t *ctx, phantom_address_t addr)
+{
+	return ((uint32_t)(addr >> 12) * 0x9e3779b1U) >> (32 - ctx->uio_index_bits); // slaves are at least 4 KiB aligned
+}
 
 
-/* Private Functions prototype */
-int get_mapped_vmem_base(uint32_t **, phantom_address_t, uint32_t);
-unsigned int get_memory_size(char *);
-char* get_nodestr(const char *);
-int check_for_node_str(const char*, const char*);
-int check_valid_addr_and_size(phantom_address_t, uint32_t);
 
+static void uio_index_insert(phantom_context_t *ctx, int entry)
+{
+	uint32_t mask = (1U << ctx->uio_index_bits) - 1;
+	uint32_t h;
+
+	for(h = uio_index_hash(ctx, ctx->uio[entry].addr); ctx->uio_index[h]; h = (h + 1) & mask)
+		;
+	ctx->uio_index[h] = entry + 1;
+}
+
+
+
+/*
+ * Make room for one more uio node, doubling the node table and its index when full.
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int uio_index_grow(phantom_context_t *ctx)
+{
+	int max_uio = ctx->max_uio ? 2 * ctx->max_uio : NUM_OF_UIO_DEVS;
+	int bits = ctx->uio_index_bits ? ctx->uio_index_bits + 1 : UIO_INDEX_BITS;
+	uio_struct_t *uio;
+	uint32_t *index;
+
+	if(ctx->num_uio < ctx->max_uio)
+		return 0;
+	if((uio = realloc(ctx->uio, max_uio * sizeof(uio_struct_t))) == NULL)
+		return -1;
+	ctx->uio = uio;
+	if((index = calloc(1U << bits, sizeof(uint32_t))) == NULL)
+		return -1;
+	free(ctx->uio_index);
+	ctx->uio_index = index;
+	ctx->uio_index_bits = bits;
+	ctx->max_uio = max_uio;
+	for(int i = 0; i < ctx->num_uio; i++)
+		uio_index_insert(ctx, i);
+	return 0;
+}
+
+
+
+static int uio_index_has(phantom_context_t *ctx, int num)
+{
+	for(int i = 0; i < ctx->num_uio; i++)
+		if(ctx->uio[i].num == num)
+			return 1;
+	return 0;
+}
 
 
 
 /*
- * Function to open all phantom uio nodes, ready for mapping. If unsuccessful, it
- * will try to automatically load phantom module (assumes not loaded) and repeat
- * attempt for uioxx access.
+ * Index the uio nodes of a context by their map0 address, in one pass over sysfs. Gaps in the
+ * uio numbering are skipped. Nodes already indexed are kept, so the index can be topped up while
+ * some are mapped. The nodes are not opened until they are mapped.
+ * Returns the number of nodes indexed.
  */
-int open_devs()
+static int uio_index_build(phantom_context_t *ctx)
 {
 	char bufstr[LINE_LEN];
-	extern uio_struct_t uio[];
-	int err = 0;
+	char valstr[LINE_LEN];
+	struct dirent *entry;
+	uio_struct_t *node;
+	DIR *dir;
+	ssize_t len;
+	int fd;
 
-	for(uint8_t i=0; i < NUM_OF_UIO_DEVS; i++)
+	if((dir = opendir(SYSCLASS_LOC)) == NULL)
+		return ctx->num_uio;
+	while((entry = readdir(dir)) != NULL)
 	{
-		if(~(uio[i].flags & UIO_DEV_OPENED))
+		if(strncmp(entry->d_name, "uio", 3) || (entry->d_name[3] < '0') || (entry->d_name[3] > '9'))
+			continue;
+		if(uio_index_has(ctx, atoi(entry->d_name + 3)))
+			continue; // indexed by an earlier scan, and possibly open
+		if(uio_index_grow(ctx))
 		{
-			sprintf(bufstr, "%s%d", UIO_DEVS_LOC, i);
-			uio[i].fd  = open(bufstr, O_RDWR);
-			if (uio[i].fd < 0)
-				err = -1;
-			else
-				uio[i].flags = UIO_DEV_OPENED;
+			#ifdef DEBUG
+				printf("error: out of memory, ignoring %s\n", entry->d_name);
+			#endif
+			continue;
 		}
+		node = &ctx->uio[ctx->num_uio];
+		node->num = atoi(entry->d_name + 3);
+		snprintf(bufstr, LINE_LEN, "%suio%d%s", SYSCLASS_LOC, node->num, MAP_ADDR_FILE);
+		if((fd = open(bufstr, O_RDONLY)) < 0)
+			continue; // node has no mappings
+		len = read(fd, valstr, LINE_LEN - 1);
+		close(fd);
+		if(len <= 0)
+			continue;
+		valstr[len] = '\0';
+		node->addr = (phantom_address_t) strtoull(valstr, NULL, 16); // map addresses are above 4 GiB on the MPSoC
+		node->fd = -1;
+		node->flags = 0;
+
+		uio_index_insert(ctx, ctx->num_uio++);
 	}
-	if(!err)
+	closedir(dir);
+	return ctx->num_uio;
+}
+
+
+
+/*
+ * Index a uio node opened elsewhere, e.g. passed by phantomd, so it is mapped through fd rather
+ * than by opening /dev/uioN.
+ * Returns 0 on success, -1 if out of memory.
+ */
+int uio_add_opened(phantom_context_t *ctx, int num, phantom_address_t addr, int fd)
+{
+	uio_struct_t *node;
+
+	if(uio_index_grow(ctx))
+		return -1;
+	node = &ctx->uio[ctx->num_uio];
+	node->num = num;
+	node->addr = addr;
+	node->fd = fd;
+	node->flags = UIO_DEV_OPENED;
+	uio_index_insert(ctx, ctx->num_uio++);
+	return 0;
+}
+
+
+
+/*
+ * Returns the indexed uio node whose map0 is at addr, or NULL if there is none.
+ */
+static uio_struct_t *uio_index_find(phantom_context_t *ctx, phantom_address_t addr)
+{
+	uint32_t mask = (1U << ctx->uio_index_bits) - 1;
+
+	if(ctx->uio_index == NULL)
+		return NULL;
+	for(uint32_t h = uio_index_hash(ctx, addr); ctx->uio_index[h]; h = (h + 1) & mask)
+		if(ctx->uio[ctx->uio_index[h] - 1].addr == addr)
+			return &ctx->uio[ctx->uio_index[h] - 1];
+	return NULL;
+}
+
+
+
+/*
+ * Returns 1 if the uio node at addr is indexed and open, or its device node can be opened, else 0.
+ */
+static int uio_node_ready(phantom_context_t *ctx, phantom_address_t addr)
+{
+	char bufstr[LINE_LEN];
+	uio_struct_t *node;
+
+	if((node = uio_index_find(ctx, addr)) == NULL)
 		return 0;
+	if(node->flags & UIO_DEV_OPENED)
+		return 1;
+	sprintf(bufstr, "%s%d", UIO_DEVS_LOC, node->num);
+	return access(bufstr, R_OK | W_OK) == 0; // udev may not have set its permissions yet
+}
+
+
+
+/*
+ * Returns 1 if the uio nodes of every slave and master memory of the IP are ready, else 0.
+ * If ip is NULL, all the context's IPs are checked.
+ */
+static int uio_nodes_ready(phantom_context_t *ctx, phantom_ip_t *ip)
+{
+	uint32_t num_comps = 1;
+
+	if(ip == NULL)
+	{
+		ip = get_phantom_component_array(&ctx->conf);
+		num_comps = get_phantom_component_count(&ctx->conf);
+	}
+	for(uint32_t i = 0; i < num_comps; i++, ip++)
+	{
+		if((ip->s0_axi_base_address != 0) && !uio_node_ready(ctx, ip->s0_axi_base_address))
+			return 0;
+		if((ip->s1_axi_base_address != 0) && !uio_node_ready(ctx, ip->s1_axi_base_address))
+			return 0;
+		if((ip->num_axi_masters > 0) && (ip->m0_axi_base_address != 0) && !uio_node_ready(ctx, ip->m0_axi_base_address))
+			return 0;
+	}
+	return 1;
+}
+
+
+
+/*
+ * Load a kernel module and the modules it depends on, as listed in modules.dep, with finit_module().
+ * Modules already loaded or built in are skipped.
+ * Returns 0 on success, -1 on fail.
+ */
+static int load_module(const char *name, const char *params)
+{
+	char dir[LINE_LEN];
+	char path[PATH_MAX];
+	char *line = NULL, *mods[MODULE_MAX_DEPS + 1], *base, *tok, *save;
+	size_t line_len = 0, name_len = strlen(name);
+	struct utsname uts;
+	int num_mods = 0, fd, err = 0;
+	FILE *fp;
+
+	if(uname(&uts))
+		return -1;
+	snprintf(dir, LINE_LEN, "%s%s", MODULES_LOC, uts.release);
+	snprintf(path, PATH_MAX, "%s%s", dir, MODULES_DEP_FILE);
+	if((fp = fopen(path, "r")) == NULL)
+		return -1;
+
+	/* find "path/name.ko[.xz]: dep1 dep2 ..." */
+	while(getline(&line, &line_len, fp) > 0)
+	{
+		if((tok = strchr(line, ':')) == NULL)
+			continue;
+		*tok = '\0';
+		base = strrchr(line, '/') ? strrchr(line, '/') + 1 : line;
+		if(strncmp(base, name, name_len) || strncmp(base + name_len, ".ko", 3))
+			continue;
+		mods[num_mods++] = line;
+		for(tok = strtok_r(tok + 1, " \t\n", &save); tok && (num_mods <= MODULE_MAX_DEPS); tok = strtok_r(NULL, " \t\n", &save))
+			mods[num_mods++] = tok;
+		break;
+	}
+	fclose(fp);
+	if(num_mods == 0)
+	{
+		#ifdef DEBUG
+			printf("error: module %s not found in %s%s\n", name, dir, MODULES_DEP_FILE);
+		#endif
+		free(line);
+		return -1; // built in, or not installed
+	}
 
-	/* have error so try loading phantom module */
-	#ifdef DEBUG
-		printf("uio devs not open so loading module manually...\n");
-	#endif
-	close_devs();
-	sprintf(bufstr, "modprobe %s\n", PHANTOM_MODULE);
-	system(bufstr);
-	sleep(1); // wait enough time to ensure kernel has loaded all uio modules
-
-	/* repeat attempt to open uio nodes */
-	err = 0;
-	for(uint8_t i=0; i < NUM_OF_UIO_DEVS; i++)
-	{
-		sprintf(bufstr, "%s%d", UIO_DEVS_LOC, i);
-		uio[i].fd  = open(bufstr, O_RDWR);
-		if (uio[i].fd < 0)
+	/* dependencies are listed with the last to be loaded first */
+	for(int i = num_mods - 1; (i >= 0) && !err; i--)
+	{
+		snprintf(path, PATH_MAX, "%s/%s", dir, mods[i]);
+		if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		{
+			err = -1;
+			break;
+		}
+		if(syscall(SYS_finit_module, fd, i ? "" : params, strstr(mods[i], ".ko.") ? MODULE_INIT_COMPRESSED_FILE : 0) && (errno != EEXIST))
 		{
 			#ifdef DEBUG
-			printf("failed to open %s\n",bufstr);
+				printf("error: unable to load %s\n", path);
+				perror("error");
 			#endif
 			err = -1;
 		}
-		else
-			uio[i].flags = UIO_DEV_OPENED;
+		close(fd);
 	}
+	free(line);
 	return err;
 }
 
 
 
 /*
- * close all opened uio nodes
+ * Wait for the uio nodes of the IP, or of all the context's IPs if ip is NULL, to appear, or for
+ * the context's dev_timeout_ms. Their device nodes are watched for with inotify, as sysfs raises
+ * no inotify events.
+ * Returns 0 once they are ready, -1 on timeout.
  */
-void close_devs(void)
+static int wait_devs(phantom_context_t *ctx, phantom_ip_t *ip)
 {
-	for(uint8_t i=0; i < NUM_OF_UIO_DEVS; i++)
+	char events[UIO_EVENT_BUF_LEN] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd = {.events = POLLIN};
+	struct timespec t0, now;
+	int elapsed_ms, wait_ms;
+
+	if(((pfd.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0) && (inotify_add_watch(pfd.fd, UIO_DEVS_DIR, IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0))
 	{
-		if(uio[i].flags & UIO_DEV_OPENED)
+		close(pfd.fd);
+		pfd.fd = -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(;;)
+	{
+		/* the watch is in place before each scan, so a node appearing in between is not missed */
+		uio_index_build(ctx);
+		if(uio_nodes_ready(ctx, ip))
+			break;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed_ms = (now.tv_sec - t0.tv_sec) * 1000 + (now.tv_nsec - t0.tv_nsec) / 1000000;
+		if((ctx->dev_timeout_ms >= 0) && (elapsed_ms >= ctx->dev_timeout_ms))
 		{
-			close(uio[i].fd);
-			uio[i].flags = 0; // clear all flags
+			if(pfd.fd >= 0)
+				close(pfd.fd);
+			#ifdef DEBUG
+				printf("error: uio nodes not ready after %d ms\n", elapsed_ms);
+			#endif
+			return -1;
 		}
+		wait_ms = (ctx->dev_timeout_ms < 0) ? -1 : ctx->dev_timeout_ms - elapsed_ms;
+		if(pfd.fd < 0)
+			wait_ms = ((wait_ms < 0) || (wait_ms > UIO_POLL_MS)) ? UIO_POLL_MS : wait_ms; // no inotify, poll instead
+		if(poll((pfd.fd >= 0) ? &pfd : NULL, (pfd.fd >= 0) ? 1 : 0, wait_ms) > 0)
+			while(read(pfd.fd, events, sizeof(events)) > 0)
+				;
 	}
+	if(pfd.fd >= 0)
+		close(pfd.fd);
+	return 0;
 }
 
 
 
 /*
- * Un-map all memory mapped uio devices.
+ * Function to index all phantom uio nodes of a context, ready for mapping. If no uio node exists
+ * at all the phantom module is loaded. Then, in eager mode, the nodes of all the context's IPs are
+ * waited for; in lazy mode each IP's nodes are waited for when it is mapped, see open_ip_devs().
+ * Returns 0 on success, -1 on fail.
  */
-void unmap_devs(void)
+int open_devs(phantom_context_t *ctx)
 {
-	phantom_ip_t *ph_ipcores_ptr = get_phantom_component_array();
-	uint8_t num_comps = get_phantom_component_count();
-	for(int i=0; i < num_comps; i++)
+	close_devs(ctx);
+	uio_index_build(ctx);
+	if(ctx->num_uio == 0)
 	{
-		if(ph_ipcores_ptr->s0_vmem_base != NULL) {
-			if(munmap((void*) ph_ipcores_ptr->s0_vmem_base, ph_ipcores_ptr->s0_axi_address_size)) {
-				#ifdef DEBUG
-					printf("error: unable to unmap vm region\n");
-				#endif
-			}
-			ph_ipcores_ptr->s0_vmem_base = NULL;
-		}
-		if(ph_ipcores_ptr->s1_vmem_base != NULL) {
-			if(munmap((void*) ph_ipcores_ptr->s0_vmem_base, ph_ipcores_ptr->s1_axi_address_size)) {
-				#ifdef DEBUG
-					printf("error: unable to unmap vm region\n");
-				#endif
-			}
-			ph_ipcores_ptr->s1_vmem_base = NULL;
-		}
+		#ifdef DEBUG
+			printf("uio devs not found so loading module manually...\n");
+		#endif
+		load_module(PHANTOM_MODULE, PHANTOM_MODULE_PARAMS);
+	}
+	if((ctx->map_mode == PHANTOM_MAP_LAZY) || uio_nodes_ready(ctx, NULL))
+		return 0;
+	return wait_devs(ctx, NULL);
+}
+
+
+
+/*
+ * Wait for the uio nodes of one IP of a context to be ready, ahead of mapping it in lazy mode.
+ * Returns 0 on success, -1 on timeout.
+ */
+int open_ip_devs(phantom_context_t *ctx, phantom_ip_t *ip)
+{
+	if(uio_nodes_ready(ctx, ip))
+		return 0;
+	return wait_devs(ctx, ip);
+}
 
 
-		ph_ipcores_ptr++;
+
+/*
+ * close all opened uio nodes of a context
+ */
+void close_devs(phantom_context_t *ctx)
+{
+	uio_struct_t *uio = ctx->uio;
+
+	for(int i=0; i < ctx->num_uio; i++)
+	{
+		if(uio[i].flags & UIO_DEV_OPENED)
+			close(uio[i].fd);
+		uio[i].fd = -1;
+		uio[i].flags = 0; // clear all flags
+	}
+	ctx->num_uio = 0;
+	if(ctx->uio_index != NULL)
+		memset(ctx->uio_index, 0, (1U << ctx->uio_index_bits) * sizeof(uint32_t));
+}
+
+
+
+/*
+ * Free the uio node table of a context, once its nodes are closed.
+ */
+void free_devs(phantom_context_t *ctx)
+{
+	free(ctx->uio);
+	free(ctx->uio_index);
+	ctx->uio = NULL;
+	ctx->uio_index = NULL;
+	ctx->num_uio = ctx->max_uio = 0;
+	ctx->uio_index_bits = 0;
+}
+
+
+
+/*
+ * Un-map one region mapped by get_mapped_vmem_base() and release its uio node, so the node can be
+ * mapped again.
+ */
+static void put_mapped_vmem_base(phantom_context_t *ctx, phantom_address_t axi_base_addr, void *vmem_base, uint32_t axi_addr_size)
+{
+	uio_struct_t *node;
+
+	if(munmap(vmem_base, axi_addr_size)) {
+		#ifdef DEBUG
+			printf("error: unable to unmap vm region\n");
+		#endif
+	}
+	if((node = uio_index_find(ctx, axi_base_addr)) != NULL)
+		node->flags &= ~UIO_DEV_MAPPED;
+}
+
+
+
+/*
+ * Un-map the memory mapped uio devices of one core, including a partial mapping left by a failed
+ * map_component().
+ */
+static void unmap_component(phantom_context_t *ctx, phantom_ip_t *ph_ipcore_ptr)
+{
+	ph_ipcore_ptr->mapped = 0;
+	if(ph_ipcore_ptr->s0_vmem_base != NULL) {
+		put_mapped_vmem_base(ctx, ph_ipcore_ptr->s0_axi_base_address, ph_ipcore_ptr->s0_vmem_base, ph_ipcore_ptr->s0_axi_address_size);
+		ph_ipcore_ptr->s0_vmem_base = NULL;
+	}
+	ph_ipcore_ptr->s0_uio_fd = -1;
+	if(ph_ipcore_ptr->s1_vmem_base != NULL) {
+		put_mapped_vmem_base(ctx, ph_ipcore_ptr->s1_axi_base_address, ph_ipcore_ptr->s1_vmem_base, ph_ipcore_ptr->s1_axi_address_size);
+		ph_ipcore_ptr->s1_vmem_base = NULL;
 	}
+	if(ph_ipcore_ptr->mem_pool != NULL) {
+		mem_pool_destroy(ph_ipcore_ptr->mem_pool);
+		ph_ipcore_ptr->mem_pool = NULL;
+	}
+	if(ph_ipcore_ptr->m0_vmem_base != NULL) {
+		put_mapped_vmem_base(ctx, ph_ipcore_ptr->m0_axi_base_address, ph_ipcore_ptr->m0_vmem_base, ph_ipcore_ptr->m0_axi_address_size);
+		ph_ipcore_ptr->m0_vmem_base = NULL;
+	}
+	ph_ipcore_ptr->m0_cache = 0;
+}
+
+
+
+/*
+ * Un-map all memory mapped uio devices of a context.
+ */
+void unmap_devs(phantom_context_t *ctx)
+{
+	phantom_ip_t *ph_ipcores_ptr = get_phantom_component_array(&ctx->conf);
+	uint32_t num_comps = get_phantom_component_count(&ctx->conf);
+	for(uint32_t i=0; i < num_comps; i++)
+		unmap_component(ctx, ph_ipcores_ptr++);
 }
 
 
 
-/* Search opened uioxx node for address base and size match and map in to virtual memory.
- * Returns matched uio fd.
+/* Look up the uio node whose map0 is at the address base in the context's index, open it and map
+ * it in to virtual memory.
+ * Returns mapped virtual address, or NULL on failure. If uio_fd is not NULL it is set to the
+ * uioxx file descriptor, which is also used for the node's interrupt.
  * Note: each uio node can only be mapped once.
- * Note: zynq ultrascale PS is 32-bit only so need to workout scheme for 64-bit PL address space mapping. TBD.
  */
-int get_mapped_vmem_base(uint32_t **mmem, phantom_address_t axi_base_addr, uint32_t axi_addr_size)
+void *get_mapped_vmem_base(phantom_context_t *ctx, phantom_address_t axi_base_addr, uint32_t axi_addr_size, int *uio_fd)
 {
 	char bufstr[LINE_LEN];
-	char valstr[LINE_LEN];
-	phantom_address_t tmp;
-	extern uio_struct_t uio[];
+	uio_struct_t *node;
+	void *mmem;
 
-	/* search for base address match in uio pool and if found map */
-	for(int i=0; i < NUM_OF_UIO_DEVS; i++)
+	if((node = uio_index_find(ctx, axi_base_addr)) == NULL)
 	{
-		sprintf(bufstr,"%suio%d%s", SYSCLASS_LOC, i, MAP_ADDR_FILE); // get map0/addr value for opened uioxx
-		if(get_file_str(bufstr, valstr))
+		#ifdef DEBUG
+			printf("error: no uio node at 0x%08" PRIx64 "\n", (uint64_t) axi_base_addr);
+		#endif
+		return NULL;
+	}
+	if(node->flags & UIO_DEV_MAPPED)
+	{
+		#ifdef DEBUG
+			printf("error: unable to map uio%d - it's already mapped!\n", node->num);
+		#endif
+		return NULL;
+	}
+	if(!(node->flags & UIO_DEV_OPENED))
+	{
+		sprintf(bufstr, "%s%d", UIO_DEVS_LOC, node->num);
+		if((node->fd = open(bufstr, O_RDWR)) < 0)
 		{
 			#ifdef DEBUG
-				printf("failed to open %s\n",bufstr);
+				printf("failed to open %s\n", bufstr);
 			#endif
-			return -1;
-		}
-		sscanf(valstr,"%x", &tmp);
-		if(tmp == axi_base_addr)
-		{
-			if(uio[i].flags & UIO_DEV_MAPPED)
-			{
-				#ifdef DEBUG
-					printf("error: unable to map uio[%d] - it's already mapped!\n",i);
-				#endif
-				return -1;
-			}
-		    if((*mmem = mmap(NULL, axi_addr_size, PROT_READ | PROT_WRITE, MAP_SHARED, uio[i].fd, 0)) == MAP_FAILED)
-		    {
-				#ifdef DEBUG
-					printf("error: failed to map uio%d\n", i);
-					perror("error:");
-				#endif
-				*mmem = NULL;
-		    	return -1;
-		    }
-			uio[i].flags |= UIO_DEV_MAPPED;
-		    return 0;
+			return NULL;
 		}
+		node->flags = UIO_DEV_OPENED;
 	}
-	return -1; // failed
+	if((mmem = mmap(NULL, axi_addr_size, PROT_READ | PROT_WRITE, MAP_SHARED, node->fd, 0)) == MAP_FAILED)
+	{
+		#ifdef DEBUG
+			printf("error: failed to map uio%d\n", node->num);
+			perror("error:");
+		#endif
+		return NULL;
+	}
+	node->flags |= UIO_DEV_MAPPED;
+	if(uio_fd != NULL)
+		*uio_fd = node->fd;
+	return mmem;
 }
 
 
 
 int check_valid_addr_and_size(phantom_address_t base_addr, uint32_t addr_size)
 {
-
-	if((base_addr < AXI_GP0_BASEADDR) || (base_addr >= MAX_AXI_GP1_BASEADDR))
+	/* each window is given by its lowest and highest permitted base address */
+	static const phantom_address_t axi_windows[][2] = {
+#if TARGET_FPGA == 0
+		{AXI_GP0_BASEADDR, MAX_AXI_GP0_BASEADDR},
+		{AXI_GP1_BASEADDR, MAX_AXI_GP1_BASEADDR},
+#else
+		{AXI_LPD_BASEADDR, MAX_AXI_LPD_BASEADDR},
+		{AXI_HPM0_BASEADDR, MAX_AXI_HPM0_BASEADDR},
+		{AXI_HPM1_BASEADDR, MAX_AXI_HPM1_BASEADDR},
+		{AXI_HPM0_HIGH_BASEADDR, MAX_AXI_HPM0_HIGH_BASEADDR},
+		{AXI_HPM1_HIGH_BASEADDR, MAX_AXI_HPM1_HIGH_BASEADDR},
+#endif
+	};
+	unsigned int i;
+
+	for(i = 0; i < sizeof(axi_windows) / sizeof(axi_windows[0]); i++)
+		if((base_addr >= axi_windows[i][0]) && (base_addr <= axi_windows[i][1]))
+			break;
+	if(i == sizeof(axi_windows) / sizeof(axi_windows[0]))
 	{
 		#ifdef DEBUG
-			printf("error: invalid axi bus slave address 0x%08x\n",base_addr);
+			printf("error: invalid axi bus slave address 0x%08" PRIx64 "\n", (uint64_t) base_addr);
 		#endif
 		return -1;
 	}
-	if((base_addr > MAX_AXI_GP0_BASEADDR) && (base_addr < AXI_GP1_BASEADDR))
+	if (addr_size > AXI_GP_ADDR_RANGE)
 	{
 		#ifdef DEBUG
-			printf("error: invalid axi bus slave address 0x%08x\n",base_addr);
+			printf("error: axi bus slave address range too high @ 0x%08x\n",addr_size);
 		#endif
 		return -1;
 	}
-	if (addr_size > AXI_GP_ADDR_RANGE)
+	return 0;
+}
+
+
+
+/*
+ * Reserved memory shared with an IP's AXI masters must lie in PS DDR, i.e. below the AXI slave
+ * windows or, on the MPSoC, in the high DDR region above 32 GiB.
+ */
+int check_valid_mem_addr_and_size(phantom_address_t base_addr, uint32_t addr_size)
+{
+	int valid = (addr_size != 0) && (base_addr < PS_DDR_ADDR_RANGE) && (addr_size <= PS_DDR_ADDR_RANGE - base_addr);
+
+#if TARGET_FPGA != 0
+	if((addr_size != 0) && (base_addr >= PS_DDR_HIGH_BASEADDR) && (base_addr - PS_DDR_HIGH_BASEADDR < PS_DDR_HIGH_ADDR_RANGE) &&
+			(addr_size <= PS_DDR_HIGH_ADDR_RANGE - (base_addr - PS_DDR_HIGH_BASEADDR)))
+		valid = 1;
+#endif
+	if(!valid)
 	{
 		#ifdef DEBUG
-			printf("error: axi bus slave address range too high @ 0x%08x\n",addr_size);
+			printf("error: invalid axi master memory 0x%08" PRIx64 " size 0x%08x\n", (uint64_t) base_addr, addr_size);
 		#endif
 		return -1;
 	}
@@ -249,29 +634,591 @@ int check_valid_addr_and_size(phantom_address_t base_addr, uint32_t addr_size)
 
 
 /*
- * Function maps given phantom core in to user space memory.
+ * Function maps given phantom core in to user space memory, using the uio nodes opened by its context.
+ * This covers the s0/s1 slave register spaces and, for cores with AXI masters, the reserved memory
+ * they share with the CPU.
  */
-int map_component(phantom_ip_t *ph_ipcore_ptr)
+int map_component(phantom_context_t *ctx, phantom_ip_t *ph_ipcore_ptr)
 {
-	extern uio_struct_t uio[];
-
+	ph_ipcore_ptr->mapped = 0;
 	ph_ipcore_ptr->s0_vmem_base = NULL;
 	ph_ipcore_ptr->s1_vmem_base = NULL;
+	ph_ipcore_ptr->m0_vmem_base = NULL;
+	ph_ipcore_ptr->mem_pool = NULL;
+	ph_ipcore_ptr->s0_uio_fd = -1;
+	ph_ipcore_ptr->m0_cache = 0;
 
 	if(ph_ipcore_ptr->s0_axi_base_address != 0) // a zero address indicates unused so ignore
 	{
 		if(check_valid_addr_and_size(ph_ipcore_ptr->s0_axi_base_address, ph_ipcore_ptr->s0_axi_address_size))
-			return -1;
-		if(get_mapped_vmem_base(&ph_ipcore_ptr->s0_vmem_base, ph_ipcore_ptr->s0_axi_base_address, ph_ipcore_ptr->s0_axi_address_size))
-			return -1;
+			goto fail;
+		if((ph_ipcore_ptr->s0_vmem_base = get_mapped_vmem_base(ctx, ph_ipcore_ptr->s0_axi_base_address, ph_ipcore_ptr->s0_axi_address_size, &ph_ipcore_ptr->s0_uio_fd)) == NULL)
+			goto fail;
 	}
 	if(ph_ipcore_ptr->s1_axi_base_address != 0) // a zero address indicates unused so ignore
 	{
 		if(check_valid_addr_and_size(ph_ipcore_ptr->s1_axi_base_address, ph_ipcore_ptr->s1_axi_address_size))
-			return -1;
-		if(get_mapped_vmem_base(&ph_ipcore_ptr->s1_vmem_base, ph_ipcore_ptr->s1_axi_base_address, ph_ipcore_ptr->s1_axi_address_size))
-			return -1;
+			goto fail;
+		if((ph_ipcore_ptr->s1_vmem_base = get_mapped_vmem_base(ctx, ph_ipcore_ptr->s1_axi_base_address, ph_ipcore_ptr->s1_axi_address_size, NULL)) == NULL)
+			goto fail;
+	}
+	if((ph_ipcore_ptr->num_axi_masters > 0) && (ph_ipcore_ptr->m0_axi_base_address != 0)) // a zero address indicates no reserved memory
+	{
+		if(check_valid_mem_addr_and_size(ph_ipcore_ptr->m0_axi_base_address, ph_ipcore_ptr->m0_axi_address_size))
+			goto fail;
+		if((ph_ipcore_ptr->m0_vmem_base = get_mapped_vmem_base(ctx, ph_ipcore_ptr->m0_axi_base_address, ph_ipcore_ptr->m0_axi_address_size, NULL)) == NULL)
+			goto fail;
+		if((ph_ipcore_ptr->mem_pool = mem_pool_create(ph_ipcore_ptr->m0_vmem_base, ph_ipcore_ptr->m0_axi_base_address, ph_ipcore_ptr->m0_axi_address_size)) == NULL)
+			goto fail;
 	}
+	__atomic_store_n(&ph_ipcore_ptr->mapped, 1, __ATOMIC_RELEASE);
+	return 0;
+
+fail:
+	unmap_component(ctx, ph_ipcore_ptr); // so a later attempt starts from nothing
+	return -1;
+}
+
+
+
+/*
+ * (Re-)enable the interrupt of an opened uioxx node. uio_pdrv_genirq masks the interrupt line
+ * each time it fires, so this must be called after every interrupt taken.
+ * Returns 0 on success, -1 if the node has no interrupt.
+ */
+int uio_irq_enable(int uio_fd)
+{
+	uint32_t enable = 1;
+
+	if(write(uio_fd, &enable, sizeof(enable)) != sizeof(enable))
+	{
+		#ifdef DEBUG
+			perror("error: unable to enable uio interrupt");
+		#endif
+		return -1;
+	}
+	return 0;
+}
+
+
+
+/*
+ * Sleep until an enabled uioxx interrupt fires, or timeout_ms milliseconds pass. A negative timeout
+ * waits forever. The pending interrupt count is consumed.
+ * Returns 0 if an interrupt was taken, 1 on timeout, or -1 on error.
+ */
+int uio_irq_wait(int uio_fd, int timeout_ms)
+{
+	struct pollfd pfd = {.fd = uio_fd, .events = POLLIN};
+	uint32_t count;
+	int ret;
+
+	do
+		ret = poll(&pfd, 1, timeout_ms);
+	while((ret < 0) && (errno == EINTR));
+	if(ret == 0)
+		return 1;
+	if((ret < 0) || (read(uio_fd, &count, sizeof(count)) != sizeof(count)))
+	{
+		#ifdef DEBUG
+			perror("error: uio interrupt wait failed");
+		#endif
+		return -1;
+	}
+	return 0;
+}
+
+
+
+/*
+ * Buffer pool over the reserved memory of an IP's AXI masters.
+ *
+ * A binary buddy allocator hands out physically contiguous blocks of 2^n bytes, n >= MEM_POOL_MIN_ORDER.
+ * Blocks are aligned to their own size, so a block never crosses a 4 KiB AXI burst boundary unless it
+ * is larger than 4 KiB, in which case it starts on one. All the pool's metadata is host-side, so
+ * allocating never touches the uncached shared memory and an IP overrunning a buffer cannot corrupt
+ * the pool: the free lists are doubly linked through a pair of words per minimum block, and one byte
+ * per minimum block records the order and state of the block starting there, so mem_pool_free() needs no size. Blocks of up to
+ * MEM_POOL_TCACHE_ORDERS orders are cached per thread so the common small alloc/free pair needs no lock.
+ * Note: the pool is private to one process.
+ */
+
+#define MEM_BLOCK_FREE 0x80
+#define MEM_BLOCK_USED 0x40
+#define MEM_BLOCK_ORDER_MASK 0x3f
+#define MEM_BLOCK_NONE 0xffffffffU
+
+typedef struct mem_tcache {
+	mem_pool_t *pool;
+	struct mem_tcache *next, *prev; // in the pool's list of thread caches, protected by its lock
+	uint8_t count[MEM_POOL_TCACHE_ORDERS];
+	void *blocks[MEM_POOL_TCACHE_ORDERS][MEM_POOL_TCACHE_DEPTH];
+} mem_tcache_t;
+
+struct mem_pool {
+	uint8_t *vmem_base;
+	phantom_address_t phys_base;
+	uint32_t size;
+	uint32_t num_blocks; // in minimum sized blocks
+	uint8_t *block_state; // per minimum block: MEM_BLOCK_FREE/USED | order, 0 if not the start of a block
+	uint32_t *block_link; // per minimum block: next and previous free block of its order, if free
+	uint32_t free_head[MEM_POOL_ORDERS];
+	pthread_mutex_t lock;
+	pthread_key_t tcache_key;
+	mem_tcache_t *tcaches; // every thread's cache, so destroy can free them; protected by lock
+	uint32_t free_bytes; // protected by lock
+	uint32_t in_use; // the counters below are updated atomically
+	uint32_t peak_in_use;
+	uint32_t num_allocs;
+	uint32_t num_frees;
+	uint32_t num_failed;
+};
+
+
+static inline uint32_t *mem_block_link(mem_pool_t *pool, uint32_t idx)
+{
+	return &pool->block_link[(size_t) idx * 2];
+}
+
+
+static void mem_list_push(mem_pool_t *pool, uint8_t order, uint32_t idx)
+{
+	uint32_t *link = mem_block_link(pool, idx);
+
+	link[0] = pool->free_head[order];
+	link[1] = MEM_BLOCK_NONE;
+	if(pool->free_head[order] != MEM_BLOCK_NONE)
+		mem_block_link(pool, pool->free_head[order])[1] = idx;
+	pool->free_head[order] = idx;
+	pool->block_state[idx] = MEM_BLOCK_FREE | order;
+	pool->free_bytes += 1U << (order + MEM_POOL_MIN_ORDER);
+}
+
+
+static void mem_list_remove(mem_pool_t *pool, uint8_t order, uint32_t idx)
+{
+	uint32_t *link = mem_block_link(pool, idx);
+	uint32_t next = link[0], prev = link[1];
+
+	if(prev != MEM_BLOCK_NONE)
+		mem_block_link(pool, prev)[0] = next;
+	else
+		pool->free_head[order] = next;
+	if(next != MEM_BLOCK_NONE)
+		mem_block_link(pool, next)[1] = prev;
+	pool->block_state[idx] = 0;
+	pool->free_bytes -= 1U << (order + MEM_POOL_MIN_ORDER);
+}
+
+
+/* Take a block of the given order from the buddy lists, splitting a larger block if needed. Call with lock held. */
+static void *mem_buddy_alloc(mem_pool_t *pool, uint8_t order)
+{
+	uint8_t k;
+	uint32_t idx;
+
+	for(k = order; k < MEM_POOL_ORDERS && pool->free_head[k] == MEM_BLOCK_NONE; k++)
+		;
+	if(k == MEM_POOL_ORDERS)
+		return NULL;
+
+	idx = pool->free_head[k];
+	mem_list_remove(pool, k, idx);
+	while(k > order)
+	{
+		k--;
+		mem_list_push(pool, k, idx + (1U << k)); // upper half becomes a free buddy
+	}
+	pool->block_state[idx] = MEM_BLOCK_USED | order;
+	return pool->vmem_base + ((size_t) idx << MEM_POOL_MIN_ORDER);
+}
+
+
+/* Return a block to the buddy lists, merging with free buddies. Call with lock held. */
+static void mem_buddy_free(mem_pool_t *pool, uint32_t idx)
+{
+	uint8_t order = pool->block_state[idx] & MEM_BLOCK_ORDER_MASK;
+	uint32_t buddy;
+
+	pool->block_state[idx] = 0;
+	while(order + 1 < MEM_POOL_ORDERS)
+	{
+		buddy = idx ^ (1U << order);
+		if((buddy + (1U << order) > pool->num_blocks) || (pool->block_state[buddy] != (MEM_BLOCK_FREE | order)))
+			break;
+		mem_list_remove(pool, order, buddy);
+		if(buddy < idx)
+			idx = buddy;
+		order++;
+	}
+	mem_list_push(pool, order, idx);
+}
+
+
+/* Thread exit: hand the thread's cached blocks back to their pool. */
+static void mem_tcache_flush(void *arg)
+{
+	mem_tcache_t *tcache = arg;
+	mem_pool_t *pool = tcache->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	for(uint8_t order = 0; order < MEM_POOL_TCACHE_ORDERS; order++)
+		while(tcache->count[order])
+			mem_buddy_free(pool, ((uint8_t *) tcache->blocks[order][--tcache->count[order]] - pool->vmem_base) >> MEM_POOL_MIN_ORDER);
+	if(tcache->prev != NULL)
+		tcache->prev->next = tcache->next;
+	else
+		pool->tcaches = tcache->next;
+	if(tcache->next != NULL)
+		tcache->next->prev = tcache->prev;
+	pthread_mutex_unlock(&pool->lock);
+	free(tcache);
+}
+
+
+static mem_tcache_t *mem_get_tcache(mem_pool_t *pool)
+{
+	mem_tcache_t *tcache = pthread_getspecific(pool->tcache_key);
+
+	if(tcache == NULL)
+	{
+		if((tcache = calloc(1, sizeof(mem_tcache_t))) == NULL)
+			return NULL;
+		tcache->pool = pool;
+		if(pthread_setspecific(pool->tcache_key, tcache))
+		{
+			free(tcache);
+			return NULL;
+		}
+		pthread_mutex_lock(&pool->lock);
+		if((tcache->next = pool->tcaches) != NULL)
+			tcache->next->prev = tcache;
+		pool->tcaches = tcache;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return tcache;
+}
+
+
+/*
+ * Create a buffer pool over a mapped region of reserved memory. The region is carved in to the
+ * largest naturally aligned blocks that fit, so it need not be a power of two in size.
+ */
+mem_pool_t *mem_pool_create(void *vmem_base, phantom_address_t phys_base, uint32_t size)
+{
+	mem_pool_t *pool;
+	uint32_t idx;
+	uint8_t order;
+
+	if(size < (1U << MEM_POOL_MIN_ORDER))
+		return NULL;
+	if((pool = calloc(1, sizeof(mem_pool_t))) == NULL)
+		return NULL;
+
+	pool->vmem_base = vmem_base;
+	pool->phys_base = phys_base;
+	pool->size = size;
+	pool->num_blocks = size >> MEM_POOL_MIN_ORDER;
+	pool->block_state = calloc(pool->num_blocks, 1);
+	pool->block_link = malloc((size_t) pool->num_blocks * 2 * sizeof(uint32_t));
+	if((pool->block_state == NULL) || (pool->block_link == NULL))
+	{
+		free(pool->block_state);
+		free(pool->block_link);
+		free(pool);
+		return NULL;
+	}
+	for(order = 0; order < MEM_POOL_ORDERS; order++)
+		pool->free_head[order] = MEM_BLOCK_NONE;
+	pthread_mutex_init(&pool->lock, NULL);
+	if(pthread_key_create(&pool->tcache_key, mem_tcache_flush))
+	{
+		free(pool->block_state);
+		free(pool->block_link);
+		free(pool);
+		return NULL;
+	}
+
+	for(idx = 0; idx < pool->num_blocks; idx += 1U << order)
+	{
+		for(order = MEM_POOL_ORDERS - 1; order > 0; order--)
+			if(!(idx & ((1U << order) - 1)) && (idx + (1U << order) <= pool->num_blocks))
+				break;
+		mem_list_push(pool, order, idx);
+	}
+	return pool;
+}
+
+
+
+/*
+ * Destroy a pool, and the block caches of every thread that used it. No other thread may be
+ * using the pool, or exiting after having used it.
+ */
+void mem_pool_destroy(mem_pool_t *pool)
+{
+	mem_tcache_t *tcache, *next;
+
+	pthread_setspecific(pool->tcache_key, NULL);
+	pthread_key_delete(pool->tcache_key); // the destructor no longer runs, so the caches are freed here
+	pthread_mutex_lock(&pool->lock);
+	for(tcache = pool->tcaches; tcache != NULL; tcache = next)
+	{
+		next = tcache->next;
+		free(tcache);
+	}
+	pool->tcaches = NULL;
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->block_state);
+	free(pool->block_link);
+	free(pool);
+}
+
+
+
+void *mem_pool_alloc(mem_pool_t *pool, uint32_t size)
+{
+	mem_tcache_t *tcache;
+	uint32_t in_use, peak;
+	uint8_t order = 0;
+	void *block = NULL;
+
+	if((size == 0) || (size > pool->size))
+		return NULL;
+	while((1U << (order + MEM_POOL_MIN_ORDER)) < size)
+		order++;
+
+	if((order < MEM_POOL_TCACHE_ORDERS) && ((tcache = mem_get_tcache(pool)) != NULL) && tcache->count[order])
+		block = tcache->blocks[order][--tcache->count[order]];
+	else
+	{
+		pthread_mutex_lock(&pool->lock);
+		block = mem_buddy_alloc(pool, order);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	if(block == NULL)
+	{
+		__atomic_add_fetch(&pool->num_failed, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	__atomic_add_fetch(&pool->num_allocs, 1, __ATOMIC_RELAXED);
+	in_use = __atomic_add_fetch(&pool->in_use, 1U << (order + MEM_POOL_MIN_ORDER), __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&pool->peak_in_use, __ATOMIC_RELAXED);
+	while((in_use > peak) && !__atomic_compare_exchange_n(&pool->peak_in_use, &peak, in_use, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return block;
+}
+
+
+
+void mem_pool_free(mem_pool_t *pool, void *ptr)
+{
+	mem_tcache_t *tcache;
+	uint32_t idx;
+	uint8_t order;
+
+	idx = ((uint8_t *) ptr - pool->vmem_base) >> MEM_POOL_MIN_ORDER;
+	if((idx >= pool->num_blocks) || !(pool->block_state[idx] & MEM_BLOCK_USED))
+	{
+		#ifdef DEBUG
+			printf("error: freeing %p which is not an allocated pool block\n", ptr);
+		#endif
+		return;
+	}
+	order = pool->block_state[idx] & MEM_BLOCK_ORDER_MASK;
+	__atomic_sub_fetch(&pool->in_use, 1U << (order + MEM_POOL_MIN_ORDER), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pool->num_frees, 1, __ATOMIC_RELAXED);
+
+	if((order < MEM_POOL_TCACHE_ORDERS) && ((tcache = mem_get_tcache(pool)) != NULL) && (tcache->count[order] < MEM_POOL_TCACHE_DEPTH))
+	{
+		tcache->blocks[order][tcache->count[order]++] = ptr;
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	mem_buddy_free(pool, idx);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+
+void mem_pool_get_stats(mem_pool_t *pool, phantom_mem_stats_t *stats)
+{
+	int order;
+
+	pthread_mutex_lock(&pool->lock);
+	stats->free = pool->free_bytes;
+	for(order = MEM_POOL_ORDERS - 1; order >= 0 && pool->free_head[order] == MEM_BLOCK_NONE; order--)
+		;
+	stats->largest_free = (order < 0) ? 0 : 1U << (order + MEM_POOL_MIN_ORDER);
+	pthread_mutex_unlock(&pool->lock);
+
+	stats->total_size = pool->size;
+	stats->in_use = __atomic_load_n(&pool->in_use, __ATOMIC_RELAXED);
+	stats->peak_in_use = __atomic_load_n(&pool->peak_in_use, __ATOMIC_RELAXED);
+	stats->num_allocs = __atomic_load_n(&pool->num_allocs, __ATOMIC_RELAXED);
+	stats->num_frees = __atomic_load_n(&pool->num_frees, __ATOMIC_RELAXED);
+	stats->num_failed = __atomic_load_n(&pool->num_failed, __ATOMIC_RELAXED);
+	stats->fragmentation = stats->free ? (uint32_t)(100 - (100ULL * stats->largest_free) / stats->free) : 0;
+}
+
+
+
+/*
+ * Returns 1 if a physical range lies inside one System RAM region of /proc/iomem, else 0.
+ * Reserved-memory nodes with no-map are listed as reserved instead.
+ */
+static int mem_is_system_ram(phantom_address_t phys_base, uint32_t size)
+{
+	char line[LINE_LEN];
+	unsigned long long start, end;
+	int name_pos, ret = 0;
+	FILE *fp;
+
+	if((fp = fopen(PROC_IOMEM_FILE, "r")) == NULL)
+		return 0;
+	while(!ret && (fgets(line, sizeof(line), fp) != NULL))
+	{
+		/* top level entries only, nested ones are indented */
+		if((line[0] == ' ') || (sscanf(line, "%llx-%llx : %n", &start, &end, &name_pos) != 2))
+			continue;
+		if(strncmp(line + name_pos, "System RAM", 10))
+			continue;
+		ret = (phys_base >= start) && ((uint64_t) phys_base + size - 1 <= end);
+	}
+	fclose(fp);
+	return ret;
+}
+
+
+
+/*
+ * Map an IP's reserved memory cacheable, through /dev/mem without O_SYNC. The kernel only gives a
+ * cacheable mapping if the region is part of the kernel's linear map, i.e. a reserved-memory node
+ * without no-map; otherwise the mapping would be uncached as through uio, so it is refused.
+ * Returns the mapping, or NULL on failure.
+ */
+void *map_mem_cached(phantom_address_t phys_base, uint32_t size)
+{
+	void *mmem;
+	int memfd;
+
+	if(!mem_is_system_ram(phys_base, size))
+	{
+		#ifdef DEBUG
+			printf("error: memory 0x%08" PRIx64 " is not in the kernel's linear map (no-map), so cannot be mapped cached\n", (uint64_t) phys_base);
+		#endif
+		return NULL;
+	}
+	if((memfd = open("/dev/mem", O_RDWR)) < 0)
+	{
+		#ifdef DEBUG
+			perror("error: unable to open /dev/mem");
+		#endif
+		return NULL;
+	}
+	mmem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, phys_base);
+	close(memfd);
+	if(mmem == MAP_FAILED)
+	{
+		#ifdef DEBUG
+			printf("error: unable to map memory 0x%08" PRIx64 " cached\n", (uint64_t) phys_base);
+		#endif
+		return NULL;
+	}
+	return mmem;
+}
+
+
+
+/*
+ * Returns 1 if data cache lines can be cleaned and invalidated from user space, 0 if not. AArch64
+ * Linux lets EL0 use DC CVAC/CIVAC. On ARMv7 the equivalent DCCMVAC/DCCIMVAC are privileged (mcr
+ * p15 faults in user mode), and the cacheflush syscall only cleans to the point of unification,
+ * which on Zynq-7000 leaves lines in the L2. So there only coherent memory is mapped cached.
+ */
+int cache_maintenance_supported(void)
+{
+#if defined(__aarch64__)
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+
+
+#if defined(__aarch64__)
+static uintptr_t cache_line_size(void)
+{
+	static uintptr_t line;
+	uint64_t ctr;
+
+	if(line == 0)
+	{
+		__asm__ __volatile__("mrs %0, ctr_el0" : "=r" (ctr));
+		line = 4U << ((ctr >> 16) & 0xf); // DminLine, log2 of words in the smallest data cache line
+	}
+	return line;
+}
+#endif
+
+
+
+/*
+ * Write dirty data cache lines covering a range back to memory, keeping them valid.
+ */
+void cache_clean_range(const void *addr, uint32_t len)
+{
+#if defined(__aarch64__)
+	uintptr_t line = cache_line_size();
+	uintptr_t end = (uintptr_t) addr + len;
+
+	for(uintptr_t p = (uintptr_t) addr & ~(line - 1); p < end; p += line)
+		__asm__ __volatile__("dc cvac, %0" : : "r" (p) : "memory");
+	__asm__ __volatile__("dsb sy" : : : "memory");
+#else
+	(void) addr; // only coherent memory is mapped cached here, see cache_maintenance_supported()
+	(void) len;
+	__sync_synchronize();
+#endif
+}
+
+
+
+/*
+ * Write back and invalidate the data cache lines covering a range, so the next CPU reads come
+ * from memory. User space cannot discard lines without writing them back.
+ */
+void cache_flush_range(const void *addr, uint32_t len)
+{
+#if defined(__aarch64__)
+	uintptr_t line = cache_line_size();
+	uintptr_t end = (uintptr_t) addr + len;
+
+	for(uintptr_t p = (uintptr_t) addr & ~(line - 1); p < end; p += line)
+		__asm__ __volatile__("dc civac, %0" : : "r" (p) : "memory");
+	__asm__ __volatile__("dsb sy" : : : "memory");
+#else
+	(void) addr;
+	(void) len;
+	__sync_synchronize();
+#endif
+}
+
+
+
+/*
+ * Order earlier CPU accesses to coherent memory before later ones, including device register writes.
+ */
+void cache_barrier(void)
+{
+#if defined(__aarch64__) || (defined(__arm__) && defined(__ARM_ARCH_7A__))
+	__asm__ __volatile__("dsb sy" : : : "memory");
+#else
+	__sync_synchronize();
+#endif
 }
 
 
@@ -280,7 +1227,7 @@ int fpga_reset(uint8_t plreset)
 {
     int memfd;
     phantom_address_t *mapped_base;
-    phantom_data_t fpga_rst;
+    uint32_t fpga_rst;
 
     fpga_rst = 0U;
     fpga_rst |= plreset;
@@ -292,9 +1239,9 @@ int fpga_reset(uint8_t plreset)
     	return -1;
 
     /* pulse reset signal for 100 ns */
-    reg_write(mapped_base, SLCR_FPGA_RST_CTRL_REG, fpga_rst);
+    reg_write32(mapped_base, SLCR_FPGA_RST_CTRL_REG, fpga_rst);
     nanosleep((const struct timespec[]){{0, 100L}}, NULL);
-    reg_write(mapped_base, SLCR_FPGA_RST_CTRL_REG, 0);
+    reg_write32(mapped_base, SLCR_FPGA_RST_CTRL_REG, 0);
 
     close(memfd);
 	return 0;
@@ -305,14 +1252,220 @@ int fpga_reset(uint8_t plreset)
 
 void reg_write(void *reg_base, phantom_address_t offset, phantom_data_t value)
 {
-	*((volatile phantom_address_t *)(reg_base + offset)) = value;
+	reg_write_data(reg_base, offset, value);
 }
 
 
 
 phantom_data_t reg_read(void *reg_base, phantom_address_t offset)
 {
-	return *((volatile phantom_address_t *)(reg_base + offset));
+	return reg_read_data(reg_base, offset);
+}
+
+
+
+/*
+ * Burst copy helpers for block transfers. dst/src on the device side must be aligned to
+ * BLOCK_BURST_LEN, the memory side may have any alignment. Each helper moves n bursts.
+ * Strongly-ordered (uio) mappings fault on unaligned access, so the device side is always
+ * accessed with naturally aligned elements.
+ */
+static void burst_to_dev(volatile uint8_t *dst, const uint8_t *src, uint32_t n)
+{
+#if defined(__aarch64__)
+	__asm__ __volatile__(
+		"1:	ldp q0, q1, [%[s]], #32\n\t"
+		"	stp q0, q1, [%[d]], #32\n\t"
+		"	subs %w[n], %w[n], #1\n\t"
+		"	b.ne 1b\n\t"
+		: [d] "+r" (dst), [s] "+r" (src), [n] "+r" (n)
+		:
+		: "v0", "v1", "cc", "memory");
+#elif defined(__arm__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+	__asm__ __volatile__(
+		"1:	vld1.8 {d0-d3}, [%[s]]!\n\t"
+		"	vst1.32 {d0-d3}, [%[d]]!\n\t"
+		"	subs %[n], %[n], #1\n\t"
+		"	bne 1b\n\t"
+		: [d] "+r" (dst), [s] "+r" (src), [n] "+r" (n)
+		:
+		: "d0", "d1", "d2", "d3", "cc", "memory");
+#elif defined(__arm__)
+	uint32_t tmp[BLOCK_BURST_LEN / sizeof(uint32_t)];
+	const uint8_t *s;
+
+	for(; n; n--, src += BLOCK_BURST_LEN)
+	{
+		s = src;
+		if((uintptr_t)src & (sizeof(uint32_t) - 1)) // ldm needs a word aligned source
+		{
+			memcpy(tmp, src, BLOCK_BURST_LEN);
+			s = (const uint8_t *)tmp;
+		}
+		__asm__ __volatile__(
+			"ldmia %[s]!, {r4-r6, r8}\n\t"
+			"stmia %[d]!, {r4-r6, r8}\n\t"
+			"ldmia %[s]!, {r4-r6, r8}\n\t"
+			"stmia %[d]!, {r4-r6, r8}\n\t"
+			: [d] "+r" (dst), [s] "+r" (s)
+			:
+			: "r4", "r5", "r6", "r8", "memory");
+	}
+#else
+	phantom_data_t word;
+
+	for(n *= BLOCK_BURST_LEN / sizeof(phantom_data_t); n; n--)
+	{
+		memcpy(&word, src, sizeof(phantom_data_t));
+		*((volatile phantom_data_t *)dst) = word;
+		dst += sizeof(phantom_data_t);
+		src += sizeof(phantom_data_t);
+	}
+#endif
+}
+
+
+
+static void burst_from_dev(uint8_t *dst, volatile const uint8_t *src, uint32_t n)
+{
+#if defined(__aarch64__)
+	__asm__ __volatile__(
+		"1:	ldp q0, q1, [%[s]], #32\n\t"
+		"	stp q0, q1, [%[d]], #32\n\t"
+		"	subs %w[n], %w[n], #1\n\t"
+		"	b.ne 1b\n\t"
+		: [d] "+r" (dst), [s] "+r" (src), [n] "+r" (n)
+		:
+		: "v0", "v1", "cc", "memory");
+#elif defined(__arm__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+	__asm__ __volatile__(
+		"1:	vld1.32 {d0-d3}, [%[s]]!\n\t"
+		"	vst1.8 {d0-d3}, [%[d]]!\n\t"
+		"	subs %[n], %[n], #1\n\t"
+		"	bne 1b\n\t"
+		: [d] "+r" (dst), [s] "+r" (src), [n] "+r" (n)
+		:
+		: "d0", "d1", "d2", "d3", "cc", "memory");
+#elif defined(__arm__)
+	uint32_t tmp[BLOCK_BURST_LEN / sizeof(uint32_t)];
+	uint8_t *d;
+
+	for(; n; n--, dst += BLOCK_BURST_LEN)
+	{
+		d = ((uintptr_t)dst & (sizeof(uint32_t) - 1)) ? (uint8_t *)tmp : dst; // stm needs a word aligned target
+		__asm__ __volatile__(
+			"ldmia %[s]!, {r4-r6, r8}\n\t"
+			"stmia %[d]!, {r4-r6, r8}\n\t"
+			"ldmia %[s]!, {r4-r6, r8}\n\t"
+			"stmia %[d]!, {r4-r6, r8}\n\t"
+			: [d] "+r" (d), [s] "+r" (src)
+			:
+			: "r4", "r5", "r6", "r8", "memory");
+		if((uintptr_t)dst & (sizeof(uint32_t) - 1))
+			memcpy(dst, tmp, BLOCK_BURST_LEN);
+	}
+#else
+	phantom_data_t word;
+
+	for(n *= BLOCK_BURST_LEN / sizeof(phantom_data_t); n; n--)
+	{
+		word = *((volatile const phantom_data_t *)src);
+		memcpy(dst, &word, sizeof(phantom_data_t));
+		dst += sizeof(phantom_data_t);
+		src += sizeof(phantom_data_t);
+	}
+#endif
+}
+
+
+
+/*
+ * Copy len bytes from buf to a mapped slave region, starting at offset. Bytes up to the first
+ * word boundary are written singly, then words up to a burst boundary, then whole bursts,
+ * and the tail is finished with word and byte writes. The caller is responsible for bounds.
+ */
+void reg_write_block(void *reg_base, phantom_address_t offset, const void *buf, uint32_t len)
+{
+	volatile uint8_t *dst = (volatile uint8_t *)reg_base + offset;
+	const uint8_t *src = buf;
+	phantom_data_t word;
+	uint32_t n;
+
+	while(len && ((uintptr_t)dst & (sizeof(phantom_data_t) - 1)))
+	{
+		*dst++ = *src++;
+		len--;
+	}
+	while((len >= sizeof(phantom_data_t)) && ((uintptr_t)dst & (BLOCK_BURST_LEN - 1)))
+	{
+		memcpy(&word, src, sizeof(phantom_data_t));
+		*((volatile phantom_data_t *)dst) = word;
+		dst += sizeof(phantom_data_t);
+		src += sizeof(phantom_data_t);
+		len -= sizeof(phantom_data_t);
+	}
+	if((n = len / BLOCK_BURST_LEN))
+	{
+		burst_to_dev(dst, src, n);
+		dst += n * BLOCK_BURST_LEN;
+		src += n * BLOCK_BURST_LEN;
+		len -= n * BLOCK_BURST_LEN;
+	}
+	while(len >= sizeof(phantom_data_t))
+	{
+		memcpy(&word, src, sizeof(phantom_data_t));
+		*((volatile phantom_data_t *)dst) = word;
+		dst += sizeof(phantom_data_t);
+		src += sizeof(phantom_data_t);
+		len -= sizeof(phantom_data_t);
+	}
+	while(len--)
+		*dst++ = *src++;
+}
+
+
+
+/*
+ * Copy len bytes from a mapped slave region, starting at offset, in to buf. Mirror of
+ * reg_write_block(). The caller is responsible for bounds.
+ */
+void reg_read_block(void *reg_base, phantom_address_t offset, void *buf, uint32_t len)
+{
+	volatile const uint8_t *src = (volatile const uint8_t *)reg_base + offset;
+	uint8_t *dst = buf;
+	phantom_data_t word;
+	uint32_t n;
+
+	while(len && ((uintptr_t)src & (sizeof(phantom_data_t) - 1)))
+	{
+		*dst++ = *src++;
+		len--;
+	}
+	while((len >= sizeof(phantom_data_t)) && ((uintptr_t)src & (BLOCK_BURST_LEN - 1)))
+	{
+		word = *((volatile const phantom_data_t *)src);
+		memcpy(dst, &word, sizeof(phantom_data_t));
+		dst += sizeof(phantom_data_t);
+		src += sizeof(phantom_data_t);
+		len -= sizeof(phantom_data_t);
+	}
+	if((n = len / BLOCK_BURST_LEN))
+	{
+		burst_from_dev(dst, src, n);
+		dst += n * BLOCK_BURST_LEN;
+		src += n * BLOCK_BURST_LEN;
+		len -= n * BLOCK_BURST_LEN;
+	}
+	while(len >= sizeof(phantom_data_t))
+	{
+		word = *((volatile const phantom_data_t *)src);
+		memcpy(dst, &word, sizeof(phantom_data_t));
+		dst += sizeof(phantom_data_t);
+		src += sizeof(phantom_data_t);
+		len -= sizeof(phantom_data_t);
+	}
+	while(len--)
+		*dst++ = *src++;
 }
 
 
@@ -341,10 +1494,13 @@ unsigned int get_memory_size(char *sysfs_path_file)
 
 
 
-char* get_nodestr(const char *sysfs_path_file)
+/*
+ * Read the first word of a sysfs file in to name, which must hold 256 chars.
+ * Returns name, or NULL on failure.
+ */
+char* get_nodestr(const char *sysfs_path_file, char *name)
 {
 	FILE *name_fp;
-	static char name[256];
 
 	name_fp = fopen(sysfs_path_file, "r");
 	if (name_fp == NULL) {
@@ -354,7 +1510,7 @@ char* get_nodestr(const char *sysfs_path_file)
 		return NULL;
 	}
 
-	fscanf(name_fp, "%s", name);
+	fscanf(name_fp, "%255s", name);
 	fclose(name_fp);
 	return name;
 }
@@ -365,7 +1521,8 @@ int check_for_node_str(const char* nodestr, const char* checkstr)
 {
 	char str[256];
 
-	strcpy(str, get_nodestr(nodestr));
+	if (get_nodestr(nodestr, str) == NULL)
+		return -1;
 	if (strcmp(str, checkstr))
 	{
 		return -1;
@@ -401,8 +1558,8 @@ int fpga_config_reset()
 {
     int memfd;
     phantom_address_t *mapped_base;
-    phantom_data_t ctrl_reg;
-    phantom_data_t status_reg;
+    uint32_t ctrl_reg;
+    uint32_t status_reg;
     int i;
 
 
@@ -411,20 +1568,20 @@ int fpga_config_reset()
     mapped_base = mmap(NULL, 0x100, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, DEVCFG_BASE_ADDR);
 
     /* get current devcfg.ctrl value */
-    ctrl_reg = reg_read(mapped_base, DEVCFG_CTRL_REG);
+    ctrl_reg = reg_read32(mapped_base, DEVCFG_CTRL_REG);
 
     /* ensure PROG_B high (should be by default) */
     ctrl_reg |= PCFG_PROG_B_MASK;
-    reg_write(mapped_base, DEVCFG_CTRL_REG, ctrl_reg);
+    reg_write32(mapped_base, DEVCFG_CTRL_REG, ctrl_reg);
 
     /* set PROG_B low */
     ctrl_reg &= ~PCFG_PROG_B_MASK;
-    reg_write(mapped_base, DEVCFG_CTRL_REG, ctrl_reg);
+    reg_write32(mapped_base, DEVCFG_CTRL_REG, ctrl_reg);
 
     /* wait until PCAP_INT status bit is low (reset state). Use timeout to prevent stall on error. */
     for(i=0; i < REG_READ_TIMEOUT; i++)
     {
-    	status_reg = reg_read(mapped_base, DEVCFG_STATUS_REG);
+    	status_reg = reg_read32(mapped_base, DEVCFG_STATUS_REG);
     	if ((status_reg & PCFG_INIT_MASK)==0)
     		break;
     	usleep(1);
@@ -438,12 +1595,12 @@ int fpga_config_reset()
 
     /* return PROG_B high */
     ctrl_reg |= PCFG_PROG_B_MASK;
-    reg_write(mapped_base, DEVCFG_CTRL_REG, ctrl_reg);
+    reg_write32(mapped_base, DEVCFG_CTRL_REG, ctrl_reg);
 
     /* wait until PCAP_INT returns high (set state) */
     for(i=0; i < REG_READ_TIMEOUT; i++)
     {
-    	status_reg = reg_read(mapped_base, DEVCFG_STATUS_REG);
+    	status_reg = reg_read32(mapped_base, DEVCFG_STATUS_REG);
     	if (status_reg & PCFG_INIT_MASK)
     		break;
     	usleep(1);
@@ -460,3 +1617,47 @@ int fpga_config_reset()
 }
 
 
+
+
+
+/*
+ * Function to configure the FPGA PL with the given bitfile. The configuration device is locked
+ * while the bitfile is written, so concurrent configurations from several processes are
+ * serialised rather than interleaved.
+ * Parameters: bitfile - path of the bitfile.
+ * Return: PHANTOM_OK once written, PHANTOM_ERROR if a file cannot be opened, or PHANTOM_FALSE
+ *         if the write fails.
+ */
+int fpga_configure(const char *bitfile)
+{
+    int xdevcfg_fd;
+    int bitfile_fd;
+    struct stat filestat;
+    ssize_t ret;
+
+    bitfile_fd = open(bitfile, O_RDONLY | O_CLOEXEC);
+    if(bitfile_fd < 0)
+    {
+		#ifdef DEBUG
+    		printf("error: can't open bitfile %s\n", bitfile);
+		#endif
+        return PHANTOM_ERROR;
+    }
+    fstat(bitfile_fd, &filestat);
+
+    xdevcfg_fd = open(FPGA_CFG_FILE, O_WRONLY | O_CLOEXEC);
+    if(xdevcfg_fd < 0)
+    {
+    	close(bitfile_fd);
+        return PHANTOM_ERROR;
+    }
+
+    flock(xdevcfg_fd, LOCK_EX); // released on close
+    ret = sendfile(xdevcfg_fd, bitfile_fd, NULL, filestat.st_size);
+    close(xdevcfg_fd);
+	close(bitfile_fd);
+
+    if (ret < 0)
+        return PHANTOM_FALSE;
+    return PHANTOM_OK;
+}
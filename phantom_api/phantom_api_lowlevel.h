@@ -31,13 +31,16 @@
 
 
 #include "phantom_api.h"
+#include "phantom_xml_parser.h"
+#include <pthread.h>
 
 
 /*
  * Defines
  */
 
-#define NUM_OF_UIO_DEVS 32
+#define NUM_OF_UIO_DEVS 32 // uio nodes allocated for at first, doubled as needed
+#define UIO_INDEX_BITS 6 // uio address index of 64 entries at first, kept at most half full
 
 #define DEFAULT_MEM_SIZE 0x1000
 
@@ -48,12 +51,54 @@
 #define FPGA_DONE_FILE "/sys/class/xdevcfg/xdevcfg/device/prog_done"
 #define FPGA_CFG_FILE "/dev/xdevcfg"
 
-#define PHANTOM_MODULE "uio_pdrv_genirq of_id=phantom_platform,generic-uio,ui_pdrv"
+#define PHANTOM_MODULE "uio_pdrv_genirq"
+#define PHANTOM_MODULE_PARAMS "of_id=phantom_platform,generic-uio,ui_pdrv"
+#define MODULES_LOC "/lib/modules/"
+#define MODULES_DEP_FILE "/modules.dep"
 
+#define UIO_DEVS_DIR "/dev" // watched for the uio nodes to appear
+#define UIO_READY_TIMEOUT_MS 5000 // default wait for a design's uio nodes, see phantom_set_dev_timeout()
+#define UIO_POLL_MS 10 // rescan interval if inotify is unavailable
+#define UIO_EVENT_BUF_LEN 4096
+#define MODULE_MAX_DEPS 16
+
+#ifndef MODULE_INIT_COMPRESSED_FILE
+    #define MODULE_INIT_COMPRESSED_FILE 4 // finit_module() flag, the kernel decompresses the module
+#endif
+#ifndef MFD_CLOEXEC
+    #define MFD_CLOEXEC 0x0001U // memfd_create() flags, for C libraries without them
+    #define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+    #define F_ADD_SEALS 1033 // memfd seals, for C libraries without them
+    #define F_SEAL_SEAL 0x0001
+    #define F_SEAL_SHRINK 0x0002
+    #define F_SEAL_GROW 0x0004
+    #define F_SEAL_WRITE 0x0008
+#endif
+
+#if TARGET_FPGA == 0
 #define AXI_GP0_BASEADDR 0x40000000
 #define MAX_AXI_GP0_BASEADDR 0x4f000000
 #define AXI_GP1_BASEADDR 0x80000000
 #define MAX_AXI_GP1_BASEADDR 0x8f000000
+#define PS_DDR_ADDR_RANGE AXI_GP0_BASEADDR // PS DDR lies below the AXI GP windows
+#else
+/* Zynq MPSoC PL slave windows: LPD, then FPD HPM0/HPM1 below 4 GiB and their 4 GiB windows above it */
+#define AXI_LPD_BASEADDR 0x80000000
+#define MAX_AXI_LPD_BASEADDR 0x9f000000
+#define AXI_HPM0_BASEADDR 0xa0000000
+#define MAX_AXI_HPM0_BASEADDR 0xaf000000
+#define AXI_HPM1_BASEADDR 0xb0000000
+#define MAX_AXI_HPM1_BASEADDR 0xbf000000
+#define AXI_HPM0_HIGH_BASEADDR 0x400000000ULL
+#define MAX_AXI_HPM0_HIGH_BASEADDR 0x4ff000000ULL
+#define AXI_HPM1_HIGH_BASEADDR 0x500000000ULL
+#define MAX_AXI_HPM1_HIGH_BASEADDR 0x5ff000000ULL
+#define PS_DDR_ADDR_RANGE 0x80000000 // low PS DDR, below the LPD window
+#define PS_DDR_HIGH_BASEADDR 0x800000000ULL
+#define PS_DDR_HIGH_ADDR_RANGE 0x800000000ULL // high PS DDR, up to 32 GiB
+#endif
 #define AXI_GP_ADDR_RANGE 0x1000000 // set at 16MB for each core (component) mapping
 
 #define DEVCFG_BASE_ADDR 0xf8007000  // Devcfg regs base
@@ -76,6 +121,73 @@
 
 #define REG_READ_TIMEOUT 1000 // 1000 us timeout
 
+#define WAIT_SPIN_MAX_NS 50000 // jobs averaging longer than this are not spun on by the hybrid wait policy
+#define WAIT_EWMA_SHIFT 3 // weight of 1/8 for each new job duration in the running average
+
+#define ASYNC_DEFAULT_RING_SIZE 64 // jobs queued per IP before submitters see backpressure
+#define ASYNC_MAX_RING_SIZE 0x10000
+#define ASYNC_CACHE_LINE 64
+#define ASYNC_JOB_QUEUED 1
+#define ASYNC_JOB_WAITING 2 // or'ed in to ASYNC_JOB_QUEUED while a thread sleeps on the job
+#define ASYNC_JOB_DONE 4
+#ifndef ASYNC_JOB_TIMEOUT_MS
+    #define ASYNC_JOB_TIMEOUT_MS 10000 // a job whose core has not completed by then is given up on with PHANTOM_ERROR
+#endif
+#define ASYNC_JOB_POLL_US 100 // sleep between control register reads for cores without an interrupt
+
+#define CMDLIST_INITIAL_CMDS 32
+#define CMDLIST_POLL_CLOCK_SPINS 256 // register reads between clock checks in a command list poll
+
+#define STREAM_MAX_SETS 64
+#define STREAM_POLL_US 100 // sleep between checks on a core without an interrupt, or while a stream closes
+
+/* continuous mode ring layout in shared memory, see phantom_api_ring.c */
+#define RING_HEAD_OFFSET 0x00
+#define RING_TAIL_OFFSET 0x04
+#define RING_NUM_DESCS_OFFSET 0x08
+#define RING_DESC_SIZE_OFFSET 0x0c
+#define RING_DESC_OFFSET 0x40
+#define RING_MAX_SIZE 0x1000000
+#define RING_WAIT_SLICE_MS 100 // bound on each interrupt sleep so a missed pass cannot stall the wait
+#define RING_CLOSE_POLL_US 100 // sleep between tail checks while a ring drains on close, or is waited on without an interrupt
+
+/* node wide IP lease block, see phantom_api_lease.c */
+#ifndef LEASE_BLOCK_FILE
+    #define LEASE_BLOCK_FILE "/dev/shm/phantom_leases"
+#endif
+#ifndef PHANTOM_ACCESS_GROUP
+    #define PHANTOM_ACCESS_GROUP "" // group given access to the lease block, e.g. "phantom"; if empty only its creator has
+#endif
+#define LEASE_MAGIC 0x5048544c // "PHTL"
+#define LEASE_VERSION 1
+#define LEASE_MAX_SLOTS 64 // IPs leased on the node, across all designs
+#define LEASE_MAX_SHARED 32 // shared holders per IP
+#define LEASE_PRUNE_MS 100 // bound on each sleep so leases of crashed processes are reclaimed
+
+/* resident daemon, see phantom_api_daemon.c and phantomd/ */
+#ifndef PHANTOMD_SOCKET_FILE
+    #define PHANTOMD_SOCKET_FILE "/run/phantomd.sock"
+#endif
+#define PHANTOMD_SOCKET_MODE 0660 // of the socket file, given to PHANTOM_ACCESS_GROUP if that is set
+#define PHANTOMD_MAGIC 0x50485444 // "PHTD"
+#define PHANTOMD_VERSION 1 // bump whenever the messages change
+#define PHANTOMD_OP_ATTACH 1
+#define PHANTOMD_OP_CONFIGURE 2
+#define PHANTOMD_FDS_PER_MSG 64 // uio fds passed per message, below the kernel's SCM_MAX_FD
+#define PHANTOMD_TIMEOUT_MS 10000 // bound on a daemon round trip, including a reconfiguration queued ahead
+#define PHANTOMD_RETRY_MS 5000 // least time between attempts of phantomd to load a design that failed to load
+
+#define MEM_CACHED 1 // phantom_ip_t.m0_cache: shared memory mapped cacheable
+#define MEM_COHERENT 2 // and the IP's masters snoop the CPU caches, so no maintenance is needed
+#define PROC_IOMEM_FILE "/proc/iomem" // memory in its System RAM regions can be mapped cached through /dev/mem
+
+#define BLOCK_BURST_LEN 32 // bytes moved per burst instruction in block copies
+
+#define MEM_POOL_MIN_ORDER 7 // smallest pool block 128 bytes, one 16 beat AXI3 burst on a 64-bit HP port
+#define MEM_POOL_ORDERS 26 // block orders above MEM_POOL_MIN_ORDER, enough for any 32-bit region
+#define MEM_POOL_TCACHE_ORDERS 6 // blocks up to 4 KiB are cached per thread
+#define MEM_POOL_TCACHE_DEPTH 8 // cached blocks per order per thread
+
 #define PHANTOM_FPGASYS_FILENAME "phantom_fpga.tar.gz"
 #define SD_CARD_PHANTOM_DOWNLOAD_LOC SD_CARD_PHANTOM_LOC "download/"
 #define SD_CARD_PHANTOM_DOWNLOAD_FILE SD_CARD_PHANTOM_DOWNLOAD_LOC PHANTOM_FPGASYS_FILENAME
@@ -83,6 +195,11 @@
 #define SD_CARD_PHANTOM_FPGA_CONFIG_LOC SD_CARD_PHANTOM_FPGA_LOC "/conf/"
 #define SD_CARD_PHANTOM_FPGA_BITFILE_LOC SD_CARD_PHANTOM_FPGA_LOC "/bitfile/"
 #define SD_CARD_PHANTOM_FPGA_CONF_FILE SD_CARD_PHANTOM_FPGA_CONFIG_LOC "phantom_fpga_conf.xml"
+#ifndef SD_CARD_PHANTOM_FPGA_SNAPSHOT_FILE
+    #define SD_CARD_PHANTOM_FPGA_SNAPSHOT_FILE SD_CARD_PHANTOM_FPGA_CONFIG_LOC "phantom_fpga_conf.bin" // e.g. elsewhere for host test builds
+#endif
+#define SNAPSHOT_MAGIC 0x50485453 // "PHTS"
+#define SNAPSHOT_VERSION 2 // bump whenever the snapshot layout changes
 #define SYSCLASS_LOC "/sys/class/uio/"
 #define MAP_ADDR_FILE "/maps/map0/addr"
 #define MAP_SIZE_FILE "/maps/map0/size"
@@ -103,23 +220,160 @@
 #define IPCORE_ISR_CH0_BM (1<<0)
 #define IPCORE_ISR_CH1_BM (1<<1)
 
+/* Xilinx AXI DMA registers. Channel registers are relative to the MM2S or S2MM channel offset. */
+#define AXI_DMA_REG_SPACE 0x60
+#define AXI_DMA_MM2S_OFFSET 0x00
+#define AXI_DMA_S2MM_OFFSET 0x30
+#define AXI_DMA_DMACR 0x00
+#define AXI_DMA_DMASR 0x04
+#define AXI_DMA_CURDESC 0x08
+#define AXI_DMA_CURDESC_MSB 0x0c
+#define AXI_DMA_TAILDESC 0x10
+#define AXI_DMA_TAILDESC_MSB 0x14
+#define AXI_DMA_ADDR 0x18 // MM2S_SA or S2MM_DA
+#define AXI_DMA_ADDR_MSB 0x1c
+#define AXI_DMA_LENGTH 0x28
+#define AXI_DMA_DMACR_RS_BM (1<<0)
+#define AXI_DMA_DMASR_HALTED_BM (1<<0)
+#define AXI_DMA_DMASR_IDLE_BM (1<<1)
+#define AXI_DMA_DMASR_SGINCLD_BM (1<<3)
+#define AXI_DMA_DMASR_ERR_BM 0x770 // Int/Slv/Dec errors for data and SG fetches
+#define AXI_DMA_DEFAULT_MAX_LEN 0x3fff // 14 bit buffer length register, the core's default width
+
+/* Xilinx AXI DMA scatter-gather buffer descriptor */
+#define AXI_DMA_BD_SIZE 0x40 // descriptors must be 16 word aligned
+#define AXI_DMA_BD_NXTDESC 0x00
+#define AXI_DMA_BD_NXTDESC_MSB 0x04
+#define AXI_DMA_BD_BUFFER 0x08
+#define AXI_DMA_BD_BUFFER_MSB 0x0c
+#define AXI_DMA_BD_CONTROL 0x18
+#define AXI_DMA_BD_STATUS 0x1c
+#define AXI_DMA_BD_CTRL_SOF_BM (1<<27)
+#define AXI_DMA_BD_CTRL_EOF_BM (1<<26)
+#define AXI_DMA_BD_STS_CMPLT_BM (1U<<31)
+#define AXI_DMA_BD_STS_ERR_BM (7<<28)
+
 
 
 typedef enum {UIO_DEV_OPENED=1, UIO_DEV_MAPPED=2} uio_dev_flags;
 
+typedef struct mem_pool mem_pool_t;
+
+/* request to phantomd */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t op; // PHANTOMD_OP_ATTACH or PHANTOMD_OP_CONFIGURE
+} phantomd_req_t;
+
+/*
+ * Reply from phantomd. An attach is answered by a first message carrying the configuration
+ * snapshot's fd, then by as many messages as it takes to pass the uio nodes' fds, in order.
+ */
+typedef struct {
+	uint32_t magic;
+	int32_t status; // PHANTOM_OK, or the error of the request
+	uint32_t num_uio; // uio nodes in the whole reply
+	uint32_t num_fds; // fds passed with this message
+	struct {
+		int32_t num; // N of /dev/uioN
+		uint32_t reserved;
+		uint64_t addr; // base address of its map0
+	} uio[PHANTOMD_FDS_PER_MSG];
+} phantomd_reply_t;
+
+
 
 /*
  * public functions prototype
  */
-void reg_write(void *reg_base, phantom_address_t, phantom_data_t);
+void reg_write(void *, phantom_address_t, phantom_data_t);
 phantom_data_t reg_read(void *, phantom_address_t);
+void reg_write_block(void *, phantom_address_t, const void *, uint32_t);
+void reg_read_block(void *, phantom_address_t, void *, uint32_t);
 int get_file_str(char*, char*);
 int fpga_config_reset();
 int fpga_reset(uint8_t);
-int map_component(phantom_ip_t *);
-int open_devs(void);
-void close_devs(void);
-void unmap_devs(void);
+int map_component(phantom_context_t *, phantom_ip_t *);
+int uio_irq_enable(int);
+int uio_irq_wait(int, int);
+int open_devs(phantom_context_t *);
+int open_ip_devs(phantom_context_t *, phantom_ip_t *);
+void close_devs(phantom_context_t *);
+void free_devs(phantom_context_t *);
+void unmap_devs(phantom_context_t *);
+void lease_close(phantom_context_t *);
+mem_pool_t *mem_pool_create(void *, phantom_address_t, uint32_t);
+void mem_pool_destroy(mem_pool_t *);
+void *mem_pool_alloc(mem_pool_t *, uint32_t);
+void mem_pool_free(mem_pool_t *, void *);
+void mem_pool_get_stats(mem_pool_t *, phantom_mem_stats_t *);
+void *map_mem_cached(phantom_address_t, uint32_t);
+int cache_maintenance_supported(void);
+void cache_clean_range(const void *, uint32_t);
+void cache_flush_range(const void *, uint32_t);
+void cache_barrier(void);
+int snapshot_load(phantom_conf_t *, const char *, const char *);
+int snapshot_save(phantom_conf_t *, const char *, const char *);
+int snapshot_load_fd(phantom_conf_t *, int);
+int snapshot_create_fd(phantom_conf_t *, const char *);
+int uio_add_opened(phantom_context_t *, int, phantom_address_t, int);
+int fpga_configure(const char *);
+int daemon_attach(phantom_context_t *);
+int daemon_configure(void);
+int daemon_recv_request(int);
+int daemon_send_status(int, int);
+int daemon_send_context(int, phantom_context_t *, int);
+
+
+
+/*
+ * Map an IP on its first access in lazy mode. The flag is read without the context lock; it is
+ * only set once all the IP's mappings are in place.
+ */
+static inline int ip_ensure_mapped(phantom_ip_t *ip)
+{
+	if(__builtin_expect(__atomic_load_n(&ip->mapped, __ATOMIC_ACQUIRE), 1))
+		return PHANTOM_OK;
+	return phantom_fpga_ip_map(ip);
+}
+
+
+
+/*
+ * Accessors for the user data windows of the slaves. Inline so API calls do not pay a call through
+ * the PLT for every register access; reg_write() and reg_read() are the out-of-line equivalents.
+ */
+static inline void reg_write_data(void *reg_base, phantom_address_t offset, phantom_data_t value)
+{
+	*((volatile phantom_data_t *)(reg_base + offset)) = value;
+}
+
+
+
+static inline phantom_data_t reg_read_data(void *reg_base, phantom_address_t offset)
+{
+	return *((volatile phantom_data_t *)(reg_base + offset));
+}
+
+
+
+/*
+ * Control register accessors. HLS control registers, devcfg and the SLCR are 32 bits wide on every
+ * platform, so must not be accessed as phantom_data_t, which is 64 bits on the ZynqMP; a 64 bit
+ * write to IER would also write ISR, which is toggle-on-write.
+ */
+static inline void reg_write32(void *reg_base, phantom_address_t offset, uint32_t value)
+{
+	*((volatile uint32_t *)(reg_base + offset)) = value;
+}
+
+
+
+static inline uint32_t reg_read32(void *reg_base, phantom_address_t offset)
+{
+	return *((volatile uint32_t *)(reg_base + offset));
+}
 
 
 
@@ -0,0 +1,80 @@
+/*
+ * File:         phantom_api_private.h
+ *
+ * Project:      PHANTOM
+ *
+ * Organisation: University of York
+ *
+ * Author(s):    PHANTOM team
+ *
+ * Version:      0.11 (dev only)
+ *
+ * Description:  Internals of the API context, shared by the library's sources and phantomd. Not
+ *               installed, so phantom_context_t stays opaque to applications and its layout can
+ *               change without breaking them.
+ *
+ * Copyright:    University of York. 2026.
+ *
+ * Legal:        All rights reserved. No warranty, explicit or implicit, provided.
+ *
+ * Revisions:
+ *
+ *
+*/
+
+
+
+
+#ifndef _PHANTOM_API_PRIVATE_H
+#define _PHANTOM_API_PRIVATE_H
+
+
+
+#include "phantom_api_lowlevel.h"
+
+
+
+/* a uio node found in sysfs, opened when first mapped */
+typedef struct {
+	int fd;
+	uint8_t flags;
+	int num; // N of /dev/uioN
+	phantom_address_t addr; // base address of its map0
+} uio_struct_t;
+
+/* per IP wait state, see phantom_fpga_ip_wait_done() */
+typedef struct {
+	phantom_wait_policy_t policy;
+	uint64_t start_ns; // when the IP was last started, if not sleeping
+	phantom_wait_stats_t stats;
+} ip_wait_t;
+
+/*
+ * Everything the API knows about one FPGA design: the parsed configuration with its IPs, the uio
+ * nodes backing their mappings, indexed by address, and the per IP wait state. ip_lock serialises
+ * the read-modify-write sequences on an IP's control registers; lock guards the rest of the context.
+ */
+struct phantom_context {
+	phantom_conf_t conf;
+	uio_struct_t *uio; // uio nodes in the order found
+	int num_uio;
+	int max_uio; // entries allocated in uio
+	uint32_t *uio_index; // hash of map0 address to entry + 1 in uio, 0 if empty
+	int uio_index_bits; // uio_index has 1 << uio_index_bits entries
+	int dev_timeout_ms; // wait for the uio nodes in phantom_context_initialise(), negative waits forever
+	phantom_map_mode_t map_mode;
+	int use_daemon; // attach to phantomd, if it is running, in phantom_context_initialise()
+	int event_fd;
+	int initialised; // cleared by phantom_terminate(), lazy mapping fails until initialised again
+	uint32_t num_ip_state; // entries in the per IP arrays below, one per IP of conf
+	ip_wait_t *ip_wait;
+	pthread_mutex_t *ip_lock;
+	pthread_mutex_t lock;
+	void *lease_block; // node wide lease block, mapped on first lease
+	int *lease_slot; // each IP's slot in the lease block, -1 until looked up
+	phantom_lease_t *lease_held; // lease held by this context, 0 if none
+};
+
+
+
+#endif /* _PHANTOM_API_PRIVATE_H */
@@ -0,0 +1,334 @@
+/*
+ * File:         phantom_api_ring.c
+ *
+ * Project:      PHANTOM
+ *
+ * Organisation: University of York
+ *
+ * Author(s):    PHANTOM team
+ *
+ * Version:      0.11 (dev only)
+ *
+ * Description:  Continuous mode. A free-running (auto-restarting) IP core consumes a ring of job
+ *               descriptors in the IP's shared memory. The host produces descriptors by advancing
+ *               the ring's head index and the core completes them by advancing its tail index, so
+ *               steady-state jobs need no register accesses at all.
+ *
+ * Copyright:    University of York. 2026.
+ *
+ * Legal:        All rights reserved. No warranty, explicit or implicit, provided.
+ *
+ * Revisions:
+ *
+ * Notes:        Ring layout, at the physical address written to the core's ring pointer register:
+ *                  RING_HEAD_OFFSET       head, descriptors produced (host writes)
+ *                  RING_TAIL_OFFSET       tail, descriptors completed (core writes)
+ *                  RING_NUM_DESCS_OFFSET  number of descriptors, a power of 2
+ *                  RING_DESC_SIZE_OFFSET  bytes per descriptor
+ *                  RING_DESC_OFFSET       the descriptors, slot = index & (number - 1)
+ *               Indices run freely and wrap at 2^32. On each invocation the core reads head and
+ *               tail, and if they differ processes descriptor tail, writing any results back in to
+ *               it, then stores tail + 1. The host sets autorestart and starts the core only when
+ *               it pushes in to a stopped ring, and clears autorestart only when the ring drains.
+ *
+ *
+*/
+
+
+
+#include "phantom_api.h"
+#include "phantom_api_lowlevel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+struct phantom_ring {
+	phantom_ip_t *ip;
+	volatile uint8_t *mem; // ring header and descriptors in the IP's shared memory
+	volatile uint32_t *head;
+	volatile uint32_t *tail;
+	uint32_t mask;
+	uint32_t desc_size;
+	uint32_t reserved; // descriptors handed out by phantom_fpga_ring_reserve(), not yet pushed
+	uint32_t head_seq; // host copy of head
+	uint32_t done_seq; // completed descriptors handed out by phantom_fpga_ring_get_done()
+	uint32_t free_seq; // completed descriptors released
+	int running; // autorestart set by the host
+};
+
+
+
+static inline volatile uint8_t *ring_desc(phantom_ring_t *r, uint32_t seq)
+{
+	return r->mem + RING_DESC_OFFSET + (seq & r->mask) * r->desc_size;
+}
+
+
+
+static inline uint32_t ring_tail(phantom_ring_t *r)
+{
+	return __atomic_load_n(r->tail, __ATOMIC_ACQUIRE);
+}
+
+
+
+/*
+ * Opens continuous mode on the specified IP. The ring is allocated from the IP's shared memory and
+ * its physical address written to the core's ring_ptr_reg register.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    num_descs (uint32_t) – Number of descriptors, a power of 2 of at least 2.
+ *    desc_size (uint32_t) – Bytes per descriptor, a multiple of 4.
+ *    ring_ptr_reg (phantom_address_t) – s0 offset of the core's ring pointer argument.
+ * Returns the ring, or NULL on failure.
+ *
+ */
+phantom_ring_t *phantom_fpga_ring_open(phantom_ip_t *ip, const uint32_t num_descs, const uint32_t desc_size, const phantom_address_t ring_ptr_reg)
+{
+	phantom_ring_t *r;
+	void *mem;
+
+	if((ip == NULL) || (num_descs < 2) || (num_descs & (num_descs - 1)) || (desc_size == 0) || (desc_size & 3))
+		return NULL;
+	if(ip_ensure_mapped(ip) || (ip->s0_vmem_base == NULL) || (ring_ptr_reg >= ip->s0_axi_address_size))
+		return NULL;
+	if((uint64_t) num_descs * desc_size > RING_MAX_SIZE)
+		return NULL;
+	if((ip->m0_cache & (MEM_CACHED | MEM_COHERENT)) == MEM_CACHED)
+	{
+		#ifdef DEBUG
+			printf("error: %s shared memory is cached and not coherent, a ring needs it uncached\n", ip->idstring);
+		#endif
+		return NULL; // the head and tail are polled by both sides without cache maintenance
+	}
+	if((mem = phantom_fpga_mem_alloc(ip, RING_DESC_OFFSET + num_descs * desc_size)) == NULL)
+		return NULL;
+	if((r = calloc(1, sizeof(phantom_ring_t))) == NULL)
+	{
+		phantom_fpga_mem_free(ip, mem);
+		return NULL;
+	}
+	r->ip = ip;
+	r->mem = mem;
+	r->head = (volatile uint32_t *)(r->mem + RING_HEAD_OFFSET);
+	r->tail = (volatile uint32_t *)(r->mem + RING_TAIL_OFFSET);
+	r->mask = num_descs - 1;
+	r->desc_size = desc_size;
+
+	*r->head = 0;
+	*r->tail = 0;
+	*(volatile uint32_t *)(r->mem + RING_NUM_DESCS_OFFSET) = num_descs;
+	*(volatile uint32_t *)(r->mem + RING_DESC_SIZE_OFFSET) = desc_size;
+	__sync_synchronize();
+	phantom_fpga_ip_set(ip, ring_ptr_reg, phantom_fpga_mem_get_phys(ip, mem), 0);
+
+	return r;
+}
+
+
+
+/*
+ * Returns the next free descriptor for the host to fill. Publish it with phantom_fpga_ring_push().
+ * Several descriptors may be reserved before pushing them together.
+ * Parameters
+ *    r (phantom_ring_t*) – The ring.
+ * Returns the descriptor, or NULL if the ring is full.
+ *
+ */
+void *phantom_fpga_ring_reserve(phantom_ring_t *r)
+{
+	uint32_t seq = r->head_seq + r->reserved;
+
+	if(seq - r->free_seq > r->mask)
+		return NULL; // slot still holds a descriptor not yet released
+	r->reserved++;
+	return (void *) ring_desc(r, seq);
+}
+
+
+
+/*
+ * Publishes all reserved descriptors to the core by advancing head. If the ring is stopped the
+ * core is set to auto-restart and started; otherwise no register is touched.
+ * Parameters
+ *    r (phantom_ring_t*) – The ring.
+ * Returns PHANTOM_OK, or PHANTOM_FALSE if nothing was reserved.
+ *
+ */
+int phantom_fpga_ring_push(phantom_ring_t *r)
+{
+	if(r->reserved == 0)
+		return PHANTOM_FALSE;
+
+	r->head_seq += r->reserved;
+	r->reserved = 0;
+	__atomic_store_n(r->head, r->head_seq, __ATOMIC_RELEASE); // descriptors are visible before head
+
+	if(!r->running)
+	{
+		/* set autorestart first: a core still finishing its last pass then restarts by itself */
+		phantom_fpga_ip_set_autorestart(r->ip);
+		if(phantom_fpga_ip_is_idle(r->ip) == PHANTOM_OK)
+			phantom_fpga_ip_start(r->ip);
+		r->running = 1;
+	}
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Returns the oldest descriptor completed by the core, with any results it wrote back.
+ * Release it with phantom_fpga_ring_release(). When every pushed descriptor has completed the
+ * core's autorestart is cleared, so an idle ring costs no memory traffic.
+ * Parameters
+ *    r (phantom_ring_t*) – The ring.
+ * Returns the descriptor, or NULL if none has completed.
+ *
+ */
+void *phantom_fpga_ring_get_done(phantom_ring_t *r)
+{
+	uint32_t tail = ring_tail(r);
+
+	if(r->running && (tail == r->head_seq))
+	{
+		phantom_fpga_ip_clear_autorestart(r->ip);
+		r->running = 0;
+	}
+	if(r->done_seq == tail)
+		return NULL;
+	return (void *) ring_desc(r, r->done_seq++);
+}
+
+
+
+/*
+ * Releases the oldest descriptor returned by phantom_fpga_ring_get_done() for reuse.
+ * Parameters
+ *    r (phantom_ring_t*) – The ring.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR if none is held.
+ *
+ */
+int phantom_fpga_ring_release(phantom_ring_t *r)
+{
+	if(r->free_seq == r->done_seq)
+		return PHANTOM_ERROR;
+	r->free_seq++;
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Returns the number of pushed descriptors the core has not completed yet.
+ */
+uint32_t phantom_fpga_ring_pending(phantom_ring_t *r)
+{
+	return r->head_seq - ring_tail(r);
+}
+
+
+
+/*
+ * Blocks until the core has completed a descriptor not yet returned by phantom_fpga_ring_get_done().
+ * The core's done interrupt is slept on if it has one, otherwise the tail is polled every RING_CLOSE_POLL_US.
+ * Parameters
+ *    r (phantom_ring_t*) – The ring.
+ *    timeout_ms (int) – The maximum time to wait in milliseconds, or a negative value to wait forever.
+ * Returns PHANTOM_OK if a descriptor is done, PHANTOM_FALSE on timeout or if nothing is pending.
+ *
+ */
+int phantom_fpga_ring_wait(phantom_ring_t *r, const int timeout_ms)
+{
+	const struct timespec poll = {0, RING_CLOSE_POLL_US * 1000L};
+	struct timespec t0, now;
+	int elapsed_ms = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while(ring_tail(r) == r->done_seq)
+	{
+		if(r->done_seq == r->head_seq)
+			return PHANTOM_FALSE; // nothing pending
+		if((timeout_ms >= 0) && (elapsed_ms >= timeout_ms))
+			return PHANTOM_FALSE;
+
+		/* each auto-restarted pass raises ap_done, so the done interrupt paces the tail checks;
+		   without an interrupt this returns at once and the tail is polled with a sleep between reads */
+		if(phantom_fpga_ip_wait_done(r->ip, (timeout_ms < 0) ? RING_WAIT_SLICE_MS : timeout_ms - elapsed_ms) == PHANTOM_ERROR)
+			nanosleep(&poll, NULL);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed_ms = (now.tv_sec - t0.tv_sec) * 1000 + (now.tv_nsec - t0.tv_nsec) / 1000000;
+	}
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Sleep until cond(r) holds or the deadline, if any, passes.
+ * Returns PHANTOM_OK, or PHANTOM_FALSE on timeout.
+ */
+static int ring_sleep_until(phantom_ring_t *r, int (*cond)(phantom_ring_t *), const int timeout_ms, const struct timespec *t0)
+{
+	const struct timespec poll = {0, RING_CLOSE_POLL_US * 1000L};
+	struct timespec now;
+
+	while(!cond(r))
+	{
+		if(timeout_ms >= 0)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if((now.tv_sec - t0->tv_sec) * 1000 + (now.tv_nsec - t0->tv_nsec) / 1000000 >= timeout_ms)
+				return PHANTOM_FALSE;
+		}
+		nanosleep(&poll, NULL);
+	}
+	return PHANTOM_OK;
+}
+
+
+
+static int ring_drained(phantom_ring_t *r)
+{
+	return ring_tail(r) == r->head_seq;
+}
+
+
+
+static int ring_core_idle(phantom_ring_t *r)
+{
+	return phantom_fpga_ip_is_idle(r->ip) == PHANTOM_OK;
+}
+
+
+
+/*
+ * Closes continuous mode, waiting for pushed descriptors to complete first, and frees the ring.
+ * Parameters
+ *    r (phantom_ring_t*) – The ring, may be NULL.
+ *    timeout_ms (int) – The maximum time to wait in milliseconds, or a negative value to wait forever.
+ * Returns PHANTOM_OK if the ring was closed, or PHANTOM_FALSE on timeout, in which case the ring is
+ * left open, as the core may still access it, and close may be called again.
+ *
+ */
+int phantom_fpga_ring_close(phantom_ring_t *r, const int timeout_ms)
+{
+	struct timespec t0;
+
+	if(r == NULL)
+		return PHANTOM_OK;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(ring_sleep_until(r, ring_drained, timeout_ms, &t0) != PHANTOM_OK)
+		return PHANTOM_FALSE;
+	phantom_fpga_ip_clear_autorestart(r->ip);
+	r->running = 0;
+	if(ring_sleep_until(r, ring_core_idle, timeout_ms, &t0) != PHANTOM_OK)
+		return PHANTOM_FALSE;
+	phantom_fpga_mem_free(r->ip, (void *) r->mem);
+	free(r);
+	return PHANTOM_OK;
+}
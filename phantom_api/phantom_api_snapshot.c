@@ -0,0 +1,388 @@
+/*
+ * File:         phantom_api_snapshot.c
+ *
+ * Project:      PHANTOM
+ *
+ * Organisation: University of York
+ *
+ * Author(s):    PHANTOM team
+ *
+ * Version:      0.11 (dev only)
+ *
+ * Description:  Configuration snapshots. The downloaded design's XML configuration is compiled once
+ *               in to a binary snapshot next to it, which later processes map and copy from instead
+ *               of parsing the XML.
+ *
+ * Copyright:    University of York. 2026.
+ *
+ * Legal:        All rights reserved. No warranty, explicit or implicit, provided.
+ *
+ * Revisions:
+ *
+ * Notes:        The snapshot, SD_CARD_PHANTOM_FPGA_SNAPSHOT_FILE, is a header followed by the platform
+ *               strings, the interrupt controllers and one fixed size record per component, all of
+ *               fixed width types so it reads the same on 32 and 64-bit builds. The header records
+ *               the size and modification time of the XML it was compiled from, and a checksum over
+ *               everything after the checksum field. A snapshot that fails any check is ignored, and
+ *               the XML is parsed and a new snapshot written in its place. Snapshots are written to
+ *               a temporary file and renamed, so a reader never sees a partial one. phantomd hands
+ *               its clients the same snapshot in a sealed memory file instead.
+ *
+ *
+*/
+
+
+
+#include "phantom_api.h"
+#include "phantom_api_lowlevel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+
+
+typedef struct {
+	char ipname[MAX_XMLTXT_LEN];
+	char idstring[MAX_XMLTXT_LEN];
+	char uio_slave[MAX_XMLTXT_LEN];
+	char uio_master[MAX_XMLTXT_LEN];
+	uint64_t s0_axi_base_address;
+	uint64_t s1_axi_base_address;
+	uint64_t m0_axi_base_address;
+	uint32_t s0_axi_address_size;
+	uint32_t s1_axi_address_size;
+	uint32_t m0_axi_address_size;
+	uint32_t id;
+	uint32_t num_axi_masters;
+	uint32_t reserved;
+} snapshot_comp_t;
+
+
+typedef struct {
+	char name[MAX_XMLTXT_LEN];
+	char ipname[MAX_XMLTXT_LEN];
+	uint64_t reg_addr;
+	uint32_t id;
+	uint32_t irq_port;
+} snapshot_intc_t;
+
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size; // of the whole snapshot
+	uint32_t checksum; // over everything after this field
+	int64_t xml_size;
+	int64_t xml_mtime_sec;
+	int64_t xml_mtime_nsec;
+	uint32_t num_comps;
+	uint32_t num_intcs;
+	char platform[MAX_XMLTXT_LEN];
+	char fpga_type[MAX_XMLTXT_LEN];
+	char fpga_device[MAX_XMLTXT_LEN];
+	char design[MAX_XMLTXT_LEN];
+	char bitfile[MAX_XMLTXT_LEN];
+	snapshot_intc_t intc[MAX_PHANTOM_INTCS];
+	snapshot_comp_t comp[];
+} snapshot_t;
+
+
+
+/*
+ * 32-bit FNV-1a hash of len bytes.
+ */
+static uint32_t snapshot_checksum(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint32_t h = 0x811c9dc5;
+
+	while(len--)
+		h = (h ^ *p++) * 0x01000193;
+	return h;
+}
+
+
+
+static uint32_t snapshot_body_checksum(const snapshot_t *snap)
+{
+	size_t start = offsetof(snapshot_t, checksum) + sizeof(snap->checksum);
+
+	return snapshot_checksum((const uint8_t *) snap + start, snap->size - start);
+}
+
+/*
+ * Map the snapshot open on fd and check its header.
+ * Returns the snapshot, to be unmapped by the caller, or NULL if it is not a valid snapshot.
+ */
+static const snapshot_t *snapshot_map(int fd)
+{
+	struct stat snap_st;
+	const snapshot_t *snap;
+
+	if(fstat(fd, &snap_st) || (snap_st.st_size < (off_t) sizeof(snapshot_t)))
+		return NULL;
+	snap = mmap(NULL, snap_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(snap == MAP_FAILED)
+		return NULL;
+
+	if((snap->magic != SNAPSHOT_MAGIC) || (snap->version != SNAPSHOT_VERSION) || (snap->size != snap_st.st_size) ||
+	   (snap->num_comps > (snap_st.st_size - sizeof(snapshot_t)) / sizeof(snapshot_comp_t)) || (snap->num_intcs > MAX_PHANTOM_INTCS) ||
+	   (snap->size != sizeof(snapshot_t) + snap->num_comps * sizeof(snapshot_comp_t)))
+	{
+		#ifdef DEBUG
+			printf("error: invalid configuration snapshot\n");
+		#endif
+		munmap((void *) snap, snap_st.st_size);
+		return NULL;
+	}
+	return snap;
+}
+
+
+
+/*
+ * Fill a configuration from a mapped snapshot, once its checksum is verified.
+ * Returns 0 if conf was filled, -1 if the snapshot is corrupt or out of memory.
+ */
+static int snapshot_copy(phantom_conf_t *conf, const snapshot_t *snap)
+{
+	if(snap->checksum != snapshot_body_checksum(snap))
+	{
+		#ifdef DEBUG
+			printf("error: configuration snapshot is corrupt\n");
+		#endif
+		return -1;
+	}
+
+	phantom_conf_clear(conf);
+	memcpy(conf->fpga_board, snap->platform, MAX_XMLTXT_LEN);
+	memcpy(conf->fpga_type, snap->fpga_type, MAX_XMLTXT_LEN);
+	memcpy(conf->fpga_device, snap->fpga_device, MAX_XMLTXT_LEN);
+	memcpy(conf->design_name, snap->design, MAX_XMLTXT_LEN);
+	memcpy(conf->design_bitfile, snap->bitfile, MAX_XMLTXT_LEN);
+	for(uint32_t i = 0; i < snap->num_comps; i++)
+	{
+		const snapshot_comp_t *c = &snap->comp[i];
+		phantom_comp_str_t *str;
+		phantom_ip_t *ip;
+
+		if(phantom_conf_add_comp(conf) < 0)
+			return -1;
+		ip = &conf->comp[i];
+		str = &conf->comp_str[i];
+		memcpy(str->ipname, c->ipname, MAX_XMLTXT_LEN);
+		memcpy(str->idstring, c->idstring, MAX_XMLTXT_LEN);
+		memcpy(str->uio_slave, c->uio_slave, MAX_XMLTXT_LEN);
+		memcpy(str->uio_master, c->uio_master, MAX_XMLTXT_LEN);
+		str->ipname[MAX_XMLTXT_LEN - 1] = '\0';
+		str->idstring[MAX_XMLTXT_LEN - 1] = '\0';
+		str->uio_slave[MAX_XMLTXT_LEN - 1] = '\0';
+		str->uio_master[MAX_XMLTXT_LEN - 1] = '\0';
+		ip->id = c->id;
+		ip->num_axi_masters = (uint8_t) c->num_axi_masters;
+		ip->s0_axi_base_address = (phantom_address_t) c->s0_axi_base_address;
+		ip->s0_axi_address_size = c->s0_axi_address_size;
+		ip->s1_axi_base_address = (phantom_address_t) c->s1_axi_base_address;
+		ip->s1_axi_address_size = c->s1_axi_address_size;
+		ip->m0_axi_base_address = (phantom_address_t) c->m0_axi_base_address;
+		ip->m0_axi_address_size = c->m0_axi_address_size;
+	}
+	for(uint32_t i = 0; i < snap->num_intcs; i++)
+	{
+		phantom_intc_t *intc = &conf->intc[i];
+
+		memcpy(intc->name, snap->intc[i].name, MAX_XMLTXT_LEN);
+		memcpy(intc->ipname, snap->intc[i].ipname, MAX_XMLTXT_LEN);
+		intc->name[MAX_XMLTXT_LEN - 1] = '\0';
+		intc->ipname[MAX_XMLTXT_LEN - 1] = '\0';
+		intc->id = snap->intc[i].id;
+		intc->irq_port = snap->intc[i].irq_port;
+		intc->reg_addr = (phantom_address_t) snap->intc[i].reg_addr;
+	}
+	conf->num_intcs = (uint8_t) snap->num_intcs;
+	return phantom_conf_index(conf);
+}
+
+
+
+/*
+ * Load a configuration from the snapshot of the given XML file, if it is valid and up to date.
+ * Returns 0 if conf was filled, -1 if the snapshot is missing, stale or corrupt.
+ */
+int snapshot_load(phantom_conf_t *conf, const char *xml_file, const char *snap_file)
+{
+	struct stat xml_st;
+	const snapshot_t *snap;
+	int fd, ret = -1;
+
+	if(stat(xml_file, &xml_st))
+		return -1;
+	if((fd = open(snap_file, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	snap = snapshot_map(fd);
+	close(fd);
+	if(snap == NULL)
+		return -1;
+
+	if((snap->xml_size == xml_st.st_size) && (snap->xml_mtime_sec == xml_st.st_mtim.tv_sec) && (snap->xml_mtime_nsec == xml_st.st_mtim.tv_nsec))
+		ret = snapshot_copy(conf, snap); // else stale
+	munmap((void *) snap, snap->size);
+	return ret;
+}
+
+
+
+/*
+ * Load a configuration from a snapshot passed as an open file, e.g. by phantomd, which has
+ * already checked it against the XML.
+ * Returns 0 if conf was filled, -1 if the snapshot is invalid or corrupt.
+ */
+int snapshot_load_fd(phantom_conf_t *conf, int fd)
+{
+	const snapshot_t *snap;
+	int ret;
+
+	if((snap = snapshot_map(fd)) == NULL)
+		return -1;
+	ret = snapshot_copy(conf, snap);
+	munmap((void *) snap, snap->size);
+	return ret;
+}
+
+
+
+/*
+ * Build the snapshot of a configuration parsed from the XML file described by xml_st.
+ * Returns the snapshot, to be freed by the caller, or NULL on fail.
+ */
+static snapshot_t *snapshot_build(phantom_conf_t *conf, const struct stat *xml_st)
+{
+	snapshot_t *snap;
+	uint32_t size = sizeof(snapshot_t) + conf->num_comps * sizeof(snapshot_comp_t);
+
+	if(conf->num_intcs > MAX_PHANTOM_INTCS)
+		return NULL;
+	if((snap = calloc(1, size)) == NULL)
+		return NULL;
+
+	snap->magic = SNAPSHOT_MAGIC;
+	snap->version = SNAPSHOT_VERSION;
+	snap->size = size;
+	snap->xml_size = xml_st->st_size;
+	snap->xml_mtime_sec = xml_st->st_mtim.tv_sec;
+	snap->xml_mtime_nsec = xml_st->st_mtim.tv_nsec;
+	snap->num_comps = conf->num_comps;
+	snap->num_intcs = conf->num_intcs;
+	memcpy(snap->platform, conf->fpga_board, MAX_XMLTXT_LEN);
+	memcpy(snap->fpga_type, conf->fpga_type, MAX_XMLTXT_LEN);
+	memcpy(snap->fpga_device, conf->fpga_device, MAX_XMLTXT_LEN);
+	memcpy(snap->design, conf->design_name, MAX_XMLTXT_LEN);
+	memcpy(snap->bitfile, conf->design_bitfile, MAX_XMLTXT_LEN);
+	for(uint32_t i = 0; i < conf->num_comps; i++)
+	{
+		snapshot_comp_t *c = &snap->comp[i];
+		phantom_ip_t *ip = &conf->comp[i];
+
+		memcpy(c->ipname, conf->comp_str[i].ipname, MAX_XMLTXT_LEN);
+		memcpy(c->idstring, conf->comp_str[i].idstring, MAX_XMLTXT_LEN);
+		memcpy(c->uio_slave, conf->comp_str[i].uio_slave, MAX_XMLTXT_LEN);
+		memcpy(c->uio_master, conf->comp_str[i].uio_master, MAX_XMLTXT_LEN);
+		c->id = ip->id;
+		c->num_axi_masters = ip->num_axi_masters;
+		c->s0_axi_base_address = ip->s0_axi_base_address;
+		c->s0_axi_address_size = ip->s0_axi_address_size;
+		c->s1_axi_base_address = ip->s1_axi_base_address;
+		c->s1_axi_address_size = ip->s1_axi_address_size;
+		c->m0_axi_base_address = ip->m0_axi_base_address;
+		c->m0_axi_address_size = ip->m0_axi_address_size;
+	}
+	for(uint32_t i = 0; i < conf->num_intcs; i++)
+	{
+		memcpy(snap->intc[i].name, conf->intc[i].name, MAX_XMLTXT_LEN);
+		memcpy(snap->intc[i].ipname, conf->intc[i].ipname, MAX_XMLTXT_LEN);
+		snap->intc[i].id = conf->intc[i].id;
+		snap->intc[i].irq_port = conf->intc[i].irq_port;
+		snap->intc[i].reg_addr = conf->intc[i].reg_addr;
+	}
+	snap->checksum = snapshot_body_checksum(snap);
+	return snap;
+}
+
+
+
+/*
+ * Write the snapshot of a configuration parsed from the given XML file. Failure is not an error
+ * for the caller, e.g. on a read-only SD card; the XML is simply parsed again next time.
+ * Returns 0 on success, -1 on fail.
+ */
+int snapshot_save(phantom_conf_t *conf, const char *xml_file, const char *snap_file)
+{
+	char tmp_file[PATH_MAX];
+	struct stat xml_st;
+	snapshot_t *snap;
+	int fd, ret = -1;
+
+	if(stat(xml_file, &xml_st))
+		return -1;
+	if((snap = snapshot_build(conf, &xml_st)) == NULL)
+		return -1;
+
+	snprintf(tmp_file, PATH_MAX, "%s.%d", snap_file, (int) getpid());
+	if((fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) >= 0)
+	{
+		if((write(fd, snap, snap->size) == (ssize_t) snap->size) && !fsync(fd))
+			ret = 0;
+		close(fd);
+		if(!ret && rename(tmp_file, snap_file))
+			ret = -1;
+		if(ret)
+			unlink(tmp_file);
+	}
+	#ifdef DEBUG
+		if(ret)
+			printf("error: unable to write configuration snapshot %s\n", snap_file);
+	#endif
+	free(snap);
+	return ret;
+}
+
+
+
+/*
+ * Write the snapshot of a configuration parsed from the given XML file to an anonymous, sealed
+ * memory file, for phantomd to pass to its clients. The seals stop any client changing it.
+ * Returns the file descriptor, or -1 on fail.
+ */
+int snapshot_create_fd(phantom_conf_t *conf, const char *xml_file)
+{
+	struct stat xml_st;
+	snapshot_t *snap;
+	int fd;
+
+	if(stat(xml_file, &xml_st))
+		return -1;
+	if((snap = snapshot_build(conf, &xml_st)) == NULL)
+		return -1;
+	if((fd = (int) syscall(SYS_memfd_create, "phantom_conf", MFD_CLOEXEC | MFD_ALLOW_SEALING)) >= 0)
+	{
+		if((write(fd, snap, snap->size) != (ssize_t) snap->size) ||
+		   fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL))
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	#ifdef DEBUG
+		if(fd < 0)
+			perror("error: unable to create configuration snapshot");
+	#endif
+	free(snap);
+	return fd;
+}
@@ -0,0 +1,347 @@
+/*
+ * File:         phantom_api_stream.c
+ *
+ * Project:      PHANTOM
+ *
+ * Organisation: University of York
+ *
+ * Author(s):    PHANTOM team
+ *
+ * Version:      0.11 (dev only)
+ *
+ * Description:  Multi-buffered streaming for IP cores with AXI masters. Two or more input/output
+ *               buffer sets are kept in the IP's shared memory and cycled, so the CPU fills the next
+ *               input and drains the last output while the core processes the set in between.
+ *
+ * Copyright:    University of York. 2026.
+ *
+ * Legal:        All rights reserved. No warranty, explicit or implicit, provided.
+ *
+ * Revisions:
+ *
+ * Notes:        Sets pass through fill -> ready -> running -> done -> drain in order, so the state
+ *               of the stream is five sequence counters. The core's buffer pointer registers are
+ *               programmed for the next ready set as soon as the running set has been started, and
+ *               the next set is started as soon as the running one is seen done. The core must
+ *               latch its pointer arguments when started, as Vivado HLS cores do.
+ *
+ *
+*/
+
+
+
+#include "phantom_api.h"
+#include "phantom_api_lowlevel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+typedef struct {
+	void *in;
+	void *out;
+	phantom_address_t in_phys;
+	phantom_address_t out_phys;
+	uint64_t fill_ns; // when handed out for filling, or started on the core
+	uint64_t drain_ns; // when handed out for draining
+} stream_set_t;
+
+
+struct phantom_stream {
+	phantom_ip_t *ip;
+	phantom_address_t in_ptr_reg;
+	phantom_address_t out_ptr_reg;
+	uint32_t num_sets;
+	uint32_t fill_seq; // sets handed out by phantom_fpga_stream_get_input()
+	uint32_t ready_seq; // sets submitted
+	uint32_t programmed_seq; // sets whose pointers are in the core's registers
+	uint32_t run_seq; // sets started
+	uint32_t done_seq; // sets completed
+	uint32_t drain_seq; // sets handed out by phantom_fpga_stream_get_output()
+	uint32_t free_seq; // sets released
+	uint64_t start_ns; // start of the running set
+	uint64_t first_start_ns;
+	phantom_stream_stats_t stats;
+	stream_set_t sets[];
+};
+
+
+static const struct timespec stream_poll = {0, STREAM_POLL_US * 1000L};
+
+
+
+static uint64_t stream_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+
+/*
+ * Program the core's pointer registers for the next ready set, if there is one.
+ */
+static void stream_program_next(phantom_stream_t *s)
+{
+	stream_set_t *set;
+
+	if((s->programmed_seq != s->run_seq) || (s->programmed_seq == s->ready_seq))
+		return;
+	set = &s->sets[s->programmed_seq % s->num_sets];
+	phantom_fpga_ip_set(s->ip, s->in_ptr_reg, set->in_phys, 0);
+	if(set->out != NULL)
+		phantom_fpga_ip_set(s->ip, s->out_ptr_reg, set->out_phys, 0);
+	s->programmed_seq++;
+}
+
+
+
+/*
+ * Start the next ready set if the core is idle, then program the pointers of the one after it
+ * so they are in place when this one completes.
+ */
+static void stream_kick(phantom_stream_t *s)
+{
+	if((s->run_seq != s->done_seq) || (s->run_seq == s->ready_seq))
+		return; // core busy, or nothing to run
+
+	stream_program_next(s);
+	s->start_ns = stream_now_ns();
+	if(s->run_seq == 0)
+		s->first_start_ns = s->start_ns;
+	phantom_fpga_ip_start(s->ip);
+	s->run_seq++;
+
+	stream_program_next(s);
+}
+
+
+
+/*
+ * Opens a stream on the specified IP. Each buffer set holds one input and, if out_size is not 0,
+ * one output buffer, allocated from the IP's shared memory. For every set the core is given the
+ * physical address of the input buffer in the in_ptr_reg register and of the output buffer in
+ * the out_ptr_reg register of its s0 slave, then started.
+ * Parameters
+ *    ip (phantom_ip_t*) – The IP core.
+ *    num_sets (uint32_t) – Number of buffer sets, at least 2.
+ *    in_size (uint32_t) – Bytes per input buffer.
+ *    out_size (uint32_t) – Bytes per output buffer, 0 if the core writes no output buffer.
+ *    in_ptr_reg (phantom_address_t) – s0 offset of the core's input pointer argument.
+ *    out_ptr_reg (phantom_address_t) – s0 offset of the core's output pointer argument.
+ * Returns the stream, or NULL on failure.
+ *
+ */
+phantom_stream_t *phantom_fpga_stream_open(phantom_ip_t *ip, const uint32_t num_sets, const uint32_t in_size, const uint32_t out_size,
+		const phantom_address_t in_ptr_reg, const phantom_address_t out_ptr_reg)
+{
+	phantom_stream_t *s;
+
+	if((ip == NULL) || ip_ensure_mapped(ip) || (ip->mem_pool == NULL) || (num_sets < 2) || (num_sets > STREAM_MAX_SETS) || (in_size == 0))
+		return NULL;
+	if((in_ptr_reg >= ip->s0_axi_address_size) || (out_ptr_reg >= ip->s0_axi_address_size))
+		return NULL;
+	if((s = calloc(1, sizeof(phantom_stream_t) + num_sets * sizeof(stream_set_t))) == NULL)
+		return NULL;
+	s->ip = ip;
+	s->in_ptr_reg = in_ptr_reg;
+	s->out_ptr_reg = out_ptr_reg;
+	s->num_sets = num_sets;
+
+	for(uint32_t i = 0; i < num_sets; i++)
+	{
+		stream_set_t *set = &s->sets[i];
+		if((set->in = phantom_fpga_mem_alloc(ip, in_size)) == NULL)
+			goto fail;
+		set->in_phys = phantom_fpga_mem_get_phys(ip, set->in);
+		if(out_size != 0)
+		{
+			if((set->out = phantom_fpga_mem_alloc(ip, out_size)) == NULL)
+				goto fail;
+			set->out_phys = phantom_fpga_mem_get_phys(ip, set->out);
+		}
+	}
+	return s;
+
+fail:
+	#ifdef DEBUG
+		printf("error: unable to allocate stream buffers for %s\n", ip->idstring);
+	#endif
+	phantom_fpga_stream_close(s, 0); // nothing has been started yet
+	return NULL;
+}
+
+
+
+/*
+ * Returns the input buffer of the next free set for the CPU to fill. Must be followed by
+ * phantom_fpga_stream_submit() before the next call.
+ * Parameters
+ *    s (phantom_stream_t*) – The stream.
+ * Returns the input buffer, or NULL if every set is submitted or still held for draining.
+ *
+ */
+void *phantom_fpga_stream_get_input(phantom_stream_t *s)
+{
+	stream_set_t *set;
+
+	if((s->fill_seq != s->ready_seq) || (s->fill_seq - s->free_seq == s->num_sets))
+		return NULL;
+	set = &s->sets[s->fill_seq++ % s->num_sets];
+	set->fill_ns = stream_now_ns();
+	return set->in;
+}
+
+
+
+/*
+ * Submits the set filled since phantom_fpga_stream_get_input(). It is started at once if the core
+ * is idle, otherwise its pointers are programmed while the core works on the running set.
+ * Parameters
+ *    s (phantom_stream_t*) – The stream.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR if no set was being filled.
+ *
+ */
+int phantom_fpga_stream_submit(phantom_stream_t *s)
+{
+	stream_set_t *set;
+
+	if(s->fill_seq == s->ready_seq)
+		return PHANTOM_ERROR;
+	set = &s->sets[s->ready_seq++ % s->num_sets];
+	s->stats.fill_ns += stream_now_ns() - set->fill_ns;
+
+	stream_kick(s);
+	stream_program_next(s);
+
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Returns the output buffer of the oldest submitted set, waiting for the core to complete it if
+ * needed. As soon as the core is seen done the next submitted set is started, so the CPU drains
+ * this output while the core runs. Release the set with phantom_fpga_stream_release().
+ * Parameters
+ *    s (phantom_stream_t*) – The stream.
+ *    timeout_ms (int) – The maximum time to wait in milliseconds, or a negative value to wait forever.
+ * Returns the output buffer (the input buffer if the stream has no outputs), or NULL on timeout
+ * or if no set is submitted.
+ *
+ */
+void *phantom_fpga_stream_get_output(phantom_stream_t *s, const int timeout_ms)
+{
+	stream_set_t *set;
+	uint64_t t0, now;
+	int ret;
+
+	if(s->drain_seq == s->done_seq)
+	{
+		if(s->run_seq == s->done_seq)
+			return NULL; // nothing running
+
+		t0 = stream_now_ns();
+		if((ret = phantom_fpga_ip_is_done(s->ip)) != PHANTOM_OK)
+		{
+			ret = phantom_fpga_ip_wait_done(s->ip, timeout_ms);
+			if(ret == PHANTOM_ERROR)
+			{
+				/* core has no interrupt, fall back to polling it with a sleep between reads */
+				while(((ret = phantom_fpga_ip_is_done(s->ip)) != PHANTOM_OK) && ((timeout_ms < 0) || (stream_now_ns() - t0 < timeout_ms * 1000000ULL)))
+					nanosleep(&stream_poll, NULL);
+			}
+			if(ret != PHANTOM_OK)
+				return NULL;
+		}
+		now = stream_now_ns();
+		s->stats.wait_ns += now - t0;
+		s->stats.fpga_ns += now - s->start_ns;
+		s->stats.elapsed_ns = now - s->first_start_ns;
+		s->stats.num_frames++;
+		s->done_seq++;
+
+		stream_kick(s);
+	}
+
+	set = &s->sets[s->drain_seq++ % s->num_sets];
+	set->drain_ns = stream_now_ns();
+	return (set->out != NULL) ? set->out : set->in;
+}
+
+
+
+/*
+ * Releases the oldest set returned by phantom_fpga_stream_get_output() for refilling.
+ * Parameters
+ *    s (phantom_stream_t*) – The stream.
+ * Returns PHANTOM_OK, or PHANTOM_ERROR if no set is being drained.
+ *
+ */
+int phantom_fpga_stream_release(phantom_stream_t *s)
+{
+	if(s->free_seq == s->drain_seq)
+		return PHANTOM_ERROR;
+	s->stats.drain_ns += stream_now_ns() - s->sets[s->free_seq++ % s->num_sets].drain_ns;
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Copies the stream's timings. Times are in ns. overlap_pct is the percentage of the core's busy
+ * time during which the CPU was doing other work rather than waiting for it.
+ * Parameters
+ *    s (phantom_stream_t*) – The stream.
+ *    stats (phantom_stream_stats_t*) – The struct to fill.
+ * Returns PHANTOM_OK.
+ *
+ */
+int phantom_fpga_stream_get_stats(phantom_stream_t *s, phantom_stream_stats_t *stats)
+{
+	*stats = s->stats;
+	stats->overlap_pct = 0;
+	if((stats->fpga_ns != 0) && (stats->wait_ns < stats->fpga_ns))
+		stats->overlap_pct = (uint32_t)(100 - (100 * stats->wait_ns) / stats->fpga_ns);
+	return PHANTOM_OK;
+}
+
+
+
+/*
+ * Closes a stream and frees its buffers. Any running set is waited for first, sleeping between checks.
+ * Parameters
+ *    s (phantom_stream_t*) – The stream, may be NULL.
+ *    timeout_ms (int) – The maximum time to wait in milliseconds, or a negative value to wait forever.
+ * Returns PHANTOM_OK if the stream was closed, or PHANTOM_FALSE on timeout, in which case the stream
+ * is left open, as the core may still access its buffers, and close may be called again.
+ *
+ */
+int phantom_fpga_stream_close(phantom_stream_t *s, const int timeout_ms)
+{
+	uint64_t t0;
+
+	if(s == NULL)
+		return PHANTOM_OK;
+	if(s->run_seq != s->done_seq)
+	{
+		t0 = stream_now_ns();
+		while(phantom_fpga_ip_is_idle(s->ip) != PHANTOM_OK)
+		{
+			if((timeout_ms >= 0) && (stream_now_ns() - t0 >= timeout_ms * 1000000ULL))
+				return PHANTOM_FALSE;
+			nanosleep(&stream_poll, NULL);
+		}
+	}
+	for(uint32_t i = 0; i < s->num_sets; i++)
+	{
+		phantom_fpga_mem_free(s->ip, s->sets[i].in);
+		phantom_fpga_mem_free(s->ip, s->sets[i].out);
+	}
+	free(s);
+	return PHANTOM_OK;
+}
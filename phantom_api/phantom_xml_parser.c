@@ -7,7 +7,7 @@
  *
  * Author(s):    A. Moulds
  *
- * Version:      0.11 (dev release only)
+ * Version:      0.13 (dev release only)
  *
  * Description:
  *
@@ -21,6 +21,14 @@
  * 				1. Corrected behaviour of get_linestr().
  * 				2. fixed bug in get_phantom_component().
  *
+ * 		0.12	Changes
+ * 				1. Replaced the line based parser, which rescanned the file for every
+ * 				   field, with a single pass tokenizer that reads the full schema.
+ *
+ * 		0.13	Changes
+ * 				1. Components are held in a growable registry, indexed by id, idstring
+ * 				   and ipname, in place of the fixed array of MAX_PHANTOM_COMPONENTS.
+ *
  *
 */
 
@@ -32,464 +40,667 @@
 #include "phantom_xml_parser.h"
 
 
-/* static globals */
-static phantom_ip_t ph_comp[MAX_PHANTOM_COMPONENTS+1];
-static char ph_comp_name[MAX_PHANTOM_COMPONENTS][MAX_XMLTXT_LEN];
-static char ph_comp_idstring[MAX_PHANTOM_COMPONENTS][MAX_XMLTXT_LEN];
-static phantom_platform_info_t ph_platform_info;
-static char ph_fpga_type[MAX_XMLTXT_LEN];
-static char ph_fpga_device[MAX_XMLTXT_LEN];
-static char ph_fpga_board[MAX_XMLTXT_LEN];
-static char ph_design_name[MAX_XMLTXT_LEN];
-static char ph_design_bitfile[MAX_XMLTXT_LEN];
-uint8_t no_of_ph_comps = 0;
-    
+/* elements the parser knows, XML_TAG_OTHER for any other */
+typedef enum {
+    XML_TAG_OTHER, XML_TAG_PHANTOM_FPGA, XML_TAG_FPGA_TYPE, XML_TAG_TARGET_DEVICE, XML_TAG_TARGET_BOARD,
+    XML_TAG_DESIGN_NAME, XML_TAG_DESIGN_BITFILE, XML_TAG_COMPONENT_INST, XML_TAG_INTC_INST, XML_TAG_NAME,
+    XML_TAG_ID, XML_TAG_IPNAME, XML_TAG_NUM_MASTERS, XML_TAG_SLAVE_BASE_0, XML_TAG_SLAVE_RANGE_0,
+    XML_TAG_SLAVE_BASE_1, XML_TAG_SLAVE_RANGE_1, XML_TAG_MASTER_BASE_0, XML_TAG_MASTER_RANGE_0,
+    XML_TAG_UIO_NAME_SLAVE, XML_TAG_UIO_NAME_MASTER, XML_TAG_IRQ_PORT, XML_TAG_REG_ADDR, XML_NUM_TAGS
+} xml_tag_t;
+
+static const char *xml_tag_names[XML_NUM_TAGS] = {
+    "", "phantom_fpga", "fpga_type", "target_device", "target_board",
+    "design_name", "design_bitfile", "component_inst", "interrupt_ctrl_inst", "name",
+    "id", "ipname", "num_masters", "slave_addr_base_0", "slave_addr_range_0",
+    "slave_addr_base_1", "slave_addr_range_1", "master_addr_base_0", "master_addr_range_0",
+    "uio_name_slave", "uio_name_master", "irq_port", "reg_addr"
+};
+
+
+/* where the tokenizer is in the markup */
+typedef enum {
+    XML_IN_TEXT, XML_IN_TAG_OPEN, XML_IN_START_TAG, XML_IN_ATTRS, XML_IN_END_TAG,
+    XML_IN_HEADER, XML_IN_DECL, XML_IN_COMMENT
+} xml_state_t;
+
+
+/* parser state, carried across reads of the file */
+typedef struct {
+    phantom_conf_t *conf;
+    xml_state_t state;
+    char tag[MAX_XMLTAG_LEN]; // tag name being read
+    int tag_len;
+    char text[MAX_XMLTXT_LEN]; // text of the innermost element
+    int text_len;
+    char header[MAXLINELEN]; // <? ?> header being read
+    int header_len;
+    char quote; // quote character while inside an attribute value
+    char prev; // previous character of a tag
+    int dashes; // '-' characters just read, to find the end of a comment
+    int self_closing;
+    int depth;
+    char stack_name[MAX_XML_DEPTH][MAX_XMLTAG_LEN];
+    xml_tag_t stack_tag[MAX_XML_DEPTH];
+    int version_found;
+    int root_found;
+    int root_closed;
+    int comp_idx; // component_inst being read, -1 if none
+    phantom_intc_t *intc; // interrupt_ctrl_inst being read
+} xml_parser_t;
+
 
 /* private functions prototype */
-static ssize_t get_linestr(FILE*, char*);
-static int get_datastr(char*, char*);
-static int is_xml_header(char*, const char*, int, char*);
-static int find_xml_header(FILE*, const char*, int, char*);
-static int check_for_version(FILE*, const char*);
-static int is_xml_tag(const char*, const char*, int);
-static char *get_element_text(char*);
-static int get_phantom_comp(FILE*, phantom_ip_t*);
+static xml_tag_t xml_lookup_tag(const char*);
+static void xml_copy_text(char*, const xml_parser_t*);
+static int xml_header(xml_parser_t*);
+static int xml_start_element(xml_parser_t*);
+static int xml_end_element(xml_parser_t*);
+static int xml_parse(xml_parser_t*, const char*, size_t);
 
 
 
-static ssize_t get_linestr(FILE *fp, char *str)
+static xml_tag_t xml_lookup_tag(const char *name)
 {
-    char *line=NULL;
-    size_t len = 0;
-    ssize_t nread;  
-  
-    memset(str,'\0', MAXLINELEN);
-    nread = getline(&line, &len, fp);
-    if(nread == -1)
-        return -1;
-    strncpy(str, line, nread);
-    free(line); 
-    return nread;
+    int i;
+
+    for(i = 1; i < XML_NUM_TAGS; i++)
+        if((name[0] == xml_tag_names[i][0]) && !strcmp(name, xml_tag_names[i]))
+            return (xml_tag_t) i;
+    return XML_TAG_OTHER;
 }
 
 
 
-static int get_datastr(char* sptr, char* datastr)
-{        
-    char *pf,*pb;
-    int len;
-  
-    pf=strchr(sptr, '\"');
-    pb=strchr(pf+1, '\"');
-    len = pb - pf - 1;
-    if (len < 1)
-        return -1;
-    memcpy(datastr, pf + 1, len);
-    return 0;
-    
+//
+// copy the text of the element just closed, at most MAX_XMLTXT_LEN - 1 chars.
+static void xml_copy_text(char *dst, const xml_parser_t *p)
+{
+    memcpy(dst, p->text, p->text_len + 1);
 }
 
 
 
-static int is_xml_header(char *str, const char *header, int len, char* datastr)
+//
+// handle a <? ?> header, checking the conf file version.
+static int xml_header(xml_parser_t *p)
 {
-    char *sptr;
-    
-    if((sptr = strstr(str, "<?")) == NULL)
-        return -1;
-    if((sptr = strstr(sptr, header)) == NULL)
-        return -1;
-    if(get_datastr(sptr, datastr))
+    char *pf, *pb;
+
+    p->header[p->header_len] = '\0';
+    if((pf = strstr(p->header, "phantom conf file version")) == NULL)
+        return 0;
+    if(((pf = strchr(pf, '\"')) == NULL) || ((pb = strchr(pf + 1, '\"')) == NULL) || (pb - pf - 1 < 1))
         return -1;
-    if((sptr = strstr(str, "?>")) == NULL)
+    if(strncmp(pf + 1, PHANTOM_CONF_VER, 3)) // note: just check first three chars in ver
         return -1;
-
+    p->version_found = 1;
     return 0;
 }
 
 
 
-static int find_xml_header(FILE* fp,const char *header, int len, char* datastr)
+static int xml_start_element(xml_parser_t *p)
 {
-    char str[MAXLINELEN];    
-    
-    while(get_linestr(fp, str) != -1)
+    xml_tag_t tag, parent;
+    phantom_conf_t *conf = p->conf;
+
+    p->tag[p->tag_len] = '\0';
+    if(p->root_closed)
+        return 0; // trailing markup after </phantom_fpga>
+    if(p->depth == MAX_XML_DEPTH)
     {
-        if(is_xml_header(str,header,len, datastr)==0)
-            return 0;
+        #ifdef DEBUG
+            printf("error in xml file - elements nested too deeply.\n");
+        #endif
+        return -1;
     }
-    return -1;
-}
+    tag = xml_lookup_tag(p->tag);
+    parent = (p->depth > 0) ? p->stack_tag[p->depth - 1] : XML_TAG_OTHER;
 
-
-
-static int check_for_version(FILE* fp, const char* ver)
-{
-    char data_str[MAXLINELEN];
-        
-    fseek(fp,0,SEEK_SET);
-        
-    if (find_xml_header(fp, "phantom conf file version", strlen("phantom conf file version"), data_str))
+    if(p->depth == 0)
+    {
+        if(tag != XML_TAG_PHANTOM_FPGA)
+        {
+            #ifdef DEBUG
+                printf("error in xml file - unable to find phantom_fpga tag.\n");
+            #endif
+            return -1;
+        }
+        if(!p->version_found)
+        {
+            #ifdef DEBUG
+                printf("error: incompatible xml format\n");
+            #endif
+            return -1;
+        }
+        p->root_found = 1;
+    }
+    else if((parent == XML_TAG_PHANTOM_FPGA) && (tag == XML_TAG_COMPONENT_INST))
     {
-        return -1;           
+        if((p->comp_idx = phantom_conf_add_comp(conf)) < 0)
+        {
+            #ifdef DEBUG
+                printf("error: unable to allocate components found in xml file.\n");
+            #endif
+            return -1;
+        }
     }
-    if (strncmp(data_str, ver, 3)) // note: just check first three chars in ver
+    else if((parent == XML_TAG_PHANTOM_FPGA) && (tag == XML_TAG_INTC_INST))
     {
-        return -1;            
+        if(conf->num_intcs == MAX_PHANTOM_INTCS)
+        {
+            #ifdef DEBUG
+                printf("error: too many interrupt controllers found in xml file.\n");
+            #endif
+            return -1;
+        }
+        p->intc = &conf->intc[conf->num_intcs++];
     }
-    
-    return 0;
-}
 
-
-
-static int is_xml_tag(const char *str,const char* tag, int len)
-{
-    char tmp[MAXLINELEN]; 
-    char *sptr;
- 
-    if((sptr = strchr(str,'<'))==NULL)
-        return -1;
-        sptr += 1;
-    if ((*sptr == '!')||(*sptr == '?')||(*sptr==' '))
-        return -1;
-    strcpy(tmp,tag);
-    strcat(tmp, ">"); 
-    return strncmp(sptr, tmp, len+1);
+    memcpy(p->stack_name[p->depth], p->tag, p->tag_len + 1);
+    p->stack_tag[p->depth++] = tag;
+    p->text_len = 0;
+    return 0;
 }
 
 
 
-static char *get_element_text(char* line)
+static int xml_end_element(xml_parser_t *p)
 {
-    char tmp[MAXLINELEN]; 
-    char *sptr1, *sptr2;
-    
-    strcpy(tmp, line);  
-    memset(line, '\0', MAXLINELEN);
- 
-    if((sptr1 = strchr(tmp, '>'))==NULL)
-        return '\0';
-        
-    sptr1++;
-    if((sptr2 = strchr(sptr1, '<'))==NULL)
-        return '\0';  
-    
-   return strncpy(line,sptr1, sptr2-sptr1);
-        
-}
-         
-            
-
-static int get_phantom_comp(FILE *fp, phantom_ip_t *ph_ip_ptr)
-{
-    char str[MAXLINELEN];      
-    long fp_start, fp_end;
-    int tag_found = 0;
-    int lineno = 0, i;
-    
-     fp_start = ftell(fp);
-     while(get_linestr(fp, str) != -1)
+    xml_tag_t tag, parent;
+    phantom_conf_t *conf = p->conf;
+    phantom_ip_t *comp;
+    phantom_comp_str_t *str;
+
+    p->tag[p->tag_len] = '\0';
+    if(p->root_closed)
+        return 0;
+    if((p->depth == 0) || strcmp(p->tag, p->stack_name[p->depth - 1]))
     {
-        if(!is_xml_tag(str,"/component_inst",strlen("/component_inst")))
-        {
-            tag_found = 1;
-            break;
-        } 
-        lineno += 1;
-    }  
-    if(!tag_found)
+        #ifdef DEBUG
+            printf("error in xml file - unexpected </%s> tag.\n", p->tag);
+        #endif
         return -1;
+    }
+    tag = p->stack_tag[--p->depth];
+    parent = (p->depth > 0) ? p->stack_tag[p->depth - 1] : XML_TAG_OTHER;
 
-    fp_end = ftell(fp);
-
+    while((p->text_len > 0) && (p->text[p->text_len - 1] <= ' '))
+        p->text_len--;
+    p->text[p->text_len] = '\0';
 
-    fseek(fp, fp_start,SEEK_SET);
-    for(i=0; i < lineno; i++)
+    if(parent == XML_TAG_PHANTOM_FPGA)
     {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"name",strlen("name")))
+        switch(tag)
         {
-            memcpy(ph_ip_ptr->idstring, get_element_text(str),MAX_XMLTXT_LEN);
-            break;
+            case XML_TAG_FPGA_TYPE: xml_copy_text(conf->fpga_type, p); break;
+            case XML_TAG_TARGET_DEVICE: xml_copy_text(conf->fpga_device, p); break;
+            case XML_TAG_TARGET_BOARD: xml_copy_text(conf->fpga_board, p); break;
+            case XML_TAG_DESIGN_NAME: xml_copy_text(conf->design_name, p); break;
+            case XML_TAG_DESIGN_BITFILE: xml_copy_text(conf->design_bitfile, p); break;
+            case XML_TAG_COMPONENT_INST: p->comp_idx = -1; break;
+            case XML_TAG_INTC_INST: p->intc = NULL; break;
+            default: break;
         }
     }
-
-    fseek(fp, fp_start,SEEK_SET);
-    for(i=0; i < lineno; i++)
+    else if((parent == XML_TAG_COMPONENT_INST) && (p->comp_idx >= 0))
     {
-        
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"ipname",strlen("ipname")))
+        comp = &conf->comp[p->comp_idx];
+        str = &conf->comp_str[p->comp_idx];
+        switch(tag)
         {
-           memcpy(ph_ip_ptr->ipname, get_element_text(str),MAX_XMLTXT_LEN);
-            break;
+            case XML_TAG_NAME: xml_copy_text(str->idstring, p); break;
+            case XML_TAG_IPNAME: xml_copy_text(str->ipname, p); break;
+            case XML_TAG_ID: comp->id = (uint32_t) strtoul(p->text, NULL, 0); break;
+            case XML_TAG_NUM_MASTERS: comp->num_axi_masters = (uint8_t) strtoul(p->text, NULL, 0); break;
+            case XML_TAG_SLAVE_BASE_0: comp->s0_axi_base_address = (phantom_address_t) strtoull(p->text, NULL, 0); break;
+            case XML_TAG_SLAVE_RANGE_0: comp->s0_axi_address_size = (uint32_t) strtoul(p->text, NULL, 0); break;
+            case XML_TAG_SLAVE_BASE_1: comp->s1_axi_base_address = (phantom_address_t) strtoull(p->text, NULL, 0); break;
+            case XML_TAG_SLAVE_RANGE_1: comp->s1_axi_address_size = (uint32_t) strtoul(p->text, NULL, 0); break;
+            case XML_TAG_MASTER_BASE_0: comp->m0_axi_base_address = (phantom_address_t) strtoull(p->text, NULL, 0); break;
+            case XML_TAG_MASTER_RANGE_0: comp->m0_axi_address_size = (uint32_t) strtoul(p->text, NULL, 0); break;
+            case XML_TAG_UIO_NAME_SLAVE: xml_copy_text(str->uio_slave, p); break;
+            case XML_TAG_UIO_NAME_MASTER: xml_copy_text(str->uio_master, p); break;
+            default: break;
         }
-         
-    } 
-    
-    fseek(fp, fp_start,SEEK_SET);
-    for(i=0; i < lineno; i++)
+    }
+    else if((parent == XML_TAG_INTC_INST) && (p->intc != NULL))
     {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"id",strlen("id")))
+        switch(tag)
         {
-            ph_ip_ptr->id = (uint32_t) strtoul(get_element_text(str), NULL, 0);
-            break;
+            case XML_TAG_NAME: xml_copy_text(p->intc->name, p); break;
+            case XML_TAG_IPNAME: xml_copy_text(p->intc->ipname, p); break;
+            case XML_TAG_ID: p->intc->id = (uint32_t) strtoul(p->text, NULL, 0); break;
+            case XML_TAG_IRQ_PORT: p->intc->irq_port = (uint32_t) strtoul(p->text, NULL, 0); break;
+            case XML_TAG_REG_ADDR: p->intc->reg_addr = (phantom_address_t) strtoull(p->text, NULL, 0); break;
+            default: break;
         }
-    }  
+    }
+    else if(tag == XML_TAG_PHANTOM_FPGA)
+        p->root_closed = 1;
 
-    fseek(fp, fp_start,SEEK_SET);
-    for(i=0; i < lineno; i++)
-    {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"slave_addr_base_0",strlen("slave_addr_base_0")))
-        {
-            ph_ip_ptr->s0_axi_base_address = (phantom_address_t) strtoul(get_element_text(str), NULL, 0);
-            break;
-        }
-    } 
+    p->text_len = 0;
+    return 0;
+}
 
-    fseek(fp, fp_start,SEEK_SET);
-    for(i=0; i < lineno; i++)
-    {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"slave_addr_base_1",strlen("slave_addr_base_1")))
-        {
-            ph_ip_ptr->s1_axi_base_address = (phantom_address_t) strtoul(get_element_text(str), NULL, 0);
-            break;
-        }
-    } 
-    
-    fseek(fp, fp_start,SEEK_SET);
-    for(i=0; i < lineno; i++)
+
+
+//
+// feed len bytes of the file through the tokenizer. Elements may span reads and lines.
+static int xml_parse(xml_parser_t *p, const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    char c;
+
+    for(; buf < end; buf++)
     {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"slave_addr_range_0",strlen("slave_addr_range_0")))
+        c = *buf;
+        switch(p->state)
         {
-            ph_ip_ptr->s0_axi_address_size = (uint32_t) strtoul(get_element_text(str), NULL, 0);
-            break;
+            case XML_IN_TEXT:
+                if(c == '<')
+                {
+                    p->state = XML_IN_TAG_OPEN;
+                    p->tag_len = 0;
+                }
+                else if((p->text_len < MAX_XMLTXT_LEN - 1) && ((p->text_len > 0) || (c > ' ')))
+                    p->text[p->text_len++] = c;
+                break;
+
+            case XML_IN_TAG_OPEN:
+                if(c == '?')
+                {
+                    p->state = XML_IN_HEADER;
+                    p->header_len = 0;
+                    p->prev = '\0';
+                }
+                else if(c == '!')
+                {
+                    p->state = XML_IN_DECL;
+                    p->dashes = 0;
+                }
+                else if(c == '/')
+                    p->state = XML_IN_END_TAG;
+                else
+                {
+                    p->state = XML_IN_START_TAG;
+                    p->self_closing = 0;
+                    p->tag[p->tag_len++] = c;
+                }
+                break;
+
+            case XML_IN_START_TAG:
+                if(c == '>')
+                {
+                    p->state = XML_IN_TEXT;
+                    if(xml_start_element(p))
+                        return -1;
+                }
+                else if((c <= ' ') || (c == '/'))
+                {
+                    p->state = XML_IN_ATTRS;
+                    p->quote = '\0';
+                    p->self_closing = (c == '/');
+                }
+                else if(p->tag_len < MAX_XMLTAG_LEN - 1)
+                    p->tag[p->tag_len++] = c;
+                break;
+
+            case XML_IN_ATTRS:
+                if(p->quote)
+                {
+                    if(c == p->quote)
+                        p->quote = '\0';
+                }
+                else if((c == '\"') || (c == '\''))
+                    p->quote = c;
+                else if(c == '>')
+                {
+                    p->state = XML_IN_TEXT;
+                    if(xml_start_element(p) || (p->self_closing && xml_end_element(p)))
+                        return -1;
+                }
+                else if(c > ' ')
+                    p->self_closing = (c == '/');
+                break;
+
+            case XML_IN_END_TAG:
+                if(c == '>')
+                {
+                    p->state = XML_IN_TEXT;
+                    if(xml_end_element(p))
+                        return -1;
+                }
+                else if((c > ' ') && (p->tag_len < MAX_XMLTAG_LEN - 1))
+                    p->tag[p->tag_len++] = c;
+                break;
+
+            case XML_IN_HEADER:
+                if((c == '>') && (p->prev == '?'))
+                {
+                    p->state = XML_IN_TEXT;
+                    p->header_len -= (p->header_len > 0);
+                    if(xml_header(p))
+                    {
+                        #ifdef DEBUG
+                            printf("error: incompatible xml format\n");
+                        #endif
+                        return -1;
+                    }
+                }
+                else if(p->header_len < MAXLINELEN - 1)
+                    p->header[p->header_len++] = c;
+                p->prev = c;
+                break;
+
+            case XML_IN_DECL:
+                // <!-- starts a comment, anything else such as <!DOCTYPE is skipped to its '>'
+                if((c == '-') && (p->dashes >= 0) && (++p->dashes == 2))
+                {
+                    p->state = XML_IN_COMMENT;
+                    p->dashes = 0;
+                }
+                else if(c == '>')
+                    p->state = XML_IN_TEXT;
+                else if(c != '-')
+                    p->dashes = -1;
+                break;
+
+            case XML_IN_COMMENT:
+                if((c == '>') && (p->dashes >= 2))
+                    p->state = XML_IN_TEXT;
+                else
+                    p->dashes = (c == '-') ? p->dashes + 1 : 0;
+                break;
         }
-    } 
+    }
+    return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////
+/*
+ * Function to reset a configuration to one with no components, before it is filled from the XML
+ * file or a configuration snapshot. The component arrays are kept for reuse.
+ * Parameters:
+ *    conf: configuration to clear.
+ */
+void phantom_conf_clear(phantom_conf_t *conf)
+{
+    //
+    // initialise memory for ph_platform_info struct.
+    memset(conf->fpga_type, '\0', MAX_XMLTXT_LEN);
+    memset(conf->fpga_device, '\0', MAX_XMLTXT_LEN);
+    memset(conf->fpga_board, '\0', MAX_XMLTXT_LEN);
+    memset(conf->design_name, '\0', MAX_XMLTXT_LEN);
+    memset(conf->design_bitfile, '\0', MAX_XMLTXT_LEN);
+    conf->platform_info.platform = conf->fpga_board;
+    conf->platform_info.fpga_type = conf->fpga_type;
+    conf->platform_info.fpga_device = conf->fpga_device;
+    conf->platform_info.design = conf->design_name;
+    conf->platform_info.bitfile = conf->design_bitfile;
+
+    //
+    // empty the registry; entries are initialised as they are added
+    conf->num_comps = 0;
+    if(conf->id_index != NULL)
+        memset(conf->id_index, 0, 3 * (conf->index_mask + 1) * sizeof(uint32_t));
+    memset(conf->intc, 0, sizeof(conf->intc));
+    conf->num_intcs = 0;
+}
+
 
-    fseek(fp, fp_start,SEEK_SET);
-    for(i=0; i < lineno; i++)
+
+////////////////////////////////////////////////////////////////////
+/*
+ * Function to free the component arrays and indexes of a configuration.
+ * Parameters:
+ *    conf: configuration to free.
+ */
+void phantom_conf_free(phantom_conf_t *conf)
+{
+    free(conf->comp);
+    free(conf->comp_str);
+    free(conf->id_index);
+    conf->comp = NULL;
+    conf->comp_str = NULL;
+    conf->id_index = conf->idstr_index = conf->name_index = conf->name_next = NULL;
+    conf->num_comps = conf->max_comps = conf->index_mask = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////
+/*
+ * Function to add an empty component to a configuration, growing the component arrays as
+ * needed. The ipname and idstring pointers are set by phantom_conf_index(), once every
+ * component is added and the arrays can no longer move.
+ * Parameters:
+ *    conf: configuration to add to.
+ * Return:
+ *    index of the new component, or -1 if out of memory.
+ */
+int phantom_conf_add_comp(phantom_conf_t *conf)
+{
+    phantom_ip_t *comp;
+    phantom_comp_str_t *comp_str;
+    uint32_t max_comps;
+
+    if(conf->num_comps == conf->max_comps)
     {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"slave_addr_range_1",strlen("slave_addr_range_1")))
-        {
-            ph_ip_ptr->s1_axi_address_size = (uint32_t) strtoul(get_element_text(str), NULL, 0);
-            break;
-        }
-    } 
+        max_comps = conf->max_comps ? 2 * conf->max_comps : CONF_MIN_COMPS;
+        if((comp = realloc(conf->comp, max_comps * sizeof(phantom_ip_t))) == NULL)
+            return -1;
+        conf->comp = comp;
+        if((comp_str = realloc(conf->comp_str, max_comps * sizeof(phantom_comp_str_t))) == NULL)
+            return -1;
+        conf->comp_str = comp_str;
+        conf->max_comps = max_comps;
+    }
+
+    comp = &conf->comp[conf->num_comps];
+    memset(comp, 0, sizeof(phantom_ip_t));
+    comp->s0_uio_fd = -1;
+    memset(&conf->comp_str[conf->num_comps], '\0', sizeof(phantom_comp_str_t));
+    return (int) conf->num_comps++;
+}
+
+
+
+static inline uint32_t conf_hash_id(uint32_t id)
+{
+    return id * 0x9e3779b1U;
+}
+
+
+
+static inline uint32_t conf_hash_str(const char *str)
+{
+    uint32_t h = 0x811c9dc5; // FNV-1a
+
+    while(*str)
+        h = (h ^ (uint8_t) *str++) * 0x01000193;
+    return h;
+}
+
+
+
+////////////////////////////////////////////////////////////////////
+/*
+ * Function to point each component at its strings and build the id, idstring and ipname
+ * indexes. Components are inserted last to first, so where several share a key the index
+ * holds the first, as the linear searches this replaces found, and each ipname chain runs in
+ * design order.
+ * Parameters:
+ *    conf: configuration to index.
+ * Return:
+ *    Zero on success, -1 if out of memory.
+ */
+int phantom_conf_index(phantom_conf_t *conf)
+{
+    uint32_t size = CONF_MIN_COMPS, h, *index;
+    int i;
 
-    fseek(fp, fp_start,SEEK_SET);
-    for(i=0; i < lineno; i++)
+    while(size < 2 * conf->num_comps)
+        size *= 2; // at most half full
+    if((index = realloc(conf->id_index, (3 * size + conf->max_comps) * sizeof(uint32_t))) == NULL)
+        return -1;
+    memset(index, 0, (3 * size + conf->max_comps) * sizeof(uint32_t));
+    conf->id_index = index;
+    conf->idstr_index = index + size;
+    conf->name_index = index + 2 * size;
+    conf->name_next = index + 3 * size;
+    conf->index_mask = size - 1;
+
+    for(i = (int) conf->num_comps - 1; i >= 0; i--)
     {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"num_masters",strlen("num_masters")))
-        {
-            ph_ip_ptr->num_axi_masters = (uint8_t) strtoul(get_element_text(str), NULL, 0);
-            break;
-        }
+        phantom_ip_t *comp = &conf->comp[i];
+
+        comp->ipname = conf->comp_str[i].ipname;
+        comp->idstring = conf->comp_str[i].idstring;
+
+        for(h = conf_hash_id(comp->id) & conf->index_mask; conf->id_index[h]; h = (h + 1) & conf->index_mask)
+            if(conf->comp[conf->id_index[h] - 1].id == comp->id)
+                break;
+        conf->id_index[h] = i + 1;
+
+        for(h = conf_hash_str(comp->idstring) & conf->index_mask; conf->idstr_index[h]; h = (h + 1) & conf->index_mask)
+            if(!strcmp(conf->comp[conf->idstr_index[h] - 1].idstring, comp->idstring))
+                break;
+        conf->idstr_index[h] = i + 1;
+
+        for(h = conf_hash_str(comp->ipname) & conf->index_mask; conf->name_index[h]; h = (h + 1) & conf->index_mask)
+            if(!strcmp(conf->comp[conf->name_index[h] - 1].ipname, comp->ipname))
+                break;
+        conf->name_next[i] = conf->name_index[h];
+        conf->name_index[h] = i + 1;
     }
-   
-    fseek(fp, fp_end, SEEK_SET);
-    return 0;    
+    return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////
+/*
+ * Functions to look up a component in the indexes built by phantom_conf_index().
+ * Parameters:
+ *    conf, and the id, idstring or ipname of the component.
+ * Return:
+ *    the first component with the key, or NULL if there is none.
+ */
+phantom_ip_t *phantom_conf_find_id(phantom_conf_t *conf, uint32_t id)
+{
+    uint32_t h;
+
+    if(conf->id_index == NULL)
+        return NULL;
+    for(h = conf_hash_id(id) & conf->index_mask; conf->id_index[h]; h = (h + 1) & conf->index_mask)
+        if(conf->comp[conf->id_index[h] - 1].id == id)
+            return &conf->comp[conf->id_index[h] - 1];
+    return NULL;
+}
+
+
+phantom_ip_t *phantom_conf_find_idstr(phantom_conf_t *conf, const char *idstr)
+{
+    uint32_t h;
+
+    if(conf->idstr_index == NULL)
+        return NULL;
+    for(h = conf_hash_str(idstr) & conf->index_mask; conf->idstr_index[h]; h = (h + 1) & conf->index_mask)
+        if(!strcmp(conf->comp[conf->idstr_index[h] - 1].idstring, idstr))
+            return &conf->comp[conf->idstr_index[h] - 1];
+    return NULL;
+}
+
+
+phantom_ip_t *phantom_conf_find_name(phantom_conf_t *conf, const char *ipname)
+{
+    uint32_t h;
+
+    if(conf->name_index == NULL)
+        return NULL;
+    for(h = conf_hash_str(ipname) & conf->index_mask; conf->name_index[h]; h = (h + 1) & conf->index_mask)
+        if(!strcmp(conf->comp[conf->name_index[h] - 1].ipname, ipname))
+            return &conf->comp[conf->name_index[h] - 1];
+    return NULL;
 }
 
 
 
 ////////////////////////////////////////////////////////////////////
 /*
- * Function to extract info from supplied XML file.
+ * Function to return the next component with the same ipname as ip, in design order.
+ * Parameters:
+ *    conf, ip: a component found by phantom_conf_find_name() or an earlier call.
+ * Return:
+ *    the next component, or NULL if ip is the last.
+ */
+phantom_ip_t *phantom_conf_next_name(phantom_conf_t *conf, phantom_ip_t *ip)
+{
+    uint32_t next = conf->name_next[ip - conf->comp];
+
+    return next ? &conf->comp[next - 1] : NULL;
+}
+
+
+
+////////////////////////////////////////////////////////////////////
+/*
+ * Function to extract info from supplied XML file. The file is read once, in fixed size
+ * blocks, through a tokenizer that fills conf as each element closes. The components are
+ * indexed once all are read.
  * Parameters:
  *    fp: File pointer to opened XML file.
- *    ph_comp_idx : pointer to integer to contain returned component count.
+ *    conf: configuration to fill.
  * Return:
  *    Zero on success.
  */ 
-int phantom_conf(FILE *fp)
+int phantom_conf(FILE *fp, phantom_conf_t *conf)
 {
-    char str[MAXLINELEN];  
-    int tag_found = 0;
-    fpos_t block_start;
-    int i, linecnt = 0;
-    int ph_comp_idx;
-
-    extern phantom_ip_t ph_comp[MAX_PHANTOM_COMPONENTS+1];
-    extern char ph_comp_name[MAX_PHANTOM_COMPONENTS][MAX_XMLTXT_LEN];
-    extern char ph_comp_idstring[MAX_PHANTOM_COMPONENTS][MAX_XMLTXT_LEN];
-    extern phantom_platform_info_t ph_platform_info;
-    extern char ph_fpga_type[MAX_XMLTXT_LEN];
-    extern char ph_fpga_device[MAX_XMLTXT_LEN];
-    extern char ph_fpga_board[MAX_XMLTXT_LEN];
-    extern char ph_design_name[MAX_XMLTXT_LEN];
-    extern char ph_design_bitfile[MAX_XMLTXT_LEN];
-    extern uint8_t no_of_ph_comps;
-    
-    //
-    // check opened xml file version is valid
-    if(check_for_version(fp, PHANTOM_CONF_VER))
-    {
-		#ifdef DEBUG
-    		printf("error: incompatible xml format\n");
-    	#endif
-        return -1;
-    }
+    char buf[XML_READ_LEN];
+    xml_parser_t parser;
+    size_t len;
 
-    //
-    // initialise static memory for ph_platform_info struct.
-    memset(ph_fpga_type, '\0', MAX_XMLTXT_LEN);
-    memset(ph_fpga_device, '\0', MAX_XMLTXT_LEN);
-    memset(ph_fpga_board, '\0', MAX_XMLTXT_LEN);
-    memset(ph_design_name, '\0', MAX_XMLTXT_LEN);
-    memset(ph_design_bitfile, '\0', MAX_XMLTXT_LEN);
-    ph_platform_info.platform = ph_fpga_board;
-    ph_platform_info.fpga_type = ph_fpga_type;
-    ph_platform_info.fpga_device = ph_fpga_device;
-    ph_platform_info.design = ph_design_name;
-    ph_platform_info.bitfile = ph_design_bitfile;
-        
-    //
-    // create and initialise static memory for phantom components 
-    for(i = 0; i < MAX_PHANTOM_COMPONENTS; i++)
+    phantom_conf_clear(conf);
+    memset(&parser, 0, sizeof(xml_parser_t));
+    parser.conf = conf;
+    parser.state = XML_IN_TEXT;
+    parser.comp_idx = -1;
+
+    fseek(fp, 0, SEEK_SET);
+    while((len = fread(buf, 1, XML_READ_LEN, fp)) > 0)
     {
-        memset(ph_comp_idstring[i], '\0', MAX_XMLTXT_LEN);
-        memset(ph_comp_name[i], '\0', MAX_XMLTXT_LEN);
-        ph_comp[i].idstring = (char *) &ph_comp_idstring[i];
-        ph_comp[i].ipname = (char *) &ph_comp_name[i];
-        ph_comp[i].id = 0;
-        ph_comp[i].num_axi_masters = 0;
-        ph_comp[i].s0_axi_address_size = 0;
-        ph_comp[i].s0_axi_base_address = 0;
-        ph_comp[i].s1_axi_address_size = 0;
-        ph_comp[i].s1_axi_base_address = 0;
-        ph_comp[i].s0_vmem_base = NULL;
-        ph_comp[i].s1_vmem_base = NULL;
+        if(xml_parse(&parser, buf, len))
+            return -1;
     }
 
     //
-    // determine range of lines in xmlfile for parent tag 'phantom_fpga'
-    fseek(fp, 0, SEEK_SET);
-    while(get_linestr(fp, str) != -1)
+    // check the file held a complete phantom_fpga block of a compatible version
+    if(!parser.version_found)
     {
-        //find parent 'phantom_fpga' tag
-        if(!is_xml_tag(str, "phantom_fpga", strlen("phantom_fpga")))
-        {
-            tag_found = 1;
-            fgetpos(fp, &block_start);
-            break;
-        }
+		#ifdef DEBUG
+    		printf("error: incompatible xml format\n");
+    	#endif
+        return -1;
     }
-    if(!tag_found)
+    if(!parser.root_found)
     {
 		#ifdef DEBUG
 			printf("error in xml file - unable to find phantom_fpga tag.\n");
 		#endif
     	return -1;
     }
-
-    tag_found = 0;
-    while(get_linestr(fp, str) != -1)
-    {
-        if(!is_xml_tag(str,"/phantom_fpga",strlen("/phantom_fpga")))
-        {
-            tag_found = 1;
-            break;
-        }
-        linecnt += 1;
-    }
-    if(!tag_found)
+    if(!parser.root_closed)
     {
 		#ifdef DEBUG
 			printf("error in xml file - unable to find /phantom_fpga tag.\n");
 		#endif
     	return -1;
     }
-       
-    //
-    // copy xml for platform fpga and design details.
-    fsetpos(fp,&block_start);
-    for(i=0; i < linecnt; i++)
-    {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"fpga_type", strlen("fpga_type")))
-        {
-           memcpy(ph_platform_info.fpga_type, get_element_text(str),MAX_XMLTXT_LEN);
-            break;
-        }
-    }
-    fsetpos(fp,&block_start);
-    for(i=0; i < linecnt; i++)
-    {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"target_device", strlen("target_device")))
-        {
-           memcpy(ph_platform_info.fpga_device, get_element_text(str),MAX_XMLTXT_LEN);
-            break;
-        }
-    }    
-    fsetpos(fp,&block_start);
-    for(i=0; i < linecnt; i++)
-    {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"target_board", strlen("target_board")))
-        {
-           memcpy(ph_platform_info.platform, get_element_text(str),MAX_XMLTXT_LEN);
-            break;
-        }
-    }
-    fsetpos(fp,&block_start);
-    for(i=0; i < linecnt; i++)
-    {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"design_name", strlen("design_name")))
-        {
-           memcpy(ph_platform_info.design, get_element_text(str),MAX_XMLTXT_LEN);
-            break;
-        }
-    }
-    fsetpos(fp,&block_start);
-    for(i=0; i < linecnt; i++)
-    {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"design_bitfile", strlen("design_bitfile")))
-        {
-           memcpy(ph_platform_info.bitfile, get_element_text(str),MAX_XMLTXT_LEN);
-            break;
-        }
-    }
-    
-    //
-    // now copy phantom component specs and fill structs
-    fsetpos(fp,&block_start);
-    ph_comp_idx = 0;
-    for(i=0; i < linecnt; i++)
-    {
-        get_linestr(fp, str);
-        if(!is_xml_tag(str,"component_inst",strlen("component_inst")))
-        {
-            if(get_phantom_comp(fp, &ph_comp[ph_comp_idx]))
-            {
-        		#ifdef DEBUG
-        			printf("error in xlm component_int group.\n");
-        		#endif
-            	return -1;
-            }
-            ph_comp_idx += 1;
-            if(ph_comp_idx > MAX_PHANTOM_COMPONENTS)
-            {
-        		#ifdef DEBUG
-        			printf("error: too many components found in xml file.\n");
-        		#endif
-            	return -1;
-            }
-        }
-    }
-
-    no_of_ph_comps = ph_comp_idx;
-    return 0;
+    return phantom_conf_index(conf);
 }
 
 
@@ -497,14 +708,13 @@ int phantom_conf(FILE *fp)
 /*
  * Function to return number of phantom component specified in xml file.
  * Parameters:
- *    None.
+ *    conf.
  * Return:
  *    number of phantom components
 */
-uint8_t inline get_phantom_component_count(void)
+uint32_t get_phantom_component_count(phantom_conf_t *conf)
 {
-	extern uint8_t no_of_ph_comps;
-    return no_of_ph_comps;
+    return conf->num_comps;
 }
 
 
@@ -513,15 +723,15 @@ uint8_t inline get_phantom_component_count(void)
  * Function to return phantom component, referenced from index obtained
  * during call to phantom_conf(). Note: 0 is first index value.
  * Parameters:
- *    idx.
+ *    conf, idx.
  * Return:
  *    struct detailing phantom component
 */ 
-phantom_ip_t inline *get_phantom_component(uint8_t idx)
+phantom_ip_t *get_phantom_component(phantom_conf_t *conf, uint32_t idx)
 {
-    if(idx < 0)
+    if(idx >= conf->num_comps)
        return NULL;
-    return  &ph_comp[idx];
+    return  &conf->comp[idx];
 }
 
 
@@ -530,21 +740,21 @@ phantom_ip_t inline *get_phantom_component(uint8_t idx)
 /*
  * Function to return phantom fpga platform information, loaded from conf xml. 
  * Parameters:
- *    None.
+ *    conf.
  * Return:
  *    struct detailing phantom target h/w
 */ 
-phantom_platform_info_t inline *get_phantom_platform_info(void)
+phantom_platform_info_t *get_phantom_platform_info(phantom_conf_t *conf)
 {
-    return &ph_platform_info;
+    return &conf->platform_info;
 }
 
 
 
 ////////////////////////////////////////////////////////////////////
-phantom_ip_t inline *get_phantom_component_array(void)
+phantom_ip_t *get_phantom_component_array(phantom_conf_t *conf)
 {
-    return ph_comp;
+    return conf->comp;
 }
 
 
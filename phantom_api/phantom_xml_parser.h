@@ -35,16 +35,74 @@
 
 
 #define PHANTOM_CONF_VER "0.1"
-#define MAXLINELEN 200 // max char length of single XML line
+#define MAXLINELEN 200 // max char length of an XML header
 #define MAX_XMLTXT_LEN 64 // max char length of XML element text
+#define MAX_XMLTAG_LEN 32 // max char length of an XML tag name
+#define MAX_XML_DEPTH 8 // max nesting of XML elements
+#define XML_READ_LEN 4096 // bytes of the XML file read at a time
+#define MAX_PHANTOM_INTCS 8 // max interrupt controller instances
+#define CONF_MIN_COMPS 16 // components allocated for at first, doubled as needed
+
+
+/* Interrupt controller instance from the conf xml. */
+typedef struct {
+	char name[MAX_XMLTXT_LEN];
+	char ipname[MAX_XMLTXT_LEN];
+	uint32_t id;
+	uint32_t irq_port;
+	phantom_address_t reg_addr;
+} phantom_intc_t;
+
+
+/* Strings of one component, kept apart from the phantom_ip_t array so that the fields used on
+   every access stay packed together. */
+typedef struct {
+	char ipname[MAX_XMLTXT_LEN];
+	char idstring[MAX_XMLTXT_LEN];
+	char uio_slave[MAX_XMLTXT_LEN]; // uio node names from the design, may be empty
+	char uio_master[MAX_XMLTXT_LEN];
+} phantom_comp_str_t;
+
+
+/* Configuration loaded from the conf xml, and the registry of its components. One is owned by
+   each phantom_context_t. Components are indexed by id, idstring and ipname in open addressed
+   hash tables of component index + 1, 0 if empty. The ipname index holds the first component
+   of each name, and name_next chains the rest in design order. */
+typedef struct {
+	phantom_ip_t *comp; // num_comps entries
+	phantom_comp_str_t *comp_str; // parallel to comp
+	uint32_t num_comps;
+	uint32_t max_comps; // entries allocated in comp and comp_str
+	uint32_t *id_index;
+	uint32_t *idstr_index;
+	uint32_t *name_index;
+	uint32_t *name_next; // next component with the same ipname + 1, 0 if last
+	uint32_t index_mask; // each index has index_mask + 1 entries
+	phantom_intc_t intc[MAX_PHANTOM_INTCS];
+	phantom_platform_info_t platform_info;
+	char fpga_type[MAX_XMLTXT_LEN];
+	char fpga_device[MAX_XMLTXT_LEN];
+	char fpga_board[MAX_XMLTXT_LEN];
+	char design_name[MAX_XMLTXT_LEN];
+	char design_bitfile[MAX_XMLTXT_LEN];
+	uint8_t num_intcs;
+} phantom_conf_t;
 
 
 /* function protortypes */
-uint8_t get_phantom_component_count(void);
-phantom_ip_t *get_phantom_component(uint8_t);
-int phantom_conf(FILE*);
-phantom_platform_info_t *get_phantom_platform_info(void);
-phantom_ip_t *get_phantom_component_array(void);
+uint32_t get_phantom_component_count(phantom_conf_t*);
+phantom_ip_t *get_phantom_component(phantom_conf_t*, uint32_t);
+int phantom_conf(FILE*, phantom_conf_t*);
+void phantom_conf_clear(phantom_conf_t*);
+void phantom_conf_free(phantom_conf_t*);
+int phantom_conf_add_comp(phantom_conf_t*);
+int phantom_conf_index(phantom_conf_t*);
+phantom_ip_t *phantom_conf_find_id(phantom_conf_t*, uint32_t);
+phantom_ip_t *phantom_conf_find_idstr(phantom_conf_t*, const char*);
+phantom_ip_t *phantom_conf_find_name(phantom_conf_t*, const char*);
+phantom_ip_t *phantom_conf_next_name(phantom_conf_t*, phantom_ip_t*);
+phantom_platform_info_t *get_phantom_platform_info(phantom_conf_t*);
+phantom_ip_t *get_phantom_component_array(phantom_conf_t*);
 
 
 #endif // SRC_PHANTOM_XML_PARSER_H_
@@ -0,0 +1,360 @@
+/*
+ * File:         phantomd.c
+ *
+ * Project:      PHANTOM
+ *
+ * Organisation: University of York
+ *
+ * Author(s):    PHANTOM team
+ *
+ * Version:      0.11 (dev only)
+ *
+ * Description:  Resident PHANTOM daemon. Holds the downloaded design's configuration and the uio
+ *               nodes of its IP cores open, and hands both to client processes over a Unix socket,
+ *               so phantom_initialise() in a client is one round trip. Configurations of the FPGA
+ *               requested by clients are carried out one at a time.
+ *
+ * Copyright:    University of York. 2026.
+ *
+ * Legal:        All rights reserved. No warranty, explicit or implicit, provided.
+ *
+ * Revisions:
+ *
+ * Notes:        Usage: phantomd [-c] [-d] [-g group] [-m mode] [-s socket]
+ *                 -c  configure the FPGA with the design's bitfile before serving clients.
+ *                 -d  run in the background.
+ *                 -g  give the socket to group rather than PHANTOM_ACCESS_GROUP.
+ *                 -m  give the socket the octal mode rather than PHANTOMD_SOCKET_MODE.
+ *                 -s  listen on socket rather than PHANTOMD_SOCKET_FILE. Clients always connect
+ *                     to PHANTOMD_SOCKET_FILE, so this is for testing.
+ *               Requests are served in turn from a single thread, which is what serialises
+ *               reconfiguration. The design is reloaded whenever its XML changes, e.g. after a
+ *               phantom_download(). See phantom_api_daemon.c for the messages.
+ *
+ *
+*/
+
+
+
+#include "phantom_api.h"
+#include "phantom_api_lowlevel.h"
+#include "phantom_api_private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <grp.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <sys/un.h>
+
+
+
+static volatile sig_atomic_t stop;
+
+static phantom_context_t *ctx; // the design, initialised in eager mode so every uio node is open
+static int loaded; // ctx initialised
+static int snap_fd = -1; // ctx's configuration snapshot, passed to clients
+static struct stat xml_st; // of the XML ctx was last loaded from, or failed to load from
+static struct timespec load_failed_at; // when the last load failed, zero if it did not
+
+
+
+static void on_signal(int sig)
+{
+	(void) sig;
+	stop = 1;
+}
+
+
+
+/*
+ * (Re)load the downloaded design: parse its configuration, open and map its IP cores' uio nodes,
+ * and build the snapshot passed to clients. The uio nodes are waited for up to dev_timeout_ms.
+ * Returns 0 on success, -1 on fail.
+ */
+static int load_design(const int dev_timeout_ms)
+{
+	loaded = 0;
+	if(snap_fd >= 0)
+		close(snap_fd);
+	snap_fd = -1;
+	phantom_context_destroy(ctx); // clients have their own open files of the nodes
+	if((ctx = phantom_context_create()) == NULL)
+		return -1;
+	phantom_context_set_use_daemon(ctx, 0);
+	phantom_context_set_dev_timeout(ctx, dev_timeout_ms);
+
+	if(stat(SD_CARD_PHANTOM_FPGA_CONF_FILE, &xml_st))
+		memset(&xml_st, 0, sizeof(xml_st));
+	if((xml_st.st_size == 0) || (phantom_context_initialise(ctx) != PHANTOM_OK) ||
+	   ((snap_fd = snapshot_create_fd(&ctx->conf, SD_CARD_PHANTOM_FPGA_CONF_FILE)) < 0))
+	{
+		fprintf(stderr, "phantomd: unable to load the design in %s\n", SD_CARD_PHANTOM_FPGA_CONF_FILE);
+		clock_gettime(CLOCK_MONOTONIC, &load_failed_at);
+		return -1;
+	}
+	memset(&load_failed_at, 0, sizeof(load_failed_at));
+	loaded = 1;
+	return 0;
+}
+
+
+
+/*
+ * Returns 1 if the design's XML has changed since it was last loaded, or failed to load, else 0.
+ */
+static int design_changed(void)
+{
+	struct stat st;
+
+	if(stat(SD_CARD_PHANTOM_FPGA_CONF_FILE, &st))
+		return xml_st.st_size != 0; // removed
+	return (st.st_size != xml_st.st_size) || (st.st_mtim.tv_sec != xml_st.st_mtim.tv_sec) || (st.st_mtim.tv_nsec != xml_st.st_mtim.tv_nsec);
+}
+
+
+
+/*
+ * Returns 1 if a load that failed should be tried again for an attach, i.e. the design's XML has
+ * changed since, or PHANTOMD_RETRY_MS has passed, else 0.
+ */
+static int load_retry_due(void)
+{
+	struct timespec now;
+
+	if(design_changed())
+		return 1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - load_failed_at.tv_sec) * 1000 + (now.tv_nsec - load_failed_at.tv_nsec) / 1000000 >= PHANTOMD_RETRY_MS;
+}
+
+
+
+/*
+ * Find the design's bitfile, from the loaded design if it is current, else by parsing only the
+ * design's configuration, from its snapshot if that is up to date. No uio node is opened.
+ * Returns 0 on success, -1 on fail.
+ */
+static int design_bitfile(char *bitfile)
+{
+	phantom_conf_t conf;
+	FILE *xml_fp;
+	int ret = -1;
+
+	if(loaded && !design_changed())
+	{
+		snprintf(bitfile, PATH_MAX, "%s%s", SD_CARD_PHANTOM_FPGA_BITFILE_LOC, ctx->conf.design_bitfile);
+		return (ctx->conf.design_bitfile[0] == '\0') ? -1 : 0;
+	}
+	memset(&conf, 0, sizeof(conf));
+	if(!snapshot_load(&conf, SD_CARD_PHANTOM_FPGA_CONF_FILE, SD_CARD_PHANTOM_FPGA_SNAPSHOT_FILE))
+		ret = 0;
+	else if((xml_fp = fopen(SD_CARD_PHANTOM_FPGA_CONF_FILE, "r")) != NULL)
+	{
+		ret = phantom_conf(xml_fp, &conf);
+		fclose(xml_fp);
+	}
+	if(!ret && (conf.design_bitfile[0] != '\0'))
+		snprintf(bitfile, PATH_MAX, "%s%s", SD_CARD_PHANTOM_FPGA_BITFILE_LOC, conf.design_bitfile);
+	else
+		ret = -1;
+	phantom_conf_free(&conf);
+	return ret;
+}
+
+
+
+/*
+ * Configure the FPGA with the design's bitfile. Only the design's configuration is needed to find
+ * it, so this works even if the design could not be loaded, e.g. before the FPGA is first
+ * configured. The IP cores' mappings stay valid across a reconfiguration.
+ * Returns the result, as phantom_fpga_configure().
+ */
+static int configure(void)
+{
+	char bitfile[PATH_MAX];
+	int ret;
+
+	if(design_bitfile(bitfile))
+		return PHANTOM_ERROR;
+	if((ret = fpga_configure(bitfile)) != PHANTOM_OK)
+		return ret;
+	return phantom_fpga_is_done();
+}
+
+
+
+/*
+ * Give the socket file the given mode and, if group is not empty, group. Connecting needs write
+ * access to the file, so this decides who may drive the IP cores through the daemon.
+ * Returns 0 on success, -1 on fail.
+ */
+static int set_socket_access(const char *sock_file, const mode_t mode, const char *group)
+{
+	struct group *gr;
+
+	if(group[0] != '\0')
+	{
+		if((gr = getgrnam(group)) == NULL)
+		{
+			fprintf(stderr, "phantomd: no group %s\n", group);
+			return -1;
+		}
+		if(chown(sock_file, -1, gr->gr_gid))
+		{
+			perror("phantomd: unable to set the socket's group");
+			return -1;
+		}
+	}
+	if(chmod(sock_file, mode))
+	{
+		perror("phantomd: unable to set the socket's mode");
+		return -1;
+	}
+	return 0;
+}
+
+
+
+static void serve(int sock)
+{
+	int ret;
+
+	switch(daemon_recv_request(sock))
+	{
+	case PHANTOMD_OP_ATTACH:
+		/* never wait for uio nodes here, the client would time out first */
+		if((!loaded && load_retry_due()) || (loaded && design_changed()))
+			load_design(0);
+		if(loaded)
+			daemon_send_context(sock, ctx, snap_fd);
+		else
+			daemon_send_status(sock, PHANTOM_ERROR); // the client loads the design itself
+		break;
+	case PHANTOMD_OP_CONFIGURE:
+		ret = configure();
+		daemon_send_status(sock, ret);
+		/* after the reply, as the design's uio nodes may only appear once the FPGA is configured */
+		if((ret == PHANTOM_OK) && (!loaded || design_changed()))
+			load_design(UIO_READY_TIMEOUT_MS);
+		break;
+	default:
+		daemon_send_status(sock, PHANTOM_ERROR);
+		break;
+	}
+}
+
+
+
+int main(int argc, char *argv[])
+{
+	const char *sock_file = PHANTOMD_SOCKET_FILE;
+	const char *group = PHANTOM_ACCESS_GROUP;
+	mode_t mode = PHANTOMD_SOCKET_MODE, old_mask;
+	char *end;
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	struct timeval tv = {PHANTOMD_TIMEOUT_MS / 1000, (PHANTOMD_TIMEOUT_MS % 1000) * 1000};
+	struct sigaction sa;
+	int opt, configure_first = 0, background = 0;
+	int listen_sock, sock;
+
+	while((opt = getopt(argc, argv, "cdg:m:s:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'c':
+			configure_first = 1;
+			break;
+		case 'd':
+			background = 1;
+			break;
+		case 'g':
+			group = optarg;
+			break;
+		case 'm':
+			mode = strtoul(optarg, &end, 8);
+			if((*end != '\0') || (mode & ~0777))
+			{
+				fprintf(stderr, "phantomd: invalid mode %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			sock_file = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c] [-d] [-g group] [-m mode] [-s socket]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(strlen(sock_file) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "phantomd: socket path %s is too long\n", sock_file);
+		return 1;
+	}
+	strcpy(addr.sun_path, sock_file);
+
+	/* refuse to take over the socket of a running daemon, but replace a stale one */
+	if((sock = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0)
+		return 1;
+	if(!connect(sock, (struct sockaddr *) &addr, sizeof(addr)))
+	{
+		fprintf(stderr, "phantomd: already running on %s\n", sock_file);
+		return 1;
+	}
+	close(sock);
+	unlink(sock_file);
+	old_mask = umask(0177); // no one else can connect before the socket's access is set
+	if(((listen_sock = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0) ||
+	   bind(listen_sock, (struct sockaddr *) &addr, sizeof(addr)) || listen(listen_sock, SOMAXCONN))
+	{
+		perror("phantomd: unable to listen");
+		return 1;
+	}
+	umask(old_mask);
+	if(set_socket_access(sock_file, mode, group))
+	{
+		unlink(sock_file);
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal; // no SA_RESTART, so accept() returns to see stop
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	if(background && daemon(0, 0))
+	{
+		perror("phantomd: unable to run in the background");
+		return 1;
+	}
+	if(configure_first && (configure() != PHANTOM_OK))
+		fprintf(stderr, "phantomd: unable to configure the FPGA\n");
+	load_design(UIO_READY_TIMEOUT_MS);
+
+	while(!stop)
+	{
+		if((sock = accept(listen_sock, NULL, NULL)) < 0)
+			continue;
+		/* a client that stops reading cannot hold up the others for long */
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		serve(sock);
+		close(sock);
+	}
+
+	close(listen_sock);
+	unlink(sock_file);
+	if(snap_fd >= 0)
+		close(snap_fd);
+	phantom_context_destroy(ctx);
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Async submission benchmark. Submits jobs to one IP from a number of threads through
+ * phantom_fpga_async_submit() and reports the completed jobs per second.
+ *
+ * Usage: async_bench <idstring> <threads> <jobs per thread>
+ * The IP is started with no arguments written, so it must be safe to run repeatedly as is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <phantom_api.h>
+#include "bench_util.h"
+
+
+static phantom_ip_t *ip;
+static int num_jobs;
+static unsigned long completed;
+
+
+static void job_done(phantom_job_t *job)
+{
+    (void) job;
+    __atomic_add_fetch(&completed, 1, __ATOMIC_RELAXED);
+}
+
+
+static void *submitter(void *arg)
+{
+    phantom_job_t *jobs = calloc(num_jobs, sizeof(phantom_job_t));
+
+    (void) arg;
+    if(jobs == NULL)
+        return NULL;
+    for(int i = 0; i < num_jobs; i++) {
+        jobs[i].callback = job_done;
+        phantom_fpga_async_submit(ip, &jobs[i], 1);
+    }
+    for(int i = 0; i < num_jobs; i++)
+        phantom_fpga_job_wait(&jobs[i], -1);
+    free(jobs);
+    return NULL;
+}
+
+
+int main(int argc, char *argv[]) {
+    pthread_t *threads;
+    int num_threads;
+    double t0, secs;
+
+    if(argc != 4) {
+        printf("usage: %s <idstring> <threads> <jobs per thread>\n", argv[0]);
+        return -1;
+    }
+    if(phantom_initialise() != PHANTOM_OK) {
+        printf("Error during initialise.\n");
+        return -1;
+    }
+    if((ip = phantom_fpga_get_ip_from_idstr(argv[1])) == NULL) {
+        printf("No IP core named %s.\n", argv[1]);
+        return -1;
+    }
+    num_threads = atoi(argv[2]);
+    num_jobs = atoi(argv[3]);
+    if(num_threads <= 0 || num_jobs <= 0 || (threads = calloc(num_threads, sizeof(pthread_t))) == NULL)
+        return -1;
+    if(phantom_fpga_async_open(ip, 0) != PHANTOM_OK) {
+        printf("Unable to open %s for async jobs.\n", argv[1]);
+        return -1;
+    }
+
+    t0 = now_s();
+    for(int i = 0; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, submitter, NULL);
+    for(int i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    secs = now_s() - t0;
+    printf("%lu jobs from %d threads in %.3f s: %.0f jobs/s\n", completed, num_threads, secs, completed / secs);
+
+    free(threads);
+    phantom_fpga_async_close(ip);
+    phantom_terminate();
+    return 0;
+}
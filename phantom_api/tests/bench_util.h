@@ -0,0 +1,51 @@
+/*
+ * Timing and statistics shared by the benchmarks.
+ */
+
+#ifndef BENCH_UTIL_H_
+#define BENCH_UTIL_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static inline double now_s(void)
+{
+    return now_ns() / 1e9;
+}
+
+
+static inline int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+
+static inline void sort_u64(uint64_t *samples, int n)
+{
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+}
+
+
+/*
+ * Nearest-rank percentile p of n sorted samples: the smallest sample with at least p% of the
+ * samples at or below it, i.e. sorted[ceil(p * n / 100) - 1].
+ */
+static inline uint64_t percentile(const uint64_t *sorted, int n, int p)
+{
+    int rank = (p * n + 99) / 100;
+
+    return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+#endif // BENCH_UTIL_H_
@@ -0,0 +1,76 @@
+/*
+ * Block transfer benchmark. Compares phantom_fpga_ip_set/get (one call per word) with
+ * phantom_fpga_ip_set_block/get_block over the same window and reports MB/s.
+ *
+ * Usage: block_bench <idstring> <axi_slave> <offset> <size>
+ * The range [offset, offset + size) must be backed by writable memory in the IP (e.g. a BRAM
+ * window), never the control registers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <phantom_api.h>
+#include "bench_util.h"
+
+#define BENCH_ITERS 1000
+
+
+int main(int argc, char *argv[]) {
+    phantom_ip_t *ip;
+    uint8_t slave;
+    uint32_t offset, size, len;
+    phantom_data_t *buf;
+    double t, mb;
+
+    if(argc != 5) {
+        printf("usage: %s <idstring> <axi_slave> <offset> <size>\n", argv[0]);
+        return -1;
+    }
+    if(phantom_initialise() != PHANTOM_OK) {
+        printf("Error during initialise.\n");
+        return -1;
+    }
+    if((ip = phantom_fpga_get_ip_from_idstr(argv[1])) == NULL) {
+        printf("No IP core named %s.\n", argv[1]);
+        return -1;
+    }
+    slave = (uint8_t) strtoul(argv[2], NULL, 0);
+    offset = (uint32_t) strtoul(argv[3], NULL, 0);
+    size = (uint32_t) strtoul(argv[4], NULL, 0);
+    buf = calloc(size / sizeof(phantom_data_t) + 1, sizeof(phantom_data_t));
+
+    printf("%10s %14s %14s %14s %14s\n", "bytes", "set MB/s", "set_block MB/s", "get MB/s", "get_block MB/s");
+    for(len = 64; len <= size; len *= 4) {
+        mb = (double) len * BENCH_ITERS / 1e6;
+        printf("%10u", len);
+
+        t = now_s();
+        for(int i = 0; i < BENCH_ITERS; i++)
+            for(uint32_t a = 0; a < len; a += sizeof(phantom_data_t))
+                phantom_fpga_ip_set(ip, offset + a, buf[a / sizeof(phantom_data_t)], slave);
+        printf(" %14.2f", mb / (now_s() - t));
+
+        t = now_s();
+        for(int i = 0; i < BENCH_ITERS; i++)
+            if(phantom_fpga_ip_set_block(ip, offset, buf, len, slave) != PHANTOM_OK) {
+                printf("\nset_block failed.\n");
+                return -1;
+            }
+        printf(" %14.2f", mb / (now_s() - t));
+
+        t = now_s();
+        for(int i = 0; i < BENCH_ITERS; i++)
+            for(uint32_t a = 0; a < len; a += sizeof(phantom_data_t))
+                buf[a / sizeof(phantom_data_t)] = phantom_fpga_ip_get(ip, offset + a, slave);
+        printf(" %14.2f", mb / (now_s() - t));
+
+        t = now_s();
+        for(int i = 0; i < BENCH_ITERS; i++)
+            phantom_fpga_ip_get_block(ip, offset, buf, len, slave);
+        printf(" %14.2f\n", mb / (now_s() - t));
+    }
+
+    free(buf);
+    phantom_terminate();
+    return 0;
+}
@@ -3,8 +3,9 @@
 cd ..
 make clean
 #We pass in the current directory to tell the library to load our config from this
-#directory rather than an absolute place on the rootfs
-make DEBUG=`pwd`/tests/
+#directory rather than an absolute place on the rootfs, and keep the configuration
+#snapshot it writes out of the tree
+make CC=gcc DEBUG=`pwd`/tests/ SNAPSHOT=/tmp/phantom_fpga_conf.bin
 cd tests
 
 #Compile the tests
@@ -12,3 +13,25 @@ export LIBRARY_PATH=`pwd`/../
 export LD_LIBRARY_PATH=`pwd`/../
 gcc -c -I../ xml_parse.c
 gcc xml_parse.o -lphantom -o xml_parse
+gcc -c -I../ xml_conf.c
+gcc xml_conf.o -lphantom -o xml_conf
+gcc -c -I../ registry.c
+gcc registry.o -lphantom -o registry
+gcc -c -I../ ip_bounds.c
+gcc ip_bounds.o -lphantom -o ip_bounds
+gcc -c -I../ snapshot.c
+gcc snapshot.o -lphantom -o snapshot
+gcc -c -O2 -I../ xml_parse_bench.c
+gcc xml_parse_bench.o -lphantom -o xml_parse_bench
+gcc -c -I../ block_bench.c
+gcc block_bench.o -lphantom -o block_bench
+gcc -c -O2 -I../ handle_bench.c
+gcc handle_bench.o -lphantom -o handle_bench
+gcc -c -O2 -I../ async_bench.c
+gcc async_bench.o -lphantom -lpthread -o async_bench
+gcc -c -O2 -I../ group_bench.c
+gcc group_bench.o -lphantom -lpthread -o group_bench
+gcc -c -O2 -I../ cache_bench.c
+gcc cache_bench.o -lphantom -o cache_bench
+gcc -c -O2 -I../ startup_bench.c
+gcc startup_bench.o -lphantom -lpthread -o startup_bench
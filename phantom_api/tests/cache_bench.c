@@ -0,0 +1,119 @@
+/*
+ * Shared memory cache benchmark. Measures CPU write and read bandwidth on a buffer in an IP's
+ * shared memory, first through the default uncached mapping, then cacheable with the
+ * phantom_fpga_mem_end_cpu_access()/begin_cpu_access() maintenance each hand-off needs included.
+ *
+ * Usage: cache_bench <idstring> [coherent]
+ * Buffer sizes run from 4 KiB up to 8 MiB, or the largest the IP's shared memory allows.
+ * Pass coherent as 1 if the IP's masters are cache coherent (ACP/HPC).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <phantom_api.h>
+#include "bench_util.h"
+
+#define BENCH_MIN_SIZE (4 << 10)
+#define BENCH_MAX_SIZE (8 << 20) // as the phantom_dummy_4 allocation in phantom_fpga_config.json
+#define BENCH_SIZES 12 // BENCH_MIN_SIZE to BENCH_MAX_SIZE in powers of 2
+#define BENCH_BYTES (64 << 20) // bytes moved per measurement
+
+
+static uint32_t checksum;
+
+
+/*
+ * One hand-off cycle per iteration: the CPU fills the buffer for the IP, then reads back what the
+ * IP wrote. Writes MB/s for each half to wr and rd.
+ */
+static void bench_size(phantom_ip_t *ip, uint32_t *buf, uint32_t len, int cached, double *wr, double *rd)
+{
+    int iters = (BENCH_BYTES / len) ? BENCH_BYTES / len : 1;
+    double t, mb = (double) len * iters / 1e6;
+
+    t = now_s();
+    for(int i = 0; i < iters; i++) {
+        memset(buf, i, len);
+        if(cached)
+            phantom_fpga_mem_end_cpu_access(ip, buf, len, PHANTOM_MEM_BIDIRECTIONAL);
+    }
+    *wr = mb / (now_s() - t);
+
+    t = now_s();
+    for(int i = 0; i < iters; i++) {
+        if(cached)
+            phantom_fpga_mem_begin_cpu_access(ip, buf, len, PHANTOM_MEM_FROM_DEVICE);
+        for(uint32_t w = 0; w < len / sizeof(uint32_t); w++)
+            checksum += buf[w];
+    }
+    *rd = mb / (now_s() - t);
+}
+
+
+static int bench_all(phantom_ip_t *ip, uint32_t max_len, int cached, double *wr, double *rd)
+{
+    uint32_t *buf;
+    int n = 0;
+
+    for(uint32_t len = BENCH_MIN_SIZE; len <= max_len; len *= 2, n++) {
+        if((buf = phantom_fpga_mem_alloc(ip, len)) == NULL) {
+            printf("Unable to allocate %u bytes.\n", len);
+            return -1;
+        }
+        bench_size(ip, buf, len, cached, &wr[n], &rd[n]);
+        phantom_fpga_mem_free(ip, buf);
+    }
+    return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+    double uc_wr[BENCH_SIZES], uc_rd[BENCH_SIZES], c_wr[BENCH_SIZES], c_rd[BENCH_SIZES];
+    phantom_mem_stats_t stats;
+    phantom_ip_t *ip;
+    uint32_t max_len, len;
+    int coherent = 0, cached;
+
+    if(argc != 2 && argc != 3) {
+        printf("usage: %s <idstring> [coherent]\n", argv[0]);
+        return -1;
+    }
+    if(argc == 3)
+        coherent = atoi(argv[2]);
+    if(phantom_initialise() != PHANTOM_OK) {
+        printf("Error during initialise.\n");
+        return -1;
+    }
+    if((ip = phantom_fpga_get_ip_from_idstr(argv[1])) == NULL) {
+        printf("No IP core named %s.\n", argv[1]);
+        return -1;
+    }
+    if(phantom_fpga_mem_get_stats(ip, &stats) != PHANTOM_OK) {
+        printf("%s has no shared memory.\n", argv[1]);
+        return -1;
+    }
+    for(max_len = BENCH_MAX_SIZE; max_len > stats.largest_free; max_len /= 2)
+        ;
+
+    if(bench_all(ip, max_len, 0, uc_wr, uc_rd))
+        return -1;
+    cached = (phantom_fpga_mem_set_cached(ip, coherent) == PHANTOM_OK);
+    if(!cached)
+        printf("Unable to map the shared memory of %s cacheable.\n", argv[1]);
+    else if(bench_all(ip, max_len, 1, c_wr, c_rd))
+        return -1;
+
+    printf("%10s %14s %14s %14s %14s\n", "bytes", "uc write MB/s", "uc read MB/s", "c write MB/s", "c read MB/s");
+    for(len = BENCH_MIN_SIZE; len <= max_len; len *= 2) {
+        int n = __builtin_ctz(len / BENCH_MIN_SIZE);
+        printf("%10u %14.2f %14.2f", len, uc_wr[n], uc_rd[n]);
+        if(cached)
+            printf(" %14.2f %14.2f", c_wr[n], c_rd[n]);
+        printf("\n");
+    }
+
+    printf("(checksum %u)\n", checksum);
+    phantom_terminate();
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Instance group benchmark. Submits jobs to every instance of an IP core through
+ * phantom_fpga_group_submit() and reports the completed jobs per second, and how many each
+ * instance ran.
+ *
+ * Usage: group_bench <ipname> <jobs>
+ * The instances are started with no arguments written, so they must be safe to run repeatedly as is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <phantom_api.h>
+#include "bench_util.h"
+
+
+static phantom_group_t *group;
+static unsigned long *ran; // jobs run per instance
+
+
+static void job_done(phantom_job_t *job)
+{
+    for(int i = 0; i < phantom_fpga_group_get_num_ips(group); i++)
+        if(phantom_fpga_group_get_ip(group, i) == job->ip)
+            __atomic_add_fetch(&ran[i], 1, __ATOMIC_RELAXED);
+}
+
+
+int main(int argc, char *argv[]) {
+    phantom_job_t *jobs;
+    int num_jobs;
+    double t0, secs;
+
+    if(argc != 3) {
+        printf("usage: %s <ipname> <jobs>\n", argv[0]);
+        return -1;
+    }
+    if(phantom_initialise() != PHANTOM_OK) {
+        printf("Error during initialise.\n");
+        return -1;
+    }
+    num_jobs = atoi(argv[2]);
+    if(num_jobs <= 0 || (jobs = calloc(num_jobs, sizeof(phantom_job_t))) == NULL)
+        return -1;
+    if((group = phantom_fpga_group_open(argv[1], 0)) == NULL) {
+        printf("Unable to open a group of %s cores.\n", argv[1]);
+        return -1;
+    }
+    if((ran = calloc(phantom_fpga_group_get_num_ips(group), sizeof(unsigned long))) == NULL)
+        return -1;
+
+    t0 = now_s();
+    for(int i = 0; i < num_jobs; i++) {
+        jobs[i].callback = job_done;
+        phantom_fpga_group_submit(group, &jobs[i], 1);
+    }
+    for(int i = 0; i < num_jobs; i++)
+        phantom_fpga_job_wait(&jobs[i], -1);
+    secs = now_s() - t0;
+    printf("%d jobs on %d instances in %.3f s: %.0f jobs/s\n", num_jobs, phantom_fpga_group_get_num_ips(group), secs, num_jobs / secs);
+    for(int i = 0; i < phantom_fpga_group_get_num_ips(group); i++)
+        printf("  %-30s %lu\n", phantom_fpga_group_get_ip(group, i)->idstring, ran[i]);
+
+    free(jobs);
+    free(ran);
+    phantom_fpga_group_close(group);
+    phantom_terminate();
+    return 0;
+}
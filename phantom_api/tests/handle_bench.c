@@ -0,0 +1,100 @@
+/*
+ * Register access benchmark. Reports CPU cycles per access for phantom_fpga_ip_get/set against
+ * the inline validated handle accessors. Cycles are read from the perf cycle counter; if that
+ * is not available the elapsed time in ns is printed instead.
+ *
+ * Usage: handle_bench <idstring> <axi_slave> <offset>
+ * offset must be a scratch register of the IP, never the control register at 0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <phantom_api.h>
+#include "bench_util.h"
+
+#define BENCH_ITERS 100000
+
+
+static int cycles_fd = -1;
+
+
+static uint64_t counter(void)
+{
+    uint64_t val;
+
+    if(cycles_fd >= 0 && read(cycles_fd, &val, sizeof(val)) == sizeof(val))
+        return val;
+    return now_ns();
+}
+
+
+int main(int argc, char *argv[]) {
+    struct perf_event_attr attr;
+    phantom_ip_t *ip;
+    phantom_ip_handle_t handle;
+    phantom_address_t offset;
+    uint8_t slave;
+    volatile phantom_data_t sink;
+    uint64_t t, get_api, set_api, get_handle, set_handle;
+
+    if(argc != 4) {
+        printf("usage: %s <idstring> <axi_slave> <offset>\n", argv[0]);
+        return -1;
+    }
+    if(phantom_initialise() != PHANTOM_OK) {
+        printf("Error during initialise.\n");
+        return -1;
+    }
+    if((ip = phantom_fpga_get_ip_from_idstr(argv[1])) == NULL) {
+        printf("No IP core named %s.\n", argv[1]);
+        return -1;
+    }
+    slave = (uint8_t) strtoul(argv[2], NULL, 0);
+    offset = (phantom_address_t) strtoul(argv[3], NULL, 0);
+    if(phantom_fpga_ip_get_handle(ip, slave, &handle) != PHANTOM_OK) {
+        printf("Unable to get handle.\n");
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    cycles_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+
+    t = counter();
+    for(int i = 0; i < BENCH_ITERS; i++)
+        sink = phantom_fpga_ip_get(ip, offset, slave);
+    get_api = counter() - t;
+
+    t = counter();
+    for(int i = 0; i < BENCH_ITERS; i++)
+        phantom_fpga_ip_set(ip, offset, i, slave);
+    set_api = counter() - t;
+
+    t = counter();
+    for(int i = 0; i < BENCH_ITERS; i++)
+        sink = phantom_handle_get(&handle, offset);
+    get_handle = counter() - t;
+
+    t = counter();
+    for(int i = 0; i < BENCH_ITERS; i++)
+        phantom_handle_set(&handle, offset, i);
+    set_handle = counter() - t;
+
+    printf("%s per access:\n", cycles_fd >= 0 ? "cycles" : "ns");
+    printf("  phantom_fpga_ip_get  %8.1f\n", (double) get_api / BENCH_ITERS);
+    printf("  phantom_handle_get   %8.1f\n", (double) get_handle / BENCH_ITERS);
+    printf("  phantom_fpga_ip_set  %8.1f\n", (double) set_api / BENCH_ITERS);
+    printf("  phantom_handle_set   %8.1f\n", (double) set_handle / BENCH_ITERS);
+
+    (void) sink;
+    phantom_terminate();
+    return 0;
+}
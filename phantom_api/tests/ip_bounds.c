@@ -0,0 +1,50 @@
+/*
+ * Bounds checks of phantom_fpga_ip_set() and phantom_fpga_ip_get(). Runs without hardware on a
+ * core whose slave 0 is backed by a local buffer and which has no slave 1.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <phantom_api.h>
+#include <phantom_api_lowlevel.h>
+
+#define S0_SIZE 64
+
+
+int main() {
+    phantom_data_t s0[S0_SIZE / sizeof(phantom_data_t)];
+    phantom_ip_t ip;
+
+    memset(&ip, 0, sizeof(ip));
+    memset(s0, 0, sizeof(s0));
+    ip.s0_vmem_base = s0;
+    ip.s0_axi_address_size = S0_SIZE;
+    ip.mapped = 1; // slave 1 is unused, so has no mapping and a size of 0
+
+    if((phantom_fpga_ip_set(&ip, 0, 1, 1) != PHANTOM_ERROR) || (phantom_fpga_ip_get(&ip, 0, 1) != 0)) {
+        printf("Access to a missing slave 1 was not rejected.\n");
+        return -1;
+    }
+
+    ip.s1_axi_address_size = sizeof(phantom_data_t) / 2;
+    ip.s1_vmem_base = s0;
+    if((phantom_fpga_ip_set(&ip, 0, 1, 1) != PHANTOM_ERROR) || (phantom_fpga_ip_get(&ip, 0, 1) != 0)) {
+        printf("Access to a slave smaller than a register was not rejected.\n");
+        return -1;
+    }
+
+    if((phantom_fpga_ip_set(&ip, S0_SIZE - sizeof(phantom_data_t) + 1, 1, 0) != PHANTOM_ERROR) ||
+       (phantom_fpga_ip_set(&ip, S0_SIZE, 1, 0) != PHANTOM_ERROR)) {
+        printf("Access past the end of slave 0 was not rejected.\n");
+        return -1;
+    }
+
+    if((phantom_fpga_ip_set(&ip, S0_SIZE - sizeof(phantom_data_t), 0x5a, 0) != PHANTOM_OK) ||
+       (phantom_fpga_ip_get(&ip, S0_SIZE - sizeof(phantom_data_t), 0) != 0x5a)) {
+        printf("Access to the last register of slave 0 failed.\n");
+        return -1;
+    }
+
+    printf("ip_set/ip_get bounds ok\n");
+    return 0;
+}
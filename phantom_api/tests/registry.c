@@ -0,0 +1,90 @@
+/*
+ * Checks of the component registry. Runs without hardware on a generated design with more
+ * components than MAX_PHANTOM_COMPONENTS, so the component arrays must grow, and with ipnames
+ * shared by several components.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <phantom_api.h>
+#include <phantom_api_lowlevel.h>
+
+#define NUM_COMPS (4 * MAX_PHANTOM_COMPONENTS + 3)
+#define NUM_NAMES 7 // component i has ipname i % NUM_NAMES
+#define ID_BASE 1000
+
+
+static int write_design(FILE *fp) {
+    fprintf(fp, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<?phantom conf file version=\"0.1\"?>\n");
+    fprintf(fp, "<phantom_fpga>\n  <fpga_type>zynq_apsoc</fpga_type>\n  <target_board>debug</target_board>\n");
+    for(int i = 0; i < NUM_COMPS; i++) {
+        fprintf(fp, "  <component_inst>\n    <name>ph_ip_%d</name>\n    <id>%d</id>\n    <ipname>ph_name_%d</ipname>\n", i, ID_BASE + 7 * i, i % NUM_NAMES);
+        fprintf(fp, "    <num_masters>0</num_masters>\n    <slave_addr_base_0>0x%x</slave_addr_base_0>\n", 0x40000000 + (i << 16));
+        fprintf(fp, "    <slave_addr_range_0>0x1000</slave_addr_range_0>\n  </component_inst>\n");
+    }
+    fprintf(fp, "</phantom_fpga>\n");
+    return ferror(fp) ? -1 : 0;
+}
+
+
+int main() {
+    char key[MAX_XMLTXT_LEN];
+    phantom_conf_t conf;
+    phantom_ip_t *ip;
+    FILE *fp;
+    int ret;
+
+    memset(&conf, 0, sizeof(conf));
+    if(((fp = tmpfile()) == NULL) || write_design(fp)) {
+        printf("Unable to write the test design.\n");
+        return -1;
+    }
+    ret = phantom_conf(fp, &conf);
+    fclose(fp);
+    if(ret || (conf.num_comps != NUM_COMPS) || (conf.max_comps < NUM_COMPS)) {
+        printf("Parsed %u of %d components.\n", conf.num_comps, NUM_COMPS);
+        return -1;
+    }
+
+    for(int i = 0; i < NUM_COMPS; i++) {
+        if((phantom_conf_find_id(&conf, ID_BASE + 7 * i) != &conf.comp[i]) || (get_phantom_component(&conf, i) != &conf.comp[i])) {
+            printf("Component %d not found by its id.\n", i);
+            return -1;
+        }
+        snprintf(key, sizeof(key), "ph_ip_%d", i);
+        if(phantom_conf_find_idstr(&conf, key) != &conf.comp[i]) {
+            printf("Component %d not found by its idstring.\n", i);
+            return -1;
+        }
+        if(conf.comp[i].s0_axi_base_address != (phantom_address_t) (0x40000000 + (i << 16))) {
+            printf("Component %d has the wrong slave address.\n", i);
+            return -1;
+        }
+    }
+    if((phantom_conf_find_id(&conf, ID_BASE + 1) != NULL) || (phantom_conf_find_idstr(&conf, "ph_ip_missing") != NULL) ||
+       (phantom_conf_find_name(&conf, "ph_name_missing") != NULL)) {
+        printf("A missing component was found.\n");
+        return -1;
+    }
+
+    /* each ipname finds its first component, and the rest follow in design order */
+    for(int n = 0; n < NUM_NAMES; n++) {
+        int i = n;
+
+        snprintf(key, sizeof(key), "ph_name_%d", n);
+        for(ip = phantom_conf_find_name(&conf, key); ip != NULL; ip = phantom_conf_next_name(&conf, ip), i += NUM_NAMES) {
+            if(ip != &conf.comp[i]) {
+                printf("Components named %s out of order at component %d.\n", key, i);
+                return -1;
+            }
+        }
+        if(i < NUM_COMPS) {
+            printf("Components named %s stop at component %d.\n", key, i);
+            return -1;
+        }
+    }
+
+    phantom_conf_free(&conf);
+    printf("registry lookups ok\n");
+    return 0;
+}
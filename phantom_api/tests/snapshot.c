@@ -0,0 +1,186 @@
+/*
+ * Checks of the configuration snapshot. Runs without hardware: the test design's XML is parsed,
+ * saved to a snapshot and loaded back, then the snapshot is made stale and corrupted. All files
+ * written are kept in a temporary directory, so the tree is left as it was.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <phantom_api.h>
+#include <phantom_api_lowlevel.h>
+
+#define CONF_XML "fpga/conf/phantom_fpga_conf.xml"
+
+
+static int parse_xml(const char *xml_file, phantom_conf_t *conf) {
+    FILE *fp;
+    int ret;
+
+    if((fp = fopen(xml_file, "r")) == NULL)
+        return -1;
+    ret = phantom_conf(fp, conf);
+    fclose(fp);
+    return ret;
+}
+
+
+static int copy_file(const char *from, const char *to) {
+    char buf[4096];
+    FILE *in, *out;
+    size_t len;
+    int ret = 0;
+
+    if((in = fopen(from, "r")) == NULL)
+        return -1;
+    if((out = fopen(to, "w")) == NULL) {
+        fclose(in);
+        return -1;
+    }
+    while((len = fread(buf, 1, sizeof(buf), in)) > 0)
+        if(fwrite(buf, 1, len, out) != len)
+            ret = -1;
+    fclose(in);
+    if(fclose(out))
+        ret = -1;
+    return ret;
+}
+
+
+/* Returns 0 if both configurations hold the same design, else -1. */
+static int conf_equal(phantom_conf_t *a, phantom_conf_t *b) {
+    if((a->num_comps != b->num_comps) || (a->num_intcs != b->num_intcs))
+        return -1;
+    if(strcmp(a->fpga_type, b->fpga_type) || strcmp(a->fpga_device, b->fpga_device) || strcmp(a->fpga_board, b->fpga_board) ||
+       strcmp(a->design_name, b->design_name) || strcmp(a->design_bitfile, b->design_bitfile))
+        return -1;
+    for(uint32_t i = 0; i < a->num_comps; i++) {
+        phantom_ip_t *x = &a->comp[i], *y = &b->comp[i];
+
+        if(strcmp(x->idstring, y->idstring) || strcmp(x->ipname, y->ipname) ||
+           strcmp(a->comp_str[i].uio_slave, b->comp_str[i].uio_slave) || strcmp(a->comp_str[i].uio_master, b->comp_str[i].uio_master))
+            return -1;
+        if((x->id != y->id) || (x->num_axi_masters != y->num_axi_masters) ||
+           (x->s0_axi_base_address != y->s0_axi_base_address) || (x->s0_axi_address_size != y->s0_axi_address_size) ||
+           (x->s1_axi_base_address != y->s1_axi_base_address) || (x->s1_axi_address_size != y->s1_axi_address_size) ||
+           (x->m0_axi_base_address != y->m0_axi_base_address) || (x->m0_axi_address_size != y->m0_axi_address_size))
+            return -1;
+        if((phantom_conf_find_idstr(b, x->idstring) != y) || (phantom_conf_find_id(b, x->id) == NULL))
+            return -1;
+    }
+    for(uint32_t i = 0; i < a->num_intcs; i++) {
+        if(strcmp(a->intc[i].name, b->intc[i].name) || strcmp(a->intc[i].ipname, b->intc[i].ipname) ||
+           (a->intc[i].id != b->intc[i].id) || (a->intc[i].irq_port != b->intc[i].irq_port) || (a->intc[i].reg_addr != b->intc[i].reg_addr))
+            return -1;
+    }
+    return 0;
+}
+
+
+static int run(const char *dir) {
+    char xml[256], snap[256];
+    phantom_conf_t parsed, loaded;
+    struct stat st;
+    struct timespec times[2];
+    uint8_t byte;
+    FILE *fp;
+    int fd;
+
+    memset(&parsed, 0, sizeof(parsed));
+    memset(&loaded, 0, sizeof(loaded));
+    snprintf(xml, sizeof(xml), "%s/phantom_fpga_conf.xml", dir);
+    snprintf(snap, sizeof(snap), "%s/phantom_fpga_conf.bin", dir);
+
+    if(copy_file(CONF_XML, xml) || parse_xml(xml, &parsed)) {
+        printf("Unable to parse %s.\n", CONF_XML);
+        return -1;
+    }
+    if(parsed.num_comps == 0) {
+        printf("No components parsed from %s.\n", CONF_XML);
+        return -1;
+    }
+
+    /* round trip */
+    if(snapshot_save(&parsed, xml, snap)) {
+        printf("Unable to save the snapshot.\n");
+        return -1;
+    }
+    if(snapshot_load(&loaded, xml, snap) || conf_equal(&parsed, &loaded)) {
+        printf("The loaded snapshot does not match the parsed XML.\n");
+        return -1;
+    }
+
+    /* a snapshot with no XML, or of a newer XML, is not used */
+    if(snapshot_load(&loaded, "missing.xml", snap) != -1) {
+        printf("A snapshot without its XML was loaded.\n");
+        return -1;
+    }
+    if(stat(xml, &st)) {
+        printf("Unable to stat %s.\n", xml);
+        return -1;
+    }
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+    times[1].tv_sec += 1;
+    if(utimensat(AT_FDCWD, xml, times, 0) || (snapshot_load(&loaded, xml, snap) != -1)) {
+        printf("A snapshot older than its XML's modification time was loaded.\n");
+        return -1;
+    }
+    times[1] = st.st_mtim;
+    if(((fp = fopen(xml, "a")) == NULL) || (fputc('\n', fp) == EOF) || fclose(fp) ||
+       utimensat(AT_FDCWD, xml, times, 0) || (snapshot_load(&loaded, xml, snap) != -1)) {
+        printf("A snapshot of an XML of another size was loaded.\n");
+        return -1;
+    }
+
+    /* a snapshot that fails its checksum is not used */
+    if(parse_xml(xml, &parsed) || snapshot_save(&parsed, xml, snap) || snapshot_load(&loaded, xml, snap)) {
+        printf("Unable to save and load the snapshot again.\n");
+        return -1;
+    }
+    if(stat(snap, &st) || ((fd = open(snap, O_RDWR)) < 0)) {
+        printf("Unable to open %s.\n", snap);
+        return -1;
+    }
+    if((pread(fd, &byte, 1, st.st_size - 1) != 1) || ((byte ^= 0xff), pwrite(fd, &byte, 1, st.st_size - 1) != 1)) {
+        close(fd);
+        printf("Unable to corrupt %s.\n", snap);
+        return -1;
+    }
+    close(fd);
+    if(snapshot_load(&loaded, xml, snap) != -1) {
+        printf("A snapshot failing its checksum was loaded.\n");
+        return -1;
+    }
+
+    phantom_conf_free(&parsed);
+    phantom_conf_free(&loaded);
+    return 0;
+}
+
+
+int main() {
+    char dir[] = "/tmp/phantom_snapshot_XXXXXX";
+    char path[sizeof(dir) + 32];
+    int ret;
+
+    if(mkdtemp(dir) == NULL) {
+        printf("Unable to create a temporary directory.\n");
+        return -1;
+    }
+    ret = run(dir);
+
+    snprintf(path, sizeof(path), "%s/phantom_fpga_conf.xml", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/phantom_fpga_conf.bin", dir);
+    unlink(path);
+    rmdir(dir);
+
+    if(ret)
+        return -1;
+    printf("snapshot round trip, staleness and checksum ok\n");
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Start-up benchmark. Runs cold and warm start-up sequences repeatedly with start-up timing on,
+ * and reports percentiles of each phase from phantom_get_startup_timing(), and of the whole
+ * sequence.
+ *
+ * A cold start downloads the platform file if one is given, removes the configuration snapshot,
+ * does not use phantomd, initialises, configures the FPGA if asked and starts the IP if one is
+ * given. A warm start initialises with the snapshot in place, through phantomd if it is running,
+ * and starts the IP. With -f the page cache is dropped before each cold start, which needs root.
+ *
+ * Usage: startup_bench [-n iterations] [-d platform.tar.gz] [-c] [-f] [-i idstring]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <phantom_api.h>
+#include <phantom_api_lowlevel.h>
+#include "bench_util.h"
+
+#define BENCH_DEFAULT_ITERS 20
+#define BENCH_TOTAL PHANTOM_NUM_PHASES // index of the whole sequence in the samples
+
+
+static const char *phase_names[PHANTOM_NUM_PHASES + 1] = {
+    "download", "configure", "initialise", "attach", "conf", "open_devs", "map", "first_start", "total"
+};
+
+static int iters = BENCH_DEFAULT_ITERS;
+static const char *platform_file;
+static const char *idstring;
+static int configure, flush;
+
+
+static void drop_caches(void)
+{
+    int fd;
+
+    sync();
+    if(((fd = open("/proc/sys/vm/drop_caches", O_WRONLY)) < 0) || (write(fd, "3", 1) != 1))
+        printf("Unable to drop the page cache.\n");
+    if(fd >= 0)
+        close(fd);
+}
+
+
+/*
+ * Run one start-up sequence, filling samples[phase] with each phase's total time, and
+ * samples[BENCH_TOTAL] with the time of the whole sequence. Returns 0 on success, -1 on fail.
+ */
+static int run(int cold, uint64_t *samples)
+{
+    phantom_phase_timing_t phases[PHANTOM_NUM_PHASES];
+    phantom_ip_t *ip;
+    uint64_t t;
+    int fd, ret = 0;
+
+    if(cold) {
+        unlink(SD_CARD_PHANTOM_FPGA_SNAPSHOT_FILE);
+        if(flush)
+            drop_caches();
+    }
+    phantom_set_use_daemon(!cold);
+    phantom_set_startup_timing(1);
+    t = now_ns();
+
+    if(cold && platform_file) {
+        if((fd = open(platform_file, O_RDONLY)) < 0)
+            return -1;
+        ret = phantom_download(fd);
+        close(fd);
+    }
+    if(!ret)
+        ret = phantom_initialise();
+    if(!ret && cold && configure)
+        ret = phantom_fpga_configure(); // finds the bitfile from the initialised configuration
+    if(!ret && idstring) {
+        if((ip = phantom_fpga_get_ip_from_idstr(idstring)) == NULL)
+            ret = -1;
+        else
+            ret = phantom_fpga_ip_start(ip);
+    }
+
+    samples[BENCH_TOTAL] = now_ns() - t;
+    phantom_terminate();
+    phantom_set_startup_timing(0);
+    if(ret)
+        return -1;
+
+    phantom_get_startup_timing(phases, PHANTOM_NUM_PHASES);
+    for(int p = 0; p < PHANTOM_NUM_PHASES; p++)
+        samples[p] = phases[p].total_ns;
+    /* the first start is a point in time, report it from the start of the sequence */
+    samples[PHANTOM_PHASE_FIRST_START] = phases[PHANTOM_PHASE_FIRST_START].count ? phases[PHANTOM_PHASE_FIRST_START].end_ns - t : 0;
+    return 0;
+}
+
+
+static void report(const char *name, uint64_t *samples, int num)
+{
+    uint64_t *sorted = malloc(num * sizeof(uint64_t));
+
+    printf("%s start, %d runs\n", name, num);
+    printf("%12s %12s %12s %12s %12s\n", "phase", "p50 us", "p90 us", "p99 us", "max us");
+    for(int p = 0; p <= PHANTOM_NUM_PHASES; p++) {
+        int n = 0;
+        for(int i = 0; i < num; i++)
+            sorted[n++] = samples[i * (PHANTOM_NUM_PHASES + 1) + p];
+        sort_u64(sorted, n);
+        if(sorted[n - 1] == 0)
+            continue; // phase did not run
+        printf("%12s %12.1f %12.1f %12.1f %12.1f\n", phase_names[p], percentile(sorted, n, 50) / 1e3,
+                percentile(sorted, n, 90) / 1e3, percentile(sorted, n, 99) / 1e3, sorted[n - 1] / 1e3);
+    }
+    free(sorted);
+}
+
+
+int main(int argc, char *argv[]) {
+    uint64_t *cold, *warm;
+    int opt, num_cold = 0, num_warm = 0;
+
+    while((opt = getopt(argc, argv, "n:d:cfi:")) != -1) {
+        switch(opt) {
+        case 'n':
+            iters = atoi(optarg);
+            break;
+        case 'd':
+            platform_file = optarg;
+            break;
+        case 'c':
+            configure = 1;
+            break;
+        case 'f':
+            flush = 1;
+            break;
+        case 'i':
+            idstring = optarg;
+            break;
+        default:
+            printf("usage: %s [-n iterations] [-d platform.tar.gz] [-c] [-f] [-i idstring]\n", argv[0]);
+            return -1;
+        }
+    }
+    if(iters < 1)
+        iters = 1;
+    cold = calloc(iters * (PHANTOM_NUM_PHASES + 1), sizeof(uint64_t));
+    warm = calloc(iters * (PHANTOM_NUM_PHASES + 1), sizeof(uint64_t));
+    if((cold == NULL) || (warm == NULL))
+        return -1;
+
+    /* alternate, so each warm start follows a cold one that rebuilt the snapshot */
+    for(int i = 0; i < iters; i++) {
+        if(run(1, &cold[num_cold * (PHANTOM_NUM_PHASES + 1)]) == 0)
+            num_cold++;
+        if(run(0, &warm[num_warm * (PHANTOM_NUM_PHASES + 1)]) == 0)
+            num_warm++;
+    }
+    if((num_cold == 0) || (num_warm == 0)) {
+        printf("Start-up failed.\n");
+        return -1;
+    }
+    report("cold", cold, num_cold);
+    printf("\n");
+    report("warm", warm, num_warm);
+    free(cold);
+    free(warm);
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Checks of the XML configuration parser. Runs without hardware on the test design, whose values
+ * are checked field by field, and on malformed designs, which must be rejected.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <phantom_api.h>
+#include <phantom_api_lowlevel.h>
+
+#define CONF_XML "fpga/conf/phantom_fpga_conf.xml"
+
+typedef struct {
+    const char *idstring;
+    uint32_t id;
+    const char *ipname; // written over several lines for ph_ip_axi_colfilter_0
+    uint8_t num_masters;
+    phantom_address_t s0_base;
+    uint32_t s0_size;
+    phantom_address_t s1_base;
+    uint32_t s1_size;
+    phantom_address_t m0_base;
+    uint32_t m0_size;
+    const char *uio_slave;
+    const char *uio_master;
+} expected_comp_t;
+
+static const expected_comp_t expected_comps[] = {
+    {"ph_ip_axi_mac32_0", 5001, "ph_ip_axi_mac32", 4, 0x40000000, 0x1000, 0, 0, 0x30000000, 0x1000000, "ph_ip_axi_mac32_0_s", "ph_ip_axi_mac32_0_m"},
+    {"ph_ip_axi_comparitor32_0", 6402, "ph_ip_axi_comparitor32", 6, 0x41000000, 0x1000, 0, 0, 0, 0, "", ""},
+    {"ph_ip_axi_colfilter_0", 3808, "axi_multiplier", 7, 0x42000000, 0x10000, 0x80000000, 0x1000, 0, 0, "", ""}
+};
+
+static const phantom_intc_t expected_intcs[] = {
+    {"axi_intc_0", "intc", 0, 0, 0x4f000000},
+    {"axi_intc_1", "intc", 0, 1, 0x8f000000}
+};
+
+#define NUM_COMPS (sizeof(expected_comps) / sizeof(expected_comps[0]))
+#define NUM_INTCS (sizeof(expected_intcs) / sizeof(expected_intcs[0]))
+
+
+static int check_design(phantom_conf_t *conf) {
+    if((conf->num_comps != NUM_COMPS) || (conf->num_intcs != NUM_INTCS)) {
+        printf("Parsed %u components and %u interrupt controllers.\n", conf->num_comps, conf->num_intcs);
+        return -1;
+    }
+    if(strcmp(conf->fpga_type, "zynq_apsoc") || strcmp(conf->fpga_device, "xc7z010clg400") || strcmp(conf->fpga_board, "debug") ||
+       strcmp(conf->design_name, "phantom_colmatrix") || strcmp(conf->design_bitfile, "phantom_colmatrix.bit")) {
+        printf("Platform information parsed wrongly.\n");
+        return -1;
+    }
+    for(uint32_t i = 0; i < NUM_COMPS; i++) {
+        const expected_comp_t *e = &expected_comps[i];
+        phantom_ip_t *ip = &conf->comp[i];
+
+        if(strcmp(ip->idstring, e->idstring) || strcmp(ip->ipname, e->ipname) || (ip->id != e->id) || (ip->num_axi_masters != e->num_masters)) {
+            printf("Component %u, %s, has the wrong name or id.\n", i, e->idstring);
+            return -1;
+        }
+        if((ip->s0_axi_base_address != e->s0_base) || (ip->s0_axi_address_size != e->s0_size) ||
+           (ip->s1_axi_base_address != e->s1_base) || (ip->s1_axi_address_size != e->s1_size) ||
+           (ip->m0_axi_base_address != e->m0_base) || (ip->m0_axi_address_size != e->m0_size)) {
+            printf("Component %s has the wrong address map.\n", e->idstring);
+            return -1;
+        }
+        if(strcmp(conf->comp_str[i].uio_slave, e->uio_slave) || strcmp(conf->comp_str[i].uio_master, e->uio_master)) {
+            printf("Component %s has the wrong uio names.\n", e->idstring);
+            return -1;
+        }
+    }
+    for(uint32_t i = 0; i < NUM_INTCS; i++) {
+        const phantom_intc_t *e = &expected_intcs[i];
+
+        if(strcmp(conf->intc[i].name, e->name) || strcmp(conf->intc[i].ipname, e->ipname) || (conf->intc[i].id != e->id) ||
+           (conf->intc[i].irq_port != e->irq_port) || (conf->intc[i].reg_addr != e->reg_addr)) {
+            printf("Interrupt controller %s parsed wrongly.\n", e->name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/* Returns what phantom_conf() returns for the given XML. */
+static int parse_string(const char *xml, phantom_conf_t *conf) {
+    FILE *fp;
+    int ret;
+
+    if((fp = tmpfile()) == NULL)
+        return 0;
+    fputs(xml, fp);
+    ret = phantom_conf(fp, conf);
+    fclose(fp);
+    return ret;
+}
+
+
+int main() {
+    phantom_conf_t conf;
+    FILE *fp;
+    int ret;
+
+    memset(&conf, 0, sizeof(conf));
+    if((fp = fopen(CONF_XML, "r")) == NULL) {
+        printf("Unable to open %s.\n", CONF_XML);
+        return -1;
+    }
+    ret = phantom_conf(fp, &conf);
+    fclose(fp);
+    if(ret || check_design(&conf)) {
+        printf("%s was not parsed as expected.\n", CONF_XML);
+        return -1;
+    }
+
+    if(parse_string("<?xml version=\"1.0\"?>\n<?phantom conf file version=\"0.2\"?>\n<phantom_fpga>\n</phantom_fpga>\n", &conf) != -1) {
+        printf("A design of another conf file version was not rejected.\n");
+        return -1;
+    }
+    if(parse_string("<?phantom conf file version=\"0.1\"?>\n<phantom_fpga>\n<component_inst>\n<name>a</ipname>\n</component_inst>\n</phantom_fpga>\n", &conf) != -1) {
+        printf("A design with mismatched tags was not rejected.\n");
+        return -1;
+    }
+    if(parse_string("<?phantom conf file version=\"0.1\"?>\n<phantom_fpga>\n<component_inst>\n<name>a</name>\n</component_inst>\n", &conf) != -1) {
+        printf("A design missing </phantom_fpga> was not rejected.\n");
+        return -1;
+    }
+
+    phantom_conf_free(&conf);
+    printf("xml conf parse ok\n");
+    return 0;
+}
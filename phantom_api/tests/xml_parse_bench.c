@@ -0,0 +1,109 @@
+/*
+ * XML configuration parse benchmark. Generates synthetic phantom_fpga_conf.xml files with a
+ * growing number of components, every field of the schema filled in, and times phantom_conf()
+ * over each from memory, so only the parser is measured.
+ *
+ * Usage: xml_parse_bench [num_comps ...]
+ * The default sizes are 1, 10, 30, 100, 300 and 1000 components.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <phantom_api.h>
+#include <phantom_api_lowlevel.h>
+#include "bench_util.h"
+
+#define BENCH_PARSE_BYTES (64 << 20) // XML parsed per measurement
+#define BENCH_DEFAULT_SIZES {1, 10, 30, 100, 300, 1000}
+
+
+/*
+ * Write a configuration with num_comps components and two interrupt controllers, laid out as
+ * arch/build_project.tcl writes them. Returns the XML, to be freed by the caller.
+ */
+static char *make_conf(int num_comps, size_t *len)
+{
+    char *xml;
+    FILE *fp;
+
+    if((fp = open_memstream(&xml, len)) == NULL)
+        return NULL;
+    fprintf(fp, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+    fprintf(fp, "<?phantom conf file version=\"0.1\"?>\n");
+    fprintf(fp, "<!--\nFilename: phantom_fpga_conf.xml\nCreated by xml_parse_bench\n-->\n");
+    fprintf(fp, "<phantom_fpga>\n");
+    fprintf(fp, "\t<fpga_type>zynq_apsoc</fpga_type>\n");
+    fprintf(fp, "\t<target_device>xc7z020clg484-1</target_device>\n");
+    fprintf(fp, "\t<target_board>zedboard</target_board>\n");
+    fprintf(fp, "\t<design_name>bench_design</design_name>\n");
+    fprintf(fp, "\t<design_bitfile>bench_design.bit</design_bitfile>\n");
+    for(int i = 0; i < num_comps; i++) {
+        fprintf(fp, "\t<component_inst>\n");
+        fprintf(fp, "\t\t<name>bench_ip_%d</name>\n", i);
+        fprintf(fp, "\t\t<id>%d</id>\n", 1000 + i);
+        fprintf(fp, "\t\t<ipname>bench_ip</ipname>\n");
+        fprintf(fp, "\t\t<num_masters>1</num_masters>\n");
+        fprintf(fp, "\t\t<uio_name_slave>bench_ip_%d_slave</uio_name_slave>\n", i);
+        fprintf(fp, "\t\t<uio_name_master>bench_ip_%d_master</uio_name_master>\n", i);
+        fprintf(fp, "\t\t<slave_addr_base_0>0x%X</slave_addr_base_0>\n", 0x43C00000 + (i << 16));
+        fprintf(fp, "\t\t<slave_addr_range_0>0x10000</slave_addr_range_0>\n");
+        fprintf(fp, "\t\t<master_addr_base_0>0x%X</master_addr_base_0>\n", 0x20000000 + (i << 20));
+        fprintf(fp, "\t\t<master_addr_range_0>0x100000</master_addr_range_0>\n");
+        fprintf(fp, "\t</component_inst>\n");
+    }
+    for(int i = 0; i < 2; i++) {
+        fprintf(fp, "\t<interrupt_ctrl_inst>\n");
+        fprintf(fp, "\t\t<name>axi_intc_%d</name>\n", i);
+        fprintf(fp, "\t\t<ipname>intc</ipname>\n");
+        fprintf(fp, "\t\t<id>0</id>\n");
+        fprintf(fp, "\t\t<irq_port>%d</irq_port>\n", i);
+        fprintf(fp, "\t\t<reg_addr>0x%X</reg_addr>\n", 0x41800000 + (i << 16));
+        fprintf(fp, "\t</interrupt_ctrl_inst>\n");
+    }
+    fprintf(fp, "</phantom_fpga>\n");
+    fclose(fp);
+    return xml;
+}
+
+
+int main(int argc, char *argv[]) {
+    int default_sizes[] = BENCH_DEFAULT_SIZES;
+    int num_sizes = (argc > 1) ? argc - 1 : (int)(sizeof(default_sizes) / sizeof(int));
+    static phantom_conf_t conf;
+
+    printf("%10s %10s %10s %12s %12s %10s\n", "comps", "bytes", "parses", "us/parse", "ns/comp", "MB/s");
+    for(int s = 0; s < num_sizes; s++) {
+        int num_comps = (argc > 1) ? atoi(argv[s + 1]) : default_sizes[s];
+        size_t len;
+        char *xml = make_conf(num_comps, &len);
+        FILE *fp;
+        int iters, ret;
+        double t;
+
+        if((xml == NULL) || ((fp = fmemopen(xml, len, "r")) == NULL)) {
+            printf("Unable to generate a configuration of %d components.\n", num_comps);
+            return -1;
+        }
+
+        ret = phantom_conf(fp, &conf);
+        if((ret != 0) || ((int) conf.num_comps != num_comps)) {
+            printf("%10d %10zu   rejected\n", num_comps, len);
+            fclose(fp);
+            free(xml);
+            continue;
+        }
+
+        iters = (BENCH_PARSE_BYTES / len) ? BENCH_PARSE_BYTES / len : 1;
+        t = now_s();
+        for(int i = 0; i < iters; i++)
+            ret |= phantom_conf(fp, &conf);
+        t = now_s() - t;
+
+        printf("%10d %10zu %10d %12.2f %12.1f %10.1f%s\n", num_comps, len, iters, t * 1e6 / iters,
+                t * 1e9 / iters / (num_comps ? num_comps : 1), (double) len * iters / 1e6 / t, ret ? " (errors)" : "");
+        fclose(fp);
+        free(xml);
+    }
+    return 0;
+}